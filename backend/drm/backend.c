@@ -14,6 +14,7 @@
 #include "backend/drm/drm.h"
 #include "backend/drm/fb.h"
 #include "render/drm_format_set.h"
+#include "util/env.h"
 
 struct wlr_drm_backend *get_drm_backend_from_backend(
 		struct wlr_backend *wlr_backend) {
@@ -41,6 +42,8 @@ static void backend_destroy(struct wlr_backend *backend) {
 		destroy_drm_connector(conn);
 	}
 
+	finish_drm_queued_commits(drm);
+
 	struct wlr_drm_page_flip *page_flip, *page_flip_tmp;
 	wl_list_for_each_safe(page_flip, page_flip_tmp, &drm->page_flips, link) {
 		drm_page_flip_destroy(page_flip);
@@ -64,6 +67,7 @@ static void backend_destroy(struct wlr_backend *backend) {
 	wl_list_for_each_safe(fb, fb_tmp, &drm->fbs, link) {
 		drm_fb_destroy(fb);
 	}
+	drm_fb_cache_finish(drm);
 
 	free(drm->name);
 	wlr_session_close_file(drm->session, drm->dev);
@@ -240,12 +244,15 @@ struct wlr_backend *wlr_drm_backend_create(struct wlr_session *session,
 
 	drm->session = session;
 	wl_list_init(&drm->fbs);
+	wl_list_init(&drm->fb_cache);
 	wl_list_init(&drm->connectors);
 	wl_list_init(&drm->page_flips);
+	wl_list_init(&drm->queued_commits);
 
 	drm->dev = dev;
 	drm->fd = dev->fd;
 	drm->name = name;
+	drm->fb_cache_max = env_parse_uint("WLR_DRM_FB_CACHE_SIZE", 16);
 
 	if (parent != NULL) {
 		drm->parent = get_drm_backend_from_backend(parent);
@@ -30,6 +30,7 @@
 #include "render/wlr_renderer.h"
 #include "types/wlr_output.h"
 #include "util/env.h"
+#include "util/trace.h"
 #include "config.h"
 
 #if HAVE_LIBLIFTOFF
@@ -127,6 +128,19 @@ bool check_drm_features(struct wlr_drm_backend *drm) {
 		drm->backend.features.timeline = drmGetCap(drm->fd, DRM_CAP_SYNCOBJ_TIMELINE, &cap) == 0 && cap == 1;
 	}
 
+	if (env_parse_bool("WLR_DRM_COALESCE_COMMITS")) {
+		if (drm->iface == &atomic_iface) {
+			drm->coalesce_commits = true;
+			drm->coalesce_window_msec =
+				env_parse_uint("WLR_DRM_COALESCE_WINDOW_MS", 0);
+			wlr_log(WLR_INFO, "WLR_DRM_COALESCE_COMMITS set, "
+				"submitting page-flips of all connectors together");
+		} else {
+			wlr_log(WLR_ERROR, "WLR_DRM_COALESCE_COMMITS set, but page-flips "
+				"can only be coalesced with the atomic DRM interface");
+		}
+	}
+
 	if (env_parse_bool("WLR_DRM_NO_MODIFIERS")) {
 		wlr_log(WLR_DEBUG, "WLR_DRM_NO_MODIFIERS set, disabling modifiers");
 	} else {
@@ -626,7 +640,9 @@ static bool drm_commit(struct wlr_drm_backend *drm,
 		page_flip->async = (flags & DRM_MODE_PAGE_FLIP_ASYNC);
 	}
 
+	TRACE_BEGIN("drm_commit");
 	bool ok = drm->iface->commit(drm, state, page_flip, flags, test_only);
+	TRACE_END("drm_commit");
 	if (ok && !test_only) {
 		for (size_t i = 0; i < state->connectors_len; i++) {
 			drm_connector_apply_commit(&state->connectors[i], page_flip);
@@ -892,6 +908,252 @@ static bool drm_connector_prepare(struct wlr_drm_connector_state *conn_state, bo
 	return true;
 }
 
+static void drm_connector_drop_queued_commit(struct wlr_drm_connector *conn) {
+	struct wlr_drm_queued_commit *queued = conn->queued_commit;
+	if (queued == NULL) {
+		return;
+	}
+
+	conn->queued_commit = NULL;
+	wl_list_remove(&queued->link);
+	drm_connector_state_finish(&queued->state);
+	wlr_output_state_finish(&queued->base);
+	free(queued);
+}
+
+static void handle_dropped_frame_idle(void *data) {
+	struct wlr_drm_connector *conn = data;
+	conn->dropped_frame_idle = NULL;
+	wlr_output_send_frame(&conn->output);
+}
+
+/**
+ * Notify the compositor that a queued page-flip won't make it to the screen.
+ * The frame event is sent from an idle callback because queued page-flips may
+ * be flushed while another output is being committed.
+ */
+static void drm_connector_drop_frame(struct wlr_drm_connector *conn) {
+	struct wlr_output_event_present present_event = {
+		.commit_seq = conn->output.commit_seq,
+		.presented = false,
+	};
+	wlr_output_send_present(&conn->output, &present_event);
+
+	if (conn->dropped_frame_idle == NULL) {
+		conn->dropped_frame_idle = wl_event_loop_add_idle(conn->output.event_loop,
+			handle_dropped_frame_idle, conn);
+	}
+}
+
+static bool drm_commit_queued(struct wlr_drm_backend *drm,
+		struct wlr_drm_connector_state *conn_states, size_t conn_states_len) {
+	struct wlr_drm_device_state dev_state = {
+		.nonblock = true,
+		.connectors = conn_states,
+		.connectors_len = conn_states_len,
+	};
+	return drm_commit(drm, &dev_state, DRM_MODE_PAGE_FLIP_EVENT, false);
+}
+
+/**
+ * Submit all queued page-flips of the device in a single atomic commit. If
+ * the kernel rejects the combination, fall back to one commit per connector.
+ */
+static void drm_flush_queued_commits(struct wlr_drm_backend *drm) {
+	if (drm->coalesce_timer != NULL) {
+		wl_event_source_timer_update(drm->coalesce_timer, 0);
+	}
+	if (drm->coalesce_idle != NULL) {
+		wl_event_source_remove(drm->coalesce_idle);
+		drm->coalesce_idle = NULL;
+	}
+
+	if (wl_list_empty(&drm->queued_commits)) {
+		return;
+	}
+
+	struct wl_list queued_commits;
+	wl_list_init(&queued_commits);
+	wl_list_insert_list(&queued_commits, &drm->queued_commits);
+	wl_list_init(&drm->queued_commits);
+
+	size_t queued_len = wl_list_length(&queued_commits);
+	struct wlr_drm_connector_state *conn_states =
+		calloc(queued_len, sizeof(conn_states[0]));
+	if (conn_states == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+	}
+
+	// Connector states are moved to the array, the queued commits only keep
+	// the output states they point to alive
+	size_t conn_states_len = 0;
+	struct wlr_drm_queued_commit *queued;
+	wl_list_for_each(queued, &queued_commits, link) {
+		struct wlr_drm_connector *conn = queued->state.connector;
+		conn->queued_commit = NULL;
+
+		if (conn_states == NULL || !drm->session->active ||
+				conn->crtc != queued->crtc) {
+			wlr_drm_conn_log(conn, WLR_DEBUG, "Dropping queued page-flip");
+			drm_connector_state_finish(&queued->state);
+			drm_connector_drop_frame(conn);
+			continue;
+		}
+
+		// The cursor may have changed since the page-flip has been queued
+		if (!conn->cursor_enabled) {
+			drm_fb_clear(&queued->state.cursor_fb);
+		} else if (conn->cursor_pending_fb != NULL) {
+			drm_fb_copy(&queued->state.cursor_fb, conn->cursor_pending_fb);
+		}
+
+		conn_states[conn_states_len++] = queued->state;
+	}
+
+	if (conn_states_len > 0 && !drm_commit_queued(drm, conn_states, conn_states_len)) {
+		if (conn_states_len > 1) {
+			wlr_log(WLR_DEBUG, "Failed to submit %zu page-flips at once, "
+				"submitting them separately", conn_states_len);
+		}
+		for (size_t i = 0; i < conn_states_len; i++) {
+			struct wlr_drm_connector *conn = conn_states[i].connector;
+			if (conn_states_len > 1 && drm_commit_queued(drm, &conn_states[i], 1)) {
+				continue;
+			}
+			wlr_drm_conn_log(conn, WLR_ERROR, "Failed to page-flip output");
+			drm_connector_drop_frame(conn);
+		}
+	}
+
+	for (size_t i = 0; i < conn_states_len; i++) {
+		drm_connector_state_finish(&conn_states[i]);
+	}
+	free(conn_states);
+
+	struct wlr_drm_queued_commit *tmp;
+	wl_list_for_each_safe(queued, tmp, &queued_commits, link) {
+		wl_list_remove(&queued->link);
+		wlr_output_state_finish(&queued->base);
+		free(queued);
+	}
+}
+
+static int handle_coalesce_timer(void *data) {
+	struct wlr_drm_backend *drm = data;
+	drm_flush_queued_commits(drm);
+	return 0;
+}
+
+static void handle_coalesce_idle(void *data) {
+	struct wlr_drm_backend *drm = data;
+	drm->coalesce_idle = NULL;
+	drm_flush_queued_commits(drm);
+}
+
+static void drm_schedule_queued_commits(struct wlr_drm_backend *drm,
+		bool first) {
+	struct wl_event_loop *loop = drm->session->event_loop;
+
+	// No need to wait for the end of the window once all enabled connectors
+	// have queued a page-flip
+	bool all_queued = true;
+	struct wlr_drm_connector *conn;
+	wl_list_for_each(conn, &drm->connectors, link) {
+		if (conn->status == DRM_MODE_CONNECTED && conn->output.enabled &&
+				conn->queued_commit == NULL) {
+			all_queued = false;
+			break;
+		}
+	}
+
+	if (!all_queued && drm->coalesce_window_msec > 0) {
+		if (drm->coalesce_timer == NULL) {
+			drm->coalesce_timer = wl_event_loop_add_timer(loop,
+				handle_coalesce_timer, drm);
+		}
+		if (drm->coalesce_timer != NULL) {
+			if (first) {
+				wl_event_source_timer_update(drm->coalesce_timer,
+					drm->coalesce_window_msec);
+			}
+			return;
+		}
+	}
+
+	if (drm->coalesce_idle == NULL) {
+		drm->coalesce_idle = wl_event_loop_add_idle(loop,
+			handle_coalesce_idle, drm);
+		if (drm->coalesce_idle == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create idle event source");
+			drm_flush_queued_commits(drm);
+		}
+	}
+}
+
+static bool drm_connector_can_queue_commit(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	return conn->backend->coalesce_commits && conn->output.enabled &&
+		conn->crtc != NULL && conn->pending_page_flip == NULL &&
+		conn->queued_commit == NULL &&
+		(state->committed & WLR_OUTPUT_STATE_BUFFER) &&
+		!(state->committed & (WLR_OUTPUT_STATE_ENABLED | WLR_OUTPUT_STATE_MODE)) &&
+		!state->allow_reconfiguration && !state->tearing_page_flip;
+}
+
+/**
+ * Accept a page-flip and hold it back until it can be submitted along with
+ * the page-flips of the other connectors of the device.
+ */
+static bool drm_connector_queue_commit(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	struct wlr_drm_backend *drm = conn->backend;
+
+	struct wlr_drm_queued_commit *queued = calloc(1, sizeof(*queued));
+	if (queued == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
+	wlr_output_state_init(&queued->base);
+	if (!wlr_output_state_copy(&queued->base, state)) {
+		wlr_output_state_finish(&queued->base);
+		free(queued);
+		return false;
+	}
+
+	// Import the buffer right away so that failures are reported to the
+	// compositor
+	queued->crtc = conn->crtc;
+	drm_connector_state_init(&queued->state, conn, &queued->base);
+	if (!drm_connector_prepare(&queued->state, false)) {
+		drm_connector_state_finish(&queued->state);
+		wlr_output_state_finish(&queued->base);
+		free(queued);
+		return false;
+	}
+
+	bool first = wl_list_empty(&drm->queued_commits);
+	wl_list_insert(drm->queued_commits.prev, &queued->link);
+	conn->queued_commit = queued;
+
+	drm_schedule_queued_commits(drm, first);
+	return true;
+}
+
+void finish_drm_queued_commits(struct wlr_drm_backend *drm) {
+	struct wlr_drm_queued_commit *queued, *tmp;
+	wl_list_for_each_safe(queued, tmp, &drm->queued_commits, link) {
+		drm_connector_drop_queued_commit(queued->state.connector);
+	}
+
+	if (drm->coalesce_timer != NULL) {
+		wl_event_source_remove(drm->coalesce_timer);
+	}
+	if (drm->coalesce_idle != NULL) {
+		wl_event_source_remove(drm->coalesce_idle);
+	}
+}
+
 static bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 		const struct wlr_output_state *state, bool test_only) {
 	struct wlr_drm_backend *drm = conn->backend;
@@ -905,6 +1167,14 @@ static bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 		return true;
 	}
 
+	if (!test_only) {
+		if (drm_connector_can_queue_commit(conn, state)) {
+			return drm_connector_queue_commit(conn, state);
+		}
+		// Page-flips must reach the kernel in order
+		drm_flush_queued_commits(drm);
+	}
+
 	if (output_pending_enabled(&conn->output, state) && !drm_connector_alloc_crtc(conn)) {
 		wlr_drm_conn_log(conn, WLR_DEBUG,
 			"No CRTC available for this connector");
@@ -1215,6 +1485,12 @@ static void dealloc_crtc(struct wlr_drm_connector *conn);
 static void drm_connector_destroy_output(struct wlr_output *output) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
 
+	drm_connector_drop_queued_commit(conn);
+	if (conn->dropped_frame_idle != NULL) {
+		wl_event_source_remove(conn->dropped_frame_idle);
+		conn->dropped_frame_idle = NULL;
+	}
+
 	dealloc_crtc(conn);
 
 	conn->status = DRM_MODE_DISCONNECTED;
@@ -1889,6 +2165,10 @@ bool commit_drm_device(struct wlr_drm_backend *drm,
 		return false;
 	}
 
+	if (!test_only) {
+		drm_flush_queued_commits(drm);
+	}
+
 	struct wlr_drm_connector_state *conn_states = calloc(output_states_len, sizeof(conn_states[0]));
 	if (conn_states == NULL) {
 		return false;
@@ -1963,6 +2243,7 @@ static int mhz_to_nsec(int mhz) {
 static void handle_page_flip(int fd, unsigned seq,
 		unsigned tv_sec, unsigned tv_usec, unsigned crtc_id, void *data) {
 	struct wlr_drm_page_flip *page_flip = data;
+	TRACE_INSTANT("handle_page_flip");
 
 	struct wlr_drm_connector *conn = drm_page_flip_pop(page_flip, crtc_id);
 	if (conn != NULL) {
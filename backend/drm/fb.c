@@ -1,5 +1,6 @@
 #include <drm_fourcc.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <wlr/render/drm_format_set.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/util/addon.h>
@@ -28,7 +29,25 @@ struct wlr_drm_fb *drm_fb_lock(struct wlr_drm_fb *fb) {
 
 static void drm_fb_handle_destroy(struct wlr_addon *addon) {
 	struct wlr_drm_fb *fb = wl_container_of(addon, fb, addon);
-	drm_fb_destroy(fb);
+	struct wlr_drm_backend *drm = fb->backend;
+
+	if (!fb->has_key || drm->fb_cache_max == 0) {
+		drm_fb_destroy(fb);
+		return;
+	}
+
+	// Clients often wrap the same DMA-BUF into a new buffer, keep the FB
+	// around for a while in case this happens
+	wlr_addon_finish(&fb->addon);
+	fb->wlr_buf = NULL;
+	wl_list_remove(&fb->link);
+	wl_list_insert(&drm->fb_cache, &fb->link);
+	drm->fb_cache_len++;
+
+	if (drm->fb_cache_len > drm->fb_cache_max) {
+		struct wlr_drm_fb *oldest = wl_container_of(drm->fb_cache.prev, oldest, link);
+		drm_fb_destroy(oldest);
+	}
 }
 
 static const struct wlr_addon_interface fb_addon_impl = {
@@ -140,6 +159,76 @@ static void poison_buffer(struct wlr_drm_backend *drm,
 	wlr_log(WLR_DEBUG, "Poisoning buffer");
 }
 
+/**
+ * Build the cache key of an FB. The DMA-BUF planes are identified by their
+ * inode, which can't be re-used as long as the FB keeps the underlying
+ * memory alive.
+ */
+static bool get_fb_key(struct wlr_drm_fb_key *key,
+		const struct wlr_dmabuf_attributes *attribs) {
+	*key = (struct wlr_drm_fb_key){
+		.width = attribs->width,
+		.height = attribs->height,
+		.format = attribs->format,
+		.modifier = attribs->modifier,
+		.n_planes = attribs->n_planes,
+	};
+
+	for (int i = 0; i < attribs->n_planes; i++) {
+		struct stat st;
+		if (fstat(attribs->fd[i], &st) != 0) {
+			wlr_log_errno(WLR_DEBUG, "fstat failed");
+			return false;
+		}
+		key->offset[i] = attribs->offset[i];
+		key->stride[i] = attribs->stride[i];
+		key->dev[i] = st.st_dev;
+		key->ino[i] = st.st_ino;
+	}
+
+	return true;
+}
+
+static bool fb_key_equal(const struct wlr_drm_fb_key *a,
+		const struct wlr_drm_fb_key *b) {
+	if (a->width != b->width || a->height != b->height ||
+			a->format != b->format || a->modifier != b->modifier ||
+			a->n_planes != b->n_planes) {
+		return false;
+	}
+
+	for (int i = 0; i < a->n_planes; i++) {
+		if (a->offset[i] != b->offset[i] || a->stride[i] != b->stride[i] ||
+				a->dev[i] != b->dev[i] || a->ino[i] != b->ino[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static struct wlr_drm_fb *fb_cache_take(struct wlr_drm_backend *drm,
+		const struct wlr_drm_fb_key *key) {
+	struct wlr_drm_fb *fb;
+	wl_list_for_each(fb, &drm->fb_cache, link) {
+		if (fb_key_equal(&fb->key, key)) {
+			wl_list_remove(&fb->link);
+			drm->fb_cache_len--;
+			return fb;
+		}
+	}
+	return NULL;
+}
+
+static void drm_fb_attach(struct wlr_drm_fb *fb, struct wlr_drm_backend *drm,
+		struct wlr_buffer *buf) {
+	fb->backend = drm;
+	fb->wlr_buf = buf;
+
+	wlr_addon_init(&fb->addon, &buf->addons, drm, &fb_addon_impl);
+	wl_list_insert(&drm->fbs, &fb->link);
+}
+
 static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats) {
 	struct wlr_dmabuf_attributes attribs;
@@ -176,6 +265,20 @@ static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 		}
 	}
 
+	if (drm->fb_cache_max > 0) {
+		fb->has_key = get_fb_key(&fb->key, &attribs);
+	}
+	if (fb->has_key) {
+		struct wlr_drm_fb *cached = fb_cache_take(drm, &fb->key);
+		if (cached != NULL) {
+			drm->fb_cache_hits++;
+			free(fb);
+			drm_fb_attach(cached, drm, buf);
+			return cached;
+		}
+		drm->fb_cache_misses++;
+	}
+
 	uint32_t handles[4] = {0};
 	for (int i = 0; i < attribs.n_planes; ++i) {
 		int ret = drmPrimeFDToHandle(drm->fd, attribs.fd[i], &handles[i]);
@@ -194,12 +297,7 @@ static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 
 	close_all_bo_handles(drm, handles);
 
-	fb->backend = drm;
-	fb->wlr_buf = buf;
-
-	wlr_addon_init(&fb->addon, &buf->addons, drm, &fb_addon_impl);
-	wl_list_insert(&drm->fbs, &fb->link);
-
+	drm_fb_attach(fb, drm, buf);
 	return fb;
 
 error_bo_handle:
@@ -213,7 +311,11 @@ void drm_fb_destroy(struct wlr_drm_fb *fb) {
 	struct wlr_drm_backend *drm = fb->backend;
 
 	wl_list_remove(&fb->link);
-	wlr_addon_finish(&fb->addon);
+	if (fb->wlr_buf != NULL) {
+		wlr_addon_finish(&fb->addon);
+	} else {
+		drm->fb_cache_len--;
+	}
 
 	int ret = drmModeCloseFB(drm->fd, fb->id);
 	if (ret == -EINVAL) {
@@ -226,6 +328,18 @@ void drm_fb_destroy(struct wlr_drm_fb *fb) {
 	free(fb);
 }
 
+void drm_fb_cache_finish(struct wlr_drm_backend *drm) {
+	if (drm->fb_cache_hits + drm->fb_cache_misses > 0) {
+		wlr_log(WLR_DEBUG, "FB cache: %"PRIu64" hits, %"PRIu64" misses",
+			drm->fb_cache_hits, drm->fb_cache_misses);
+	}
+
+	struct wlr_drm_fb *fb, *fb_tmp;
+	wl_list_for_each_safe(fb, fb_tmp, &drm->fb_cache, link) {
+		drm_fb_destroy(fb);
+	}
+}
+
 bool drm_fb_import(struct wlr_drm_fb **fb_ptr, struct wlr_drm_backend *drm,
 		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats) {
 	struct wlr_drm_fb *fb;
@@ -6,6 +6,8 @@
 #include <wlr/util/log.h>
 #include "backend/headless.h"
 #include "types/wlr_output.h"
+#include "util/env.h"
+#include "util/time.h"
 
 static const uint32_t SUPPORTED_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_BACKEND_OPTIONAL |
@@ -28,7 +30,137 @@ static void output_update_refresh(struct wlr_headless_output *output,
 		refresh = HEADLESS_DEFAULT_REFRESH;
 	}
 
-	output->frame_delay = 1000000 / refresh;
+	output->refresh = refresh;
+}
+
+static int64_t output_refresh_nsec(struct wlr_headless_output *output) {
+	return 1000000000000ll / output->refresh;
+}
+
+static int64_t get_monotonic_nsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_nsec(&now);
+}
+
+static int64_t output_now_nsec(struct wlr_headless_output *output) {
+	if (output->manual_clock) {
+		return output->manual_clock_nsec;
+	}
+	return get_monotonic_nsec();
+}
+
+static int64_t output_vblank_nsec(struct wlr_headless_output *output,
+		int64_t vblank) {
+	return output->vblank_base_nsec + vblank * output_refresh_nsec(output);
+}
+
+/**
+ * Restart the vblank clock at base_nsec, with sequence numbers following the
+ * ones of the vblanks which already happened.
+ */
+static void output_reset_vblank_clock(struct wlr_headless_output *output,
+		int64_t base_nsec) {
+	int64_t elapsed = output_now_nsec(output) - output->vblank_base_nsec;
+	if (elapsed > 0) {
+		output->vblank_base_seq += elapsed / output_refresh_nsec(output);
+	}
+	output->vblank_base_seq++;
+	output->vblank_base_nsec = base_nsec;
+	output->last_vblank = -1;
+}
+
+static uint32_t output_next_random(struct wlr_headless_output *output) {
+	// xorshift32
+	uint32_t x = output->jitter_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	output->jitter_state = x;
+	return x;
+}
+
+static void output_arm_vblank_timer(struct wlr_headless_output *output) {
+	if (output->manual_clock) {
+		return;
+	}
+
+	// Round up, the timer must not fire before the vblank
+	int64_t delay_nsec = output_vblank_nsec(output, output->present_vblank) -
+		get_monotonic_nsec();
+	int delay_msec = (int)((delay_nsec + 999999) / 1000000);
+	if (delay_msec < 1) {
+		delay_msec = 1;
+	}
+	wl_event_source_timer_update(output->vblank_timer, delay_msec);
+}
+
+/**
+ * Pick the vblank the pending frame is presented on.
+ */
+static void output_schedule_vblank(struct wlr_headless_output *output) {
+	int64_t latency = output->latency_nsec;
+	if (output->jitter_nsec > 0) {
+		latency += output_next_random(output) % (output->jitter_nsec + 1);
+	}
+
+	// Present on the first vblank after the simulated scan-out latency, and
+	// never twice on the same vblank
+	int64_t ready_nsec = output_now_nsec(output) + latency;
+	int64_t vblank = (ready_nsec - output->vblank_base_nsec) /
+		output_refresh_nsec(output) + 1;
+	if (vblank <= output->last_vblank) {
+		vblank = output->last_vblank + 1;
+	}
+
+	output->present_vblank = vblank;
+	output_arm_vblank_timer(output);
+}
+
+static void output_schedule_present(struct wlr_headless_output *output,
+		uint32_t commit_seq) {
+	output->present_pending = true;
+	output->present_commit_seq = commit_seq;
+	output->present_commits_len = 1;
+	output_schedule_vblank(output);
+}
+
+static void output_drop_pending_present(struct wlr_headless_output *output) {
+	if (!output->present_pending) {
+		return;
+	}
+
+	output->present_pending = false;
+	wl_event_source_timer_update(output->vblank_timer, 0);
+
+	for (uint32_t i = 0; i < output->present_commits_len; i++) {
+		struct wlr_output_event_present present_event = {
+			.commit_seq = output->present_commit_seq + i,
+			.presented = false,
+		};
+		output_defer_present(&output->wlr_output, present_event);
+	}
+}
+
+static void output_present_vblank(struct wlr_headless_output *output) {
+	assert(output->present_pending);
+	output->present_pending = false;
+	output->last_vblank = output->present_vblank;
+
+	struct wlr_output_event_present present_event = {
+		.presented = true,
+		.seq = output->vblank_base_seq + (uint64_t)output->present_vblank,
+		.refresh = output_refresh_nsec(output),
+		.flags = WLR_OUTPUT_PRESENT_VSYNC,
+	};
+	timespec_from_nsec(&present_event.when,
+		output_vblank_nsec(output, output->present_vblank));
+	for (uint32_t i = 0; i < output->present_commits_len; i++) {
+		present_event.commit_seq = output->present_commit_seq + i;
+		wlr_output_send_present(&output->wlr_output, &present_event);
+	}
+
+	wlr_output_send_frame(&output->wlr_output);
 }
 
 static bool output_test(struct wlr_output *wlr_output,
@@ -63,17 +195,25 @@ static bool output_commit(struct wlr_output *wlr_output,
 	}
 
 	if (state->committed & WLR_OUTPUT_STATE_MODE) {
+		output_drop_pending_present(output);
+		output_reset_vblank_clock(output, output_now_nsec(output));
 		output_update_refresh(output, state->custom_mode.refresh);
 	}
 
-	if (output_pending_enabled(wlr_output, state)) {
-		struct wlr_output_event_present present_event = {
-			.commit_seq = wlr_output->commit_seq + 1,
-			.presented = true,
-		};
-		output_defer_present(wlr_output, present_event);
-
-		wl_event_source_timer_update(output->frame_timer, output->frame_delay);
+	uint32_t commit_seq = wlr_output->commit_seq + 1;
+	if (!output_pending_enabled(wlr_output, state)) {
+		output_drop_pending_present(output);
+	} else if (!output->present_pending ||
+			(state->committed & WLR_OUTPUT_STATE_BUFFER)) {
+		// A new frame replaces the one waiting for a vblank
+		output_drop_pending_present(output);
+		output_schedule_present(output, commit_seq);
+	} else {
+		// The contents of the output don't change, the commit is presented
+		// along with the pending frame. Commit sequence numbers follow each
+		// other since a buffer or mode commit would have replaced the frame.
+		assert(commit_seq == output->present_commit_seq + output->present_commits_len);
+		output->present_commits_len++;
 	}
 
 	return true;
@@ -83,7 +223,7 @@ static void output_destroy(struct wlr_output *wlr_output) {
 	struct wlr_headless_output *output =
 		headless_output_from_output(wlr_output);
 	wl_list_remove(&output->link);
-	wl_event_source_remove(output->frame_timer);
+	wl_event_source_remove(output->vblank_timer);
 	free(output);
 }
 
@@ -97,9 +237,9 @@ bool wlr_output_is_headless(struct wlr_output *wlr_output) {
 	return wlr_output->impl == &output_impl;
 }
 
-static int signal_frame(void *data) {
+static int handle_vblank_timer(void *data) {
 	struct wlr_headless_output *output = data;
-	wlr_output_send_frame(&output->wlr_output);
+	output_present_vblank(output);
 	return 0;
 }
 
@@ -135,7 +275,15 @@ struct wlr_output *wlr_headless_add_output(struct wlr_backend *wlr_backend,
 	snprintf(description, sizeof(description), "Headless output %zu", output_num);
 	wlr_output_set_description(wlr_output, description);
 
-	output->frame_timer = wl_event_loop_add_timer(backend->event_loop, signal_frame, output);
+	output->vblank_base_nsec = get_monotonic_nsec();
+	output->last_vblank = -1;
+	output->latency_nsec =
+		env_parse_uint("WLR_HEADLESS_SCANOUT_LATENCY_US", 0) * 1000;
+	output->jitter_nsec =
+		env_parse_uint("WLR_HEADLESS_SCANOUT_JITTER_US", 0) * 1000;
+	output->jitter_state = (uint32_t)output_num;
+	output->vblank_timer = wl_event_loop_add_timer(backend->event_loop,
+		handle_vblank_timer, output);
 
 	wl_list_insert(&backend->outputs, &output->link);
 
@@ -145,3 +293,50 @@ struct wlr_output *wlr_headless_add_output(struct wlr_backend *wlr_backend,
 
 	return wlr_output;
 }
+
+void wlr_headless_output_set_scanout_latency(struct wlr_output *wlr_output,
+		int64_t latency_nsec, int64_t jitter_nsec) {
+	struct wlr_headless_output *output =
+		headless_output_from_output(wlr_output);
+	output->latency_nsec = latency_nsec > 0 ? latency_nsec : 0;
+	output->jitter_nsec = jitter_nsec > 0 ? jitter_nsec : 0;
+}
+
+void wlr_headless_output_set_manual_clock(struct wlr_output *wlr_output,
+		bool manual) {
+	struct wlr_headless_output *output =
+		headless_output_from_output(wlr_output);
+	if (output->manual_clock == manual) {
+		return;
+	}
+
+	if (manual) {
+		output->manual_clock_nsec = get_monotonic_nsec();
+		output->manual_clock = true;
+		wl_event_source_timer_update(output->vblank_timer, 0);
+		return;
+	}
+
+	// The manual clock may be ahead of the real one, restart the vblank
+	// clock now and move the pending frame to it
+	output_reset_vblank_clock(output, get_monotonic_nsec());
+	output->manual_clock = false;
+	if (output->present_pending) {
+		output_schedule_vblank(output);
+	}
+}
+
+void wlr_headless_output_advance_clock(struct wlr_output *wlr_output,
+		int64_t nsec) {
+	struct wlr_headless_output *output =
+		headless_output_from_output(wlr_output);
+	assert(output->manual_clock);
+	// The clock is monotonic
+	assert(nsec >= 0);
+
+	output->manual_clock_nsec += nsec;
+	while (output->present_pending && output_vblank_nsec(output,
+			output->present_vblank) <= output->manual_clock_nsec) {
+		output_present_vblank(output);
+	}
+}
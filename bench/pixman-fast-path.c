@@ -0,0 +1,240 @@
+/*
+ * Compare the pixman renderer fast paths against pixman for the texture
+ * draws they handle.
+ *
+ * Usage: bench-pixman-fast-path [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wlr/util/log.h>
+#include "render/pixman.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+struct bench_case {
+	const char *name;
+	pixman_op_t op;
+	pixman_format_code_t src_format;
+	uint16_t alpha;
+	enum wl_output_transform transform;
+	int scale;
+};
+
+static const struct bench_case cases[] = {
+	{ "over, alpha 0.5", PIXMAN_OP_OVER, PIXMAN_a8r8g8b8, 0x7FFF, WL_OUTPUT_TRANSFORM_NORMAL, 1 },
+	{ "over xrgb, alpha 0.5", PIXMAN_OP_OVER, PIXMAN_x8r8g8b8, 0x7FFF, WL_OUTPUT_TRANSFORM_NORMAL, 1 },
+	{ "src, alpha 0.5", PIXMAN_OP_SRC, PIXMAN_a8r8g8b8, 0x7FFF, WL_OUTPUT_TRANSFORM_NORMAL, 1 },
+	{ "over", PIXMAN_OP_OVER, PIXMAN_a8r8g8b8, 0xFFFF, WL_OUTPUT_TRANSFORM_NORMAL, 1 },
+	{ "over, nearest 2x", PIXMAN_OP_OVER, PIXMAN_a8r8g8b8, 0xFFFF, WL_OUTPUT_TRANSFORM_NORMAL, 2 },
+	{ "src, nearest 2x", PIXMAN_OP_SRC, PIXMAN_x8r8g8b8, 0xFFFF, WL_OUTPUT_TRANSFORM_NORMAL, 2 },
+	{ "over, 90", PIXMAN_OP_OVER, PIXMAN_a8r8g8b8, 0xFFFF, WL_OUTPUT_TRANSFORM_90, 1 },
+	{ "src, 180", PIXMAN_OP_SRC, PIXMAN_x8r8g8b8, 0xFFFF, WL_OUTPUT_TRANSFORM_180, 1 },
+	{ "over, 270, alpha 0.5", PIXMAN_OP_OVER, PIXMAN_a8r8g8b8, 0x7FFF, WL_OUTPUT_TRANSFORM_270, 1 },
+};
+
+static int64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fill_random(uint32_t *data, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		// Mix of opaque, transparent and translucent premultiplied pixels
+		uint32_t a = (i / 64) % 3 == 0 ? 0xFF : (i / 64) % 3 == 1 ? 0 : rand() & 0xFF;
+		uint32_t p = a << 24;
+		for (int c = 0; c < 24; c += 8) {
+			p |= (uint32_t)(a == 0 ? 0 : rand() % (a + 1)) << c;
+		}
+		data[i] = p;
+	}
+}
+
+/**
+ * Build the transform mapping destination to source coordinates, for a
+ * source of src_width x src_height.
+ */
+static void get_transform(const struct bench_case *c, int src_width, int src_height,
+		struct pixman_transform *transform) {
+	pixman_transform_init_identity(transform);
+	pixman_fixed_t s = pixman_fixed_1 / c->scale;
+	switch (c->transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+		// dst (x, y) -> src (y, h - x)
+		transform->matrix[0][0] = 0;
+		transform->matrix[0][1] = pixman_fixed_1;
+		transform->matrix[1][0] = -pixman_fixed_1;
+		transform->matrix[1][1] = 0;
+		transform->matrix[1][2] = pixman_int_to_fixed(src_height);
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		transform->matrix[0][0] = -pixman_fixed_1;
+		transform->matrix[1][1] = -pixman_fixed_1;
+		transform->matrix[0][2] = pixman_int_to_fixed(src_width);
+		transform->matrix[1][2] = pixman_int_to_fixed(src_height);
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		// dst (x, y) -> src (w - y, x)
+		transform->matrix[0][0] = 0;
+		transform->matrix[0][1] = -pixman_fixed_1;
+		transform->matrix[1][0] = pixman_fixed_1;
+		transform->matrix[1][1] = 0;
+		transform->matrix[0][2] = pixman_int_to_fixed(src_width);
+		break;
+	default:
+		transform->matrix[0][0] = s;
+		transform->matrix[1][1] = s;
+		break;
+	}
+}
+
+static double run_pixman(const struct bench_case *c, const struct wlr_pixman_render_op *op,
+		pixman_image_t *src, pixman_image_t *dst, int iterations) {
+	pixman_image_t *mask = NULL;
+	if (c->alpha != 0xFFFF) {
+		mask = pixman_image_create_solid_fill(&(struct pixman_color){
+			.alpha = c->alpha,
+		});
+	}
+	if (op->has_transform) {
+		pixman_image_set_transform(src, &op->transform);
+		pixman_image_set_filter(src, op->filter, NULL, 0);
+	}
+
+	int64_t start = get_time_ns();
+	for (int i = 0; i < iterations; i++) {
+		if (op->has_transform) {
+			pixman_image_composite32(c->op, src, mask, dst, 0, 0, 0, 0,
+				0, 0, op->dst_box.width, op->dst_box.height);
+		} else {
+			pixman_image_composite32(c->op, src, mask, dst, 0, 0, 0, 0,
+				0, 0, op->src_box.width, op->src_box.height);
+		}
+	}
+	int64_t end = get_time_ns();
+
+	pixman_image_set_transform(src, NULL);
+	if (mask != NULL) {
+		pixman_image_unref(mask);
+	}
+	return (double)(end - start) / iterations / 1000000;
+}
+
+static double run_fast_path(const struct wlr_pixman_fast_path_impl *impl,
+		const struct wlr_pixman_render_op *op, pixman_image_t *dst, int iterations) {
+	int64_t start = get_time_ns();
+	for (int i = 0; i < iterations; i++) {
+		if (!pixman_fast_path_render_op(impl, op, dst, &op->clip)) {
+			return -1;
+		}
+	}
+	int64_t end = get_time_ns();
+	return (double)(end - start) / iterations / 1000000;
+}
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	int iterations = 50;
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t len = (size_t)WIDTH * HEIGHT;
+	uint32_t *src_data = malloc(len * sizeof(uint32_t));
+	uint32_t *dst_data = malloc(len * sizeof(uint32_t));
+	uint32_t *dst_init = malloc(len * sizeof(uint32_t));
+	uint32_t *reference = malloc(len * sizeof(uint32_t));
+	if (src_data == NULL || dst_data == NULL || dst_init == NULL || reference == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return EXIT_FAILURE;
+	}
+	srand(42);
+	fill_random(src_data, len);
+	fill_random(dst_init, len);
+
+	// Only used to tell texture operations from rect operations
+	struct wlr_buffer buffer = {0};
+
+	printf("%-24s %-8s %10s %10s %8s\n", "case", "impl", "ms/frame", "pixman", "speedup");
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		const struct bench_case *c = &cases[i];
+
+		bool swapped = c->transform == WL_OUTPUT_TRANSFORM_90 ||
+			c->transform == WL_OUTPUT_TRANSFORM_270;
+		int src_width = (swapped ? HEIGHT : WIDTH) / c->scale;
+		int src_height = (swapped ? WIDTH : HEIGHT) / c->scale;
+
+		struct wlr_pixman_render_op op = {
+			.op = c->op,
+			.dst_box = { .width = WIDTH, .height = HEIGHT },
+			.buffer = &buffer,
+			.src_data = src_data,
+			.src_format = c->src_format,
+			.src_width = src_width,
+			.src_height = src_height,
+			.src_stride = src_width * 4,
+			.src_box = { .width = src_width, .height = src_height },
+			.has_transform = c->transform != WL_OUTPUT_TRANSFORM_NORMAL || c->scale != 1,
+			.filter = PIXMAN_FILTER_NEAREST,
+			.alpha = c->alpha,
+		};
+		get_transform(c, src_width, src_height, &op.transform);
+		pixman_region32_init_rect(&op.clip, 0, 0, WIDTH, HEIGHT);
+
+		pixman_image_t *src = pixman_image_create_bits_no_clear(c->src_format,
+			src_width, src_height, src_data, op.src_stride);
+		pixman_image_t *dst = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8,
+			WIDTH, HEIGHT, dst_data, WIDTH * 4);
+
+		memcpy(dst_data, dst_init, len * sizeof(uint32_t));
+		run_pixman(c, &op, src, dst, 1);
+		memcpy(reference, dst_data, len * sizeof(uint32_t));
+		double pixman_ms = run_pixman(c, &op, src, dst, iterations);
+
+		for (size_t j = 0; pixman_fast_path_impls[j] != NULL; j++) {
+			const struct wlr_pixman_fast_path_impl *impl = pixman_fast_path_impls[j];
+			if (!impl->is_supported()) {
+				continue;
+			}
+
+			memcpy(dst_data, dst_init, len * sizeof(uint32_t));
+			if (run_fast_path(impl, &op, dst, 1) < 0) {
+				printf("%-24s %-8s %10s\n", c->name, impl->name, "n/a");
+				continue;
+			}
+
+			size_t mismatches = 0;
+			for (size_t k = 0; k < len; k++) {
+				if (dst_data[k] != reference[k]) {
+					mismatches++;
+				}
+			}
+
+			double ms = run_fast_path(impl, &op, dst, iterations);
+			printf("%-24s %-8s %10.3f %10.3f %7.2fx", c->name, impl->name,
+				ms, pixman_ms, pixman_ms / ms);
+			if (mismatches > 0) {
+				printf(" (%zu pixels differ from pixman)", mismatches);
+			}
+			printf("\n");
+		}
+
+		pixman_image_unref(dst);
+		pixman_image_unref(src);
+		pixman_region32_fini(&op.clip);
+	}
+
+	free(reference);
+	free(dst_init);
+	free(dst_data);
+	free(src_data);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,340 @@
+/*
+ * Render scripted scenes with the headless backend and the pixman renderer,
+ * printing per-frame statistics as CSV on stdout and a summary on stderr.
+ *
+ * Usage: bench-scene [-w windows] [-s subsurfaces] [-p pattern] [-S scale]
+ *                    [-n frames] [-W width] [-H height]
+ *
+ * Patterns:
+ *   static    nothing changes after the first frame
+ *   move      every window moves each frame
+ *   occlude   the bottom-most window is raised to the top each frame
+ */
+#include <drm_fourcc.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/pixman.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+#define WINDOW_WIDTH 640
+#define WINDOW_HEIGHT 480
+#define SUBSURFACE_WIDTH 160
+#define SUBSURFACE_HEIGHT 120
+
+enum pattern {
+	PATTERN_STATIC,
+	PATTERN_MOVE,
+	PATTERN_OCCLUDE,
+};
+
+struct mem_buffer {
+	struct wlr_buffer base;
+	uint32_t format;
+	size_t stride;
+	void *data;
+};
+
+struct window {
+	struct wlr_scene_tree *tree;
+	int x, y;
+};
+
+static void mem_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct mem_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	free(buffer->data);
+	free(buffer);
+}
+
+static bool mem_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct mem_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	if (flags & WLR_BUFFER_DATA_PTR_ACCESS_WRITE) {
+		return false;
+	}
+	*data = buffer->data;
+	*format = buffer->format;
+	*stride = buffer->stride;
+	return true;
+}
+
+static void mem_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+}
+
+static const struct wlr_buffer_impl mem_buffer_impl = {
+	.destroy = mem_buffer_destroy,
+	.begin_data_ptr_access = mem_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = mem_buffer_end_data_ptr_access,
+};
+
+/**
+ * Create a buffer filled with a gradient. XRGB8888 buffers are opaque, so
+ * that windows occlude what's below them, ARGB8888 buffers are translucent.
+ */
+static struct wlr_buffer *mem_buffer_create(int width, int height, uint32_t format) {
+	struct mem_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (buffer == NULL) {
+		return NULL;
+	}
+	buffer->format = format;
+	buffer->stride = (size_t)width * 4;
+	buffer->data = malloc(buffer->stride * height);
+	if (buffer->data == NULL) {
+		free(buffer);
+		return NULL;
+	}
+	wlr_buffer_init(&buffer->base, &mem_buffer_impl, width, height);
+
+	uint32_t alpha = format == DRM_FORMAT_ARGB8888 ? 0x80 : 0xFF;
+	for (int y = 0; y < height; y++) {
+		uint32_t *row = (uint32_t *)((uint8_t *)buffer->data + y * buffer->stride);
+		for (int x = 0; x < width; x++) {
+			uint32_t r = x * alpha / width, g = y * alpha / height, b = alpha / 2;
+			row[x] = alpha << 24 | r << 16 | g << 8 | b;
+		}
+	}
+
+	return &buffer->base;
+}
+
+static int64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Triangle wave going back and forth between 0 and range.
+ */
+static int bounce(int t, int range) {
+	if (range <= 0) {
+		return 0;
+	}
+	t %= 2 * range;
+	return t < range ? t : 2 * range - t;
+}
+
+static bool parse_pattern(const char *str, enum pattern *pattern) {
+	if (strcmp(str, "static") == 0) {
+		*pattern = PATTERN_STATIC;
+	} else if (strcmp(str, "move") == 0) {
+		*pattern = PATTERN_MOVE;
+	} else if (strcmp(str, "occlude") == 0) {
+		*pattern = PATTERN_OCCLUDE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static void update_scene(struct window *windows, int windows_len,
+		enum pattern pattern, int frame, int logical_width, int logical_height) {
+	switch (pattern) {
+	case PATTERN_STATIC:
+		break;
+	case PATTERN_MOVE:
+		for (int i = 0; i < windows_len; i++) {
+			struct window *window = &windows[i];
+			int x = bounce(window->x + frame * 8, logical_width - WINDOW_WIDTH);
+			int y = bounce(window->y + frame * 6, logical_height - WINDOW_HEIGHT);
+			wlr_scene_node_set_position(&window->tree->node, x, y);
+		}
+		break;
+	case PATTERN_OCCLUDE:
+		// Windows are raised in turn, so this one is the bottom-most
+		wlr_scene_node_raise_to_top(&windows[(frame - 1) % windows_len].tree->node);
+		break;
+	}
+}
+
+static const char usage[] =
+	"usage: %s [-w windows] [-s subsurfaces] [-p static|move|occlude] "
+	"[-S scale] [-n frames] [-W width] [-H height]\n";
+
+int main(int argc, char *argv[]) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	int windows_len = 8, subsurfaces_len = 2, frames = 300;
+	int width = 1920, height = 1080;
+	float scale = 1;
+	enum pattern pattern = PATTERN_MOVE;
+
+	int c;
+	while ((c = getopt(argc, argv, "w:s:p:S:n:W:H:")) != -1) {
+		switch (c) {
+		case 'w':
+			windows_len = atoi(optarg);
+			break;
+		case 's':
+			subsurfaces_len = atoi(optarg);
+			break;
+		case 'p':
+			if (!parse_pattern(optarg, &pattern)) {
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			scale = strtof(optarg, NULL);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc || windows_len <= 0 || subsurfaces_len < 0 ||
+			frames <= 0 || scale <= 0 || width <= 0 || height <= 0) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wlr_backend *backend = wlr_headless_backend_create(loop);
+	struct wlr_renderer *renderer = wlr_pixman_renderer_create();
+	if (loop == NULL || backend == NULL || renderer == NULL) {
+		fprintf(stderr, "failed to create backend or renderer\n");
+		return EXIT_FAILURE;
+	}
+	struct wlr_allocator *allocator = wlr_allocator_autocreate(backend, renderer);
+	if (allocator == NULL || !wlr_backend_start(backend)) {
+		fprintf(stderr, "failed to create allocator or start backend\n");
+		return EXIT_FAILURE;
+	}
+
+	struct wlr_output *output = wlr_headless_add_output(backend, width, height);
+	wlr_output_init_render(output, allocator, renderer);
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_enabled(&state, true);
+	wlr_output_state_set_scale(&state, scale);
+	bool ok = wlr_output_commit_state(output, &state);
+	wlr_output_state_finish(&state);
+	if (!ok) {
+		fprintf(stderr, "failed to enable output\n");
+		return EXIT_FAILURE;
+	}
+
+	struct wlr_scene *scene = wlr_scene_create();
+	struct wlr_scene_output *scene_output = wlr_scene_output_create(scene, output);
+
+	int logical_width, logical_height;
+	wlr_output_effective_resolution(output, &logical_width, &logical_height);
+
+	struct wlr_buffer *window_buffer =
+		mem_buffer_create(WINDOW_WIDTH, WINDOW_HEIGHT, DRM_FORMAT_XRGB8888);
+	struct wlr_buffer *subsurface_buffer =
+		mem_buffer_create(SUBSURFACE_WIDTH, SUBSURFACE_HEIGHT, DRM_FORMAT_ARGB8888);
+	struct window *windows = calloc(windows_len, sizeof(*windows));
+	if (window_buffer == NULL || subsurface_buffer == NULL || windows == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return EXIT_FAILURE;
+	}
+
+	wlr_scene_rect_create(&scene->tree, logical_width, logical_height,
+		(float[4]){ 0.2, 0.2, 0.2, 1 });
+
+	// Cascade windows, each with its subsurfaces laid out in a grid
+	for (int i = 0; i < windows_len; i++) {
+		struct window *window = &windows[i];
+		window->x = bounce(i * 64, logical_width - WINDOW_WIDTH);
+		window->y = bounce(i * 48, logical_height - WINDOW_HEIGHT);
+		window->tree = wlr_scene_tree_create(&scene->tree);
+		wlr_scene_node_set_position(&window->tree->node, window->x, window->y);
+		wlr_scene_buffer_create(window->tree, window_buffer);
+
+		int cols = WINDOW_WIDTH / SUBSURFACE_WIDTH;
+		for (int j = 0; j < subsurfaces_len; j++) {
+			struct wlr_scene_buffer *subsurface =
+				wlr_scene_buffer_create(window->tree, subsurface_buffer);
+			wlr_scene_node_set_position(&subsurface->node,
+				(j % cols) * SUBSURFACE_WIDTH + 8 * (j / cols),
+				(j / cols % (WINDOW_HEIGHT / SUBSURFACE_HEIGHT)) * SUBSURFACE_HEIGHT);
+		}
+	}
+
+	int64_t total_pre_render = 0, total_render = 0, total_commit = 0;
+	uint64_t total_damage = 0;
+
+	printf("frame,pre_render_ns,render_ns,commit_ns,render_list_len,damage_area\n");
+	for (int frame = 0; frame < frames; frame++) {
+		if (frame > 0) {
+			update_scene(windows, windows_len, pattern, frame,
+				logical_width, logical_height);
+		}
+
+		struct wlr_scene_timer timer = {0};
+		wlr_output_state_init(&state);
+
+		if (!wlr_scene_output_build_state(scene_output, &state,
+				&(struct wlr_scene_output_state_options){ .timer = &timer })) {
+			fprintf(stderr, "failed to build output state\n");
+			return EXIT_FAILURE;
+		}
+		int64_t built = get_time_ns();
+		if (!wlr_output_commit_state(output, &state)) {
+			fprintf(stderr, "failed to commit output\n");
+			return EXIT_FAILURE;
+		}
+		int64_t committed = get_time_ns();
+		wlr_output_state_finish(&state);
+
+		// The pixman render timer measures the submission of the pass, at the
+		// end of building the state. Frames without damage aren't rendered.
+		int64_t render = 0;
+		if (timer.render_timer != NULL) {
+			int duration = wlr_render_timer_get_duration_ns(timer.render_timer);
+			if (duration >= 0) {
+				render = duration;
+			}
+		}
+
+		printf("%d,%" PRIi64 ",%" PRIi64 ",%" PRIi64 ",%zu,%" PRIu64 "\n",
+			frame, timer.pre_render_duration, render, committed - built,
+			timer.render_list_len, timer.damage_area);
+
+		total_pre_render += timer.pre_render_duration;
+		total_render += render;
+		total_commit += committed - built;
+		total_damage += timer.damage_area;
+		wlr_scene_timer_finish(&timer);
+	}
+
+	fprintf(stderr, "%d frames, mean pre-render %.3f ms, render %.3f ms, "
+		"commit %.3f ms, damage %.0f px\n", frames,
+		(double)total_pre_render / frames / 1000000,
+		(double)total_render / frames / 1000000,
+		(double)total_commit / frames / 1000000,
+		(double)total_damage / frames);
+
+	wlr_scene_node_destroy(&scene->tree.node);
+	wlr_buffer_drop(subsurface_buffer);
+	wlr_buffer_drop(window_buffer);
+	free(windows);
+	wlr_backend_destroy(backend);
+	wlr_allocator_destroy(allocator);
+	wlr_renderer_destroy(renderer);
+	wl_event_loop_destroy(loop);
+	return EXIT_SUCCESS;
+}
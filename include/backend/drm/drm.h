@@ -111,6 +111,11 @@ struct wlr_drm_backend {
 	struct wl_listener dev_remove;
 
 	struct wl_list fbs; // wlr_drm_fb.link
+	// FBs whose buffer has been destroyed, most recently used first. They're
+	// re-used when the same DMA-BUF is imported again.
+	struct wl_list fb_cache; // wlr_drm_fb.link
+	size_t fb_cache_len, fb_cache_max;
+	uint64_t fb_cache_hits, fb_cache_misses;
 	struct wl_list connectors; // wlr_drm_connector.link
 
 	struct wl_list page_flips; // wlr_drm_page_flip.link
@@ -125,6 +130,14 @@ struct wlr_drm_backend {
 	struct wlr_drm_format_set mgpu_formats;
 
 	bool supports_tearing_page_flips;
+
+	// Page-flips waiting to be submitted together, see
+	// WLR_DRM_COALESCE_COMMITS
+	bool coalesce_commits;
+	int coalesce_window_msec;
+	struct wl_list queued_commits; // wlr_drm_queued_commit.link
+	struct wl_event_source *coalesce_timer;
+	struct wl_event_source *coalesce_idle;
 };
 
 struct wlr_drm_mode {
@@ -185,6 +198,18 @@ struct wlr_drm_page_flip_connector {
 	struct wlr_drm_connector *connector; // may be NULL
 };
 
+/**
+ * A page-flip which has been accepted by wlr_output, but hasn't been
+ * submitted to the kernel yet because it waits for the page-flips of other
+ * connectors, so that they all get submitted in a single atomic commit.
+ */
+struct wlr_drm_queued_commit {
+	struct wl_list link; // wlr_drm_backend.queued_commits
+	struct wlr_drm_crtc *crtc;
+	struct wlr_output_state base;
+	struct wlr_drm_connector_state state;
+};
+
 struct wlr_drm_connector {
 	struct wlr_output output; // only valid if status != DISCONNECTED
 
@@ -211,6 +236,10 @@ struct wlr_drm_connector {
 
 	// Last committed page-flip
 	struct wlr_drm_page_flip *pending_page_flip;
+	// Page-flip waiting to be submitted, may be NULL
+	struct wlr_drm_queued_commit *queued_commit;
+	// Sends the frame event of a queued page-flip the kernel rejected
+	struct wl_event_source *dropped_frame_idle;
 
 	int32_t refresh;
 };
@@ -226,6 +255,7 @@ void scan_drm_leases(struct wlr_drm_backend *drm);
 bool commit_drm_device(struct wlr_drm_backend *drm,
 	const struct wlr_backend_output_state *states, size_t states_len, bool test_only);
 int handle_drm_event(int fd, uint32_t mask, void *data);
+void finish_drm_queued_commits(struct wlr_drm_backend *drm);
 void destroy_drm_connector(struct wlr_drm_connector *conn);
 bool drm_connector_is_cursor_visible(struct wlr_drm_connector *conn);
 size_t drm_crtc_get_gamma_lut_size(struct wlr_drm_backend *drm,
@@ -2,19 +2,40 @@
 #define BACKEND_DRM_FB_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Identity of the DMA-BUF planes an FB has been created from, and of the
+ * parameters it has been created with.
+ */
+struct wlr_drm_fb_key {
+	int32_t width, height;
+	uint32_t format;
+	uint64_t modifier;
+	int n_planes;
+	uint32_t offset[4];
+	uint32_t stride[4];
+	dev_t dev[4];
+	ino_t ino[4];
+};
 
 struct wlr_drm_fb {
-	struct wlr_buffer *wlr_buf;
+	struct wlr_buffer *wlr_buf; // NULL if cached
 	struct wlr_addon addon;
 	struct wlr_drm_backend *backend;
-	struct wl_list link; // wlr_drm_backend.fbs
+	struct wl_list link; // wlr_drm_backend.fbs or wlr_drm_backend.fb_cache
 
 	uint32_t id;
+
+	bool has_key;
+	struct wlr_drm_fb_key key;
 };
 
 bool drm_fb_import(struct wlr_drm_fb **fb, struct wlr_drm_backend *drm,
 		struct wlr_buffer *buf, const struct wlr_drm_format_set *formats);
 void drm_fb_destroy(struct wlr_drm_fb *fb);
+void drm_fb_cache_finish(struct wlr_drm_backend *drm);
 
 void drm_fb_clear(struct wlr_drm_fb **fb);
 void drm_fb_copy(struct wlr_drm_fb **new, struct wlr_drm_fb *old);
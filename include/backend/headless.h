@@ -20,8 +20,28 @@ struct wlr_headless_output {
 	struct wlr_headless_backend *backend;
 	struct wl_list link;
 
-	struct wl_event_source *frame_timer;
-	int frame_delay; // ms
+	int32_t refresh; // mHz
+
+	// Virtual vblank clock: vblank n happens at vblank_base_nsec + n * period
+	// and has the sequence number vblank_base_seq + n
+	int64_t vblank_base_nsec;
+	uint64_t vblank_base_seq;
+	int64_t last_vblank; // index of the last vblank a frame was presented on
+	struct wl_event_source *vblank_timer;
+
+	// Simulated time between a commit and the earliest vblank it can make
+	int64_t latency_nsec, jitter_nsec;
+	uint32_t jitter_state; // pseudo-random generator state
+
+	bool manual_clock;
+	int64_t manual_clock_nsec;
+
+	// Commits waiting for a vblank to be presented: the one with the pending
+	// frame, followed by the ones which didn't change the contents since
+	bool present_pending;
+	uint32_t present_commit_seq;
+	uint32_t present_commits_len;
+	int64_t present_vblank;
 };
 
 struct wlr_headless_backend *headless_backend_from_backend(
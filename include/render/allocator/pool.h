@@ -0,0 +1,56 @@
+#ifndef RENDER_ALLOCATOR_POOL_H
+#define RENDER_ALLOCATOR_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+/**
+ * Backing storage of a destroyed buffer, kept around to be recycled. The
+ * allocator embeds it in its own buffer struct.
+ */
+struct buffer_pool_entry {
+	struct wl_list link; // buffer_pool.entries
+	size_t size;
+	int64_t release_msec;
+};
+
+/**
+ * A free list of buffer storage, for allocators whose buffers are expensive
+ * to create but not tied to a particular size or format.
+ *
+ * Storage sizes are rounded up to buckets, so that buffers of similar sizes
+ * can share storage. Entries are destroyed when they have been idle for too
+ * long or when the pool grows past its cap.
+ */
+struct buffer_pool {
+	struct wl_list entries; // buffer_pool_entry.link, most recently released first
+	size_t size; // sum of the sizes of the entries
+	size_t max_size;
+	int64_t max_idle_msec;
+
+	void (*destroy_entry)(struct buffer_pool_entry *entry);
+};
+
+void buffer_pool_init(struct buffer_pool *pool,
+	void (*destroy_entry)(struct buffer_pool_entry *entry));
+void buffer_pool_finish(struct buffer_pool *pool);
+
+/**
+ * Round a storage size up to its bucket.
+ */
+size_t buffer_pool_bucket_size(size_t size);
+
+/**
+ * Take an entry of the given bucket size out of the pool. Returns NULL if
+ * there is none.
+ */
+struct buffer_pool_entry *buffer_pool_take(struct buffer_pool *pool, size_t size);
+/**
+ * Hand over the storage of a destroyed buffer to the pool. Returns false if
+ * the pool doesn't accept it, in which case the caller needs to destroy it.
+ */
+bool buffer_pool_put(struct buffer_pool *pool, struct buffer_pool_entry *entry);
+
+#endif
@@ -3,16 +3,24 @@
 
 #include <wlr/render/allocator.h>
 #include <wlr/types/wlr_buffer.h>
+#include "render/allocator/pool.h"
 
 struct wlr_shm_buffer {
 	struct wlr_buffer base;
 	struct wlr_shm_attributes shm;
 	void *data;
 	size_t size;
+
+	struct wlr_shm_allocator *allocator; // NULL if destroyed
+	struct wl_list link; // wlr_shm_allocator.buffers
+	struct buffer_pool_entry pool_entry;
 };
 
 struct wlr_shm_allocator {
 	struct wlr_allocator base;
+
+	struct wl_list buffers; // wlr_shm_buffer.link
+	struct buffer_pool pool;
 };
 
 /**
@@ -0,0 +1,66 @@
+#ifndef RENDER_ATLAS_H
+#define RENDER_ATLAS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/util/box.h>
+
+struct wlr_buffer;
+struct wlr_renderer;
+struct wlr_texture;
+
+/**
+ * A texture atlas packing small buffers into shared pages, so that a render
+ * pass can draw many of them from the same texture.
+ *
+ * Only buffers providing data pointer access are packed. Their contents are
+ * copied when they are added, so the entries remain valid after the buffer
+ * is released. Each buffer is packed once: adding it again references the
+ * same entry. Fragmented pages are compacted when space runs out, which
+ * moves entries around: callers must query the texture and box of an entry
+ * again after adding another one.
+ */
+struct wlr_atlas {
+	struct wlr_renderer *renderer;
+	struct wl_list pages; // wlr_atlas_page.link
+	size_t pages_len;
+
+	size_t entries_len;
+	bool destroyed;
+};
+
+struct wlr_atlas_entry;
+
+struct wlr_atlas *atlas_create(struct wlr_renderer *renderer);
+/**
+ * Destroy the atlas and its textures. Entries left over stop referencing a
+ * texture, and still need to be destroyed.
+ */
+void atlas_destroy(struct wlr_atlas *atlas);
+
+/**
+ * Pack a buffer into the atlas, or reference its entry if it has already been
+ * packed. Returns NULL if the buffer isn't eligible or no space could be
+ * found for it.
+ */
+struct wlr_atlas_entry *atlas_add(struct wlr_atlas *atlas, struct wlr_buffer *buffer);
+/**
+ * Let the atlas know that the contents of a buffer have changed. The buffer
+ * is packed into a new entry the next time it is added, existing entries
+ * keep the old contents.
+ */
+void atlas_invalidate_buffer(struct wlr_atlas *atlas, struct wlr_buffer *buffer);
+/**
+ * Drop a reference to an entry, destroying it along with the last one.
+ */
+void atlas_entry_unref(struct wlr_atlas_entry *entry);
+
+/**
+ * Get the texture containing an entry, and the box of the entry inside it.
+ * Returns NULL if the atlas has been destroyed.
+ */
+struct wlr_texture *atlas_entry_get_texture(struct wlr_atlas_entry *entry,
+	struct wlr_box *box);
+
+#endif
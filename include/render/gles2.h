@@ -32,10 +32,34 @@ struct wlr_gles2_pixel_format {
 struct wlr_gles2_tex_shader {
 	GLuint program;
 	GLint proj;
-	GLint tex_proj;
 	GLint tex;
 	GLint alpha;
 	GLint pos_attrib;
+	GLint texcoord_attrib;
+};
+
+/**
+ * A staging ring for shm texture uploads, backed by a pixel buffer object.
+ *
+ * Damage is copied into the ring when a texture is updated, and uploaded to
+ * the textures in a single batch before the next render pass. Each batch is
+ * protected by a fence, and its part of the ring is only reused once the GPU
+ * has consumed it.
+ */
+struct wlr_gles2_upload_ring {
+	GLuint pbo;
+	size_t size;
+	uint8_t *map; // non-NULL while uploads are staged
+
+	// Next write offset, and start of the oldest region still in use
+	size_t head, tail;
+	// Bytes in use, including the padding skipped when wrapping around
+	size_t used;
+	// Bytes staged since the last batch was submitted
+	size_t staged;
+
+	struct wl_array pending; // struct wlr_gles2_pending_upload
+	struct wl_array batches; // struct wlr_gles2_upload_batch, oldest first
 };
 
 struct wlr_gles2_renderer {
@@ -72,6 +96,13 @@ struct wlr_gles2_renderer {
 		PFNGLGETQUERYOBJECTIVEXTPROC glGetQueryObjectivEXT;
 		PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
 		PFNGLGETINTEGER64VEXTPROC glGetInteger64vEXT;
+		// Streaming uploads, either from GLES 3.0 or from extensions, only
+		// loaded if all of them are available
+		PFNGLMAPBUFFERRANGEEXTPROC glMapBufferRange;
+		PFNGLUNMAPBUFFEROESPROC glUnmapBuffer;
+		PFNGLFENCESYNCAPPLEPROC glFenceSync;
+		PFNGLCLIENTWAITSYNCAPPLEPROC glClientWaitSync;
+		PFNGLDELETESYNCAPPLEPROC glDeleteSync;
 	} procs;
 
 	struct {
@@ -88,6 +119,13 @@ struct wlr_gles2_renderer {
 
 	struct wl_list buffers; // wlr_gles2_buffer.link
 	struct wl_list textures; // wlr_gles2_texture.link
+
+	struct wlr_gles2_upload_ring upload_ring;
+
+	// Whether consecutive draws are merged into a single one
+	bool batching;
+	// Render pass with batched quads which haven't been drawn yet
+	struct wlr_gles2_render_pass *batch_pass;
 };
 
 struct wlr_gles2_render_timer {
@@ -130,6 +168,17 @@ struct wlr_gles2_texture {
 
 	uint32_t drm_format; // for mutable textures only, used to interpret upload data
 	struct wlr_gles2_buffer *buffer; // for DMA-BUF imports only
+
+	size_t pending_uploads; // staged in wlr_gles2_renderer.upload_ring
+};
+
+struct wlr_gles2_batch_state {
+	struct wlr_gles2_texture *texture; // NULL for rects
+	struct wlr_gles2_tex_shader *shader; // NULL for rects
+	enum wlr_render_blend_mode blend_mode;
+	enum wlr_scale_filter_mode filter_mode;
+	float alpha;
+	struct wlr_render_color color;
 };
 
 struct wlr_gles2_render_pass {
@@ -140,6 +189,14 @@ struct wlr_gles2_render_pass {
 	struct wlr_gles2_render_timer *timer;
 	struct wlr_drm_syncobj_timeline *signal_timeline;
 	uint64_t signal_point;
+
+	// Quads of consecutive draws which only differ by their geometry, drawn
+	// with a single call when the state changes or the pass is submitted
+	struct {
+		struct wlr_gles2_batch_state state;
+		struct wl_array verts; // struct wlr_gles2_vertex
+	} batch;
+	uint32_t draws, quads;
 };
 
 bool is_gles2_pixel_format_supported(const struct wlr_gles2_renderer *renderer,
@@ -165,11 +222,35 @@ struct wlr_texture *gles2_texture_from_buffer(struct wlr_renderer *wlr_renderer,
 	struct wlr_buffer *buffer);
 void gles2_texture_destroy(struct wlr_gles2_texture *texture);
 
+/**
+ * Stage an update of a mutable texture in the upload ring. Returns false if
+ * streaming uploads are unavailable or the ring is full, in which case the
+ * caller needs to upload synchronously. The EGL context must be current.
+ */
+bool gles2_upload_ring_stage(struct wlr_gles2_renderer *renderer,
+	struct wlr_gles2_texture *texture, const void *data, size_t stride,
+	const pixman_region32_t *damage);
+/**
+ * Upload all staged texture updates. The EGL context must be current.
+ */
+void gles2_upload_ring_flush(struct wlr_gles2_renderer *renderer);
+/**
+ * Discard the staged updates of a texture which is being destroyed.
+ */
+void gles2_upload_ring_drop_texture(struct wlr_gles2_renderer *renderer,
+	struct wlr_gles2_texture *texture);
+void gles2_upload_ring_finish(struct wlr_gles2_renderer *renderer);
+
 void push_gles2_debug_(struct wlr_gles2_renderer *renderer,
 	const char *file, const char *func);
 #define push_gles2_debug(renderer) push_gles2_debug_(renderer, _WLR_FILENAME, __func__)
 void pop_gles2_debug(struct wlr_gles2_renderer *renderer);
 
+/**
+ * Draw the quads batched so far by the pass.
+ */
+void gles2_render_pass_flush_batch(struct wlr_gles2_render_pass *pass);
+
 struct wlr_gles2_render_pass *begin_gles2_buffer_pass(struct wlr_gles2_buffer *buffer,
 	struct wlr_egl_context *prev_ctx, struct wlr_gles2_render_timer *timer,
 	struct wlr_drm_syncobj_timeline *signal_timeline, uint64_t signal_point);
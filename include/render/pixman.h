@@ -1,10 +1,14 @@
 #ifndef RENDER_PIXMAN_H
 #define RENDER_PIXMAN_H
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <wlr/render/drm_format_set.h>
 #include <wlr/render/interface.h>
 #include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/util/addon.h>
 #include "render/pixel_format.h"
 
 struct wlr_pixman_pixel_format {
@@ -14,13 +18,72 @@ struct wlr_pixman_pixel_format {
 
 struct wlr_pixman_buffer;
 
+typedef void (*wlr_pixman_job_func_t)(void *data, size_t index);
+
+/**
+ * A fixed set of threads running the jobs of a batch in parallel. The thread
+ * submitting the batch takes part in it, so a pool of N threads spawns N - 1
+ * workers.
+ */
+struct wlr_pixman_worker_pool {
+	pthread_t *workers;
+	size_t workers_len;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond, done_cond;
+	uint64_t generation; // incremented for each batch
+	size_t running; // workers which haven't finished the current batch yet
+	bool stop;
+
+	wlr_pixman_job_func_t func;
+	void *data;
+	size_t jobs_len;
+	atomic_size_t next_job;
+};
+
+#define WLR_PIXMAN_SOLID_FILL_CACHE_SIZE 8
+#define WLR_PIXMAN_TRANSFORM_CACHE_SIZE 4
+
+struct wlr_pixman_solid_fill {
+	struct pixman_color color;
+	pixman_image_t *image; // NULL if unused
+};
+
+/**
+ * Blend a row of 32-bit ARGB pixels onto dst. Source pixels are OR'ed with
+ * src_or (used to set the alpha channel of formats without alpha), then
+ * multiplied by alpha.
+ */
+typedef void (*wlr_pixman_combine_func_t)(uint32_t *dst, const uint32_t *src,
+	int width, uint8_t alpha, uint32_t src_or);
+
+struct wlr_pixman_fast_path_impl {
+	const char *name;
+	bool (*is_supported)(void);
+	wlr_pixman_combine_func_t combine_src, combine_over;
+};
+
 struct wlr_pixman_renderer {
 	struct wlr_renderer wlr_renderer;
 
 	struct wl_list buffers; // wlr_pixman_buffer.link
 	struct wl_list textures; // wlr_pixman_texture.link
+	struct wl_list buffer_images; // wlr_pixman_buffer_image.link
 
 	struct wlr_drm_format_set drm_formats;
+
+	// Solid fill images for rects and alpha masks, only used from the
+	// compositor thread
+	struct wlr_pixman_solid_fill solid_fills[WLR_PIXMAN_SOLID_FILL_CACHE_SIZE];
+	size_t solid_fills_next;
+
+	size_t threads;
+	struct wlr_pixman_worker_pool *pool; // created on first use if threads > 1
+
+	const struct wlr_pixman_fast_path_impl *fast_path; // NULL if disabled
+
+	// Lookups of buffer images when creating or updating textures
+	uint64_t buffer_image_hits, buffer_image_misses;
 };
 
 struct wlr_pixman_buffer {
@@ -33,6 +96,51 @@ struct wlr_pixman_buffer {
 	struct wl_list link; // wlr_pixman_renderer.buffers
 };
 
+struct wlr_pixman_transform_key {
+	enum wl_output_transform transform;
+	struct wlr_box src_box;
+	int dst_width, dst_height;
+};
+
+struct wlr_pixman_cached_transform {
+	struct wlr_pixman_transform_key key;
+	bool has_transform; // false if a straight blit is enough
+	struct pixman_transform transform;
+};
+
+/**
+ * Source image used from the compositor thread, keeping the transform and
+ * filter of the last operation it was used for. Recorded operations hold a
+ * reference, so that it outlives textures destroyed before submission.
+ */
+struct wlr_pixman_view {
+	size_t n_refs;
+	pixman_image_t *image; // may be NULL
+	bool has_transform;
+	struct pixman_transform transform;
+	pixman_filter_t filter;
+};
+
+/**
+ * Images wrapping the memory of a buffer used as a texture source. They are
+ * attached to the buffer rather than to a texture: clients cycle through a
+ * few wl_shm buffers, and textures may be re-created or re-bound to another
+ * buffer on each commit.
+ */
+struct wlr_pixman_buffer_image {
+	struct wlr_addon addon; // wlr_buffer.addons, owned by the renderer
+	struct wlr_pixman_renderer *renderer;
+	struct wl_list link; // wlr_pixman_renderer.buffer_images
+
+	// One reference is held while attached to the buffer, and one by each
+	// texture using it
+	size_t n_refs;
+	bool attached;
+
+	pixman_image_t *image;
+	struct wlr_pixman_view *view;
+};
+
 struct wlr_pixman_texture {
 	struct wlr_texture wlr_texture;
 	struct wlr_pixman_renderer *renderer;
@@ -42,23 +150,110 @@ struct wlr_pixman_texture {
 	pixman_format_code_t format;
 	const struct wlr_pixel_format_info *format_info;
 
-	void *data; // if created via texture_from_pixels
-	struct wlr_buffer *buffer; // if created via texture_from_buffer
+	// Textures created from pixels are backed by a read-only data buffer
+	struct wlr_buffer *buffer;
+	struct wlr_pixman_buffer_image *buffer_image; // referenced
+
+	struct wlr_pixman_cached_transform transforms[WLR_PIXMAN_TRANSFORM_CACHE_SIZE];
+	size_t transforms_len, transforms_next;
+};
+
+struct wlr_pixman_render_op {
+	pixman_op_t op;
+	// Area of the buffer written by the operation, clip included
+	pixman_region32_t clip;
+	struct wlr_box dst_box;
+
+	// Rect operations
+	struct pixman_color color;
+
+	// Texture operations: the source is described by its raw pixels so that
+	// workers can each wrap it in their own pixman image. Textures may be
+	// destroyed before the pass is submitted, so operations don't refer to
+	// them but to their buffer, which the pass keeps locked.
+	struct wlr_buffer *buffer; // NULL for rect operations
+	struct wlr_pixman_view *view;
+	void *src_data; // set when the pass is submitted
+	pixman_format_code_t src_format;
+	int src_width, src_height, src_stride;
+	struct wlr_box src_box;
+	bool has_transform;
+	struct pixman_transform transform;
+	pixman_filter_t filter;
+	uint16_t alpha;
+};
+
+struct wlr_pixman_buffer_access {
+	struct wlr_buffer *buffer;
+	void *data; // NULL unless the pass is being submitted
+	uint32_t format;
+	size_t stride;
+};
+
+// Rendering happens on the CPU when the pass is submitted, so the timer
+// measures the pass from its beginning to the end of its submission
+struct wlr_pixman_render_timer {
+	struct wlr_render_timer base;
+	struct timespec start, end;
 };
 
 struct wlr_pixman_render_pass {
 	struct wlr_render_pass base;
 	struct wlr_pixman_buffer *buffer;
+	struct wlr_pixman_render_timer *timer;
+
+	struct wl_array ops; // struct wlr_pixman_render_op
+	// Texture buffers, locked until the pass is finished and only open for
+	// reading while it is submitted
+	struct wl_array accesses; // struct wlr_pixman_buffer_access
 };
 
 pixman_format_code_t get_pixman_format_from_drm(uint32_t fmt);
 uint32_t get_drm_format_from_pixman(pixman_format_code_t fmt);
 const uint32_t *get_pixman_drm_formats(size_t *len);
 
+struct wlr_pixman_view *pixman_view_create(void);
+struct wlr_pixman_view *pixman_view_ref(struct wlr_pixman_view *view);
+void pixman_view_unref(struct wlr_pixman_view *view);
+
 bool begin_pixman_data_ptr_access(struct wlr_buffer *buffer, pixman_image_t **image_ptr,
 	uint32_t flags);
 
 struct wlr_pixman_render_pass *begin_pixman_render_pass(
-	struct wlr_pixman_buffer *buffer);
+	struct wlr_pixman_buffer *buffer, struct wlr_pixman_render_timer *timer);
+
+/**
+ * Fast path implementations, best first. The last one is portable C and
+ * always supported. The array is NULL-terminated.
+ */
+extern const struct wlr_pixman_fast_path_impl *const pixman_fast_path_impls[];
+
+const struct wlr_pixman_fast_path_impl *pixman_fast_path_get_best_impl(void);
+/**
+ * Composite an operation onto dst using dedicated kernels. Returns false
+ * if the operation isn't supported by fast paths, in which case nothing
+ * has been drawn.
+ */
+bool pixman_fast_path_render_op(const struct wlr_pixman_fast_path_impl *impl,
+	const struct wlr_pixman_render_op *op, pixman_image_t *dst,
+	const pixman_region32_t *clip);
+
+#if defined(__x86_64__) || defined(__i386__)
+extern const struct wlr_pixman_fast_path_impl pixman_fast_path_sse2;
+extern const struct wlr_pixman_fast_path_impl pixman_fast_path_avx2;
+#endif
+#if defined(__aarch64__) && WLR_LITTLE_ENDIAN
+extern const struct wlr_pixman_fast_path_impl pixman_fast_path_neon;
+#endif
+extern const struct wlr_pixman_fast_path_impl pixman_fast_path_c;
+
+struct wlr_pixman_worker_pool *pixman_worker_pool_create(size_t threads);
+void pixman_worker_pool_destroy(struct wlr_pixman_worker_pool *pool);
+/**
+ * Run func(data, index) for each index in [0, jobs_len) and wait for all of
+ * them to complete.
+ */
+void pixman_worker_pool_run(struct wlr_pixman_worker_pool *pool,
+	wlr_pixman_job_func_t func, void *data, size_t jobs_len);
 
 #endif
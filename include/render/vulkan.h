@@ -172,6 +172,10 @@ struct wlr_vk_pipeline_key {
 
 	// only used if source is texture
 	enum wlr_vk_texture_transform texture_transform;
+
+	// takes the quad geometry from per-instance vertex attributes
+	// (struct wlr_vk_instance_data) instead of push constants
+	bool instanced;
 };
 
 struct wlr_vk_pipeline {
@@ -241,17 +245,29 @@ struct wlr_vk_render_buffer {
 bool vulkan_setup_plain_framebuffer(struct wlr_vk_render_buffer *buffer,
 	const struct wlr_dmabuf_attributes *dmabuf);
 
+struct wlr_vk_instance_buffer {
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	void *cpu_mapping;
+};
+
 struct wlr_vk_command_buffer {
 	VkCommandBuffer vk;
 	bool recording;
 	uint64_t timeline_point;
 	// Textures to destroy after the command buffer completes
 	struct wl_list destroy_textures; // wlr_vk_texture.destroy_link
-	// Staging shared buffers to release after the command buffer completes
-	struct wl_list stage_buffers; // wlr_vk_shared_buffer.link
 	// Color transform to unref after the command buffer completes
 	struct wlr_color_transform *color_transform;
 
+	// Per-instance data of the batched draws, reset when recording starts
+	struct wlr_vk_instance_buffer instances;
+	VkDeviceSize instances_used;
+	// Instance buffers outgrown while recording, to destroy after the
+	// command buffer completes
+	struct wl_array retired_instances; // struct wlr_vk_instance_buffer
+
 	// For DMA-BUF implicit sync interop, may be NULL
 	VkSemaphore binary_semaphore;
 
@@ -269,6 +285,7 @@ struct wlr_vk_renderer {
 	VkCommandPool command_pool;
 
 	VkShaderModule vert_module;
+	VkShaderModule instanced_vert_module;
 	VkShaderModule tex_frag_module;
 	VkShaderModule quad_frag_module;
 	VkShaderModule output_module;
@@ -316,8 +333,18 @@ struct wlr_vk_renderer {
 		struct wlr_vk_command_buffer *cb;
 		uint64_t last_timeline_point;
 		struct wl_list buffers; // wlr_vk_shared_buffer.link
+
+		// Bytes of the stage buffers in use by allocations, and allocated
+		VkDeviceSize used, size;
+		VkDeviceSize peak_used, peak_size;
 	} stage;
 
+	// Batch consecutive compatible draws into instanced draws
+	bool batching;
+	// Draws issued and elements (rects and textures) submitted by all
+	// render passes
+	uint64_t draws, elements;
+
 	struct {
 		bool initialized;
 		uint32_t drm_format;
@@ -334,6 +361,14 @@ struct wlr_vk_vert_pcr_data {
 	float uv_size[2];
 };
 
+// per-instance vertex data for batched draws, see shaders/instanced.vert
+struct wlr_vk_instance_data {
+	float proj[2][4];
+	float uv_off[2];
+	float uv_size[2];
+	float clip[4];
+};
+
 struct wlr_vk_frag_output_pcr_data {
 	float lut_3d_offset;
 	float lut_3d_scale;
@@ -370,6 +405,12 @@ VkCommandBuffer vulkan_record_stage_cb(struct wlr_vk_renderer *renderer);
 // finished execution.
 bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer);
 
+// Allocates space for per-instance vertex data in the instance buffer of
+// a recording command buffer, which stays valid until it completes.
+bool vulkan_command_buffer_alloc_instances(struct wlr_vk_renderer *renderer,
+	struct wlr_vk_command_buffer *cb, VkDeviceSize size,
+	VkBuffer *buffer, VkDeviceSize *offset, void **data);
+
 struct wlr_vk_render_pass_texture {
 	struct wlr_vk_texture *texture;
 
@@ -393,6 +434,17 @@ struct wlr_vk_render_pass {
 	uint64_t signal_point;
 
 	struct wl_array textures; // struct wlr_vk_render_pass_texture
+
+	// Pending batch of draws sharing their pipeline, descriptor set and
+	// fragment push constants
+	struct {
+		const struct wlr_vk_pipeline *pipe;
+		VkDescriptorSet ds; // VK_NULL_HANDLE for rects
+		float frag_pcr[4];
+		uint32_t frag_pcr_size;
+		struct wl_array instances; // struct wlr_vk_instance_data
+	} batch;
+	uint32_t draws, elements;
 };
 
 struct wlr_vk_render_pass *vulkan_begin_render_pass(struct wlr_vk_renderer *renderer,
@@ -405,6 +457,10 @@ struct wlr_vk_render_pass *vulkan_begin_render_pass(struct wlr_vk_renderer *rend
 struct wlr_vk_buffer_span vulkan_get_stage_span(
 	struct wlr_vk_renderer *renderer, VkDeviceSize size,
 	VkDeviceSize alignment);
+// Marks the stage spans handed out so far as used by the stage cb submitted
+// with the given timeline point, to release them once it's reached.
+void vulkan_stage_mark_submitted(struct wlr_vk_renderer *renderer,
+	uint64_t timeline_point);
 
 // Tries to allocate a texture descriptor set. Will additionally
 // return the pool it was allocated from when successful (for freeing it later).
@@ -489,17 +545,23 @@ struct wlr_vk_descriptor_pool {
 struct wlr_vk_allocation {
 	VkDeviceSize start;
 	VkDeviceSize size;
+	// Timeline point of the stage cb using the allocation, zero until the
+	// stage cb is submitted
+	uint64_t timeline_point;
 };
 
 // List of suballocated staging buffers.
 // Used to upload to/read from device local images.
+// Each buffer is used as a ring: allocations are made at its head and
+// released from its tail, in submission order.
 struct wlr_vk_shared_buffer {
-	struct wl_list link; // wlr_vk_renderer.stage.buffers or wlr_vk_command_buffer.stage_buffers
+	struct wl_list link; // wlr_vk_renderer.stage.buffers
 	VkBuffer buffer;
 	VkDeviceMemory memory;
 	VkDeviceSize buf_size;
 	void *cpu_mapping;
-	struct wl_array allocs; // struct wlr_vk_allocation
+	VkDeviceSize head, tail;
+	struct wl_array allocs; // struct wlr_vk_allocation, oldest first
 	int64_t last_used_ms;
 };
 
@@ -23,6 +23,23 @@ bool output_cursor_set_texture(struct wlr_output_cursor *cursor,
 
 void output_defer_present(struct wlr_output *output, struct wlr_output_event_present event);
 
+/**
+ * Send a frame event without going through the frame scheduler.
+ */
+void output_send_frame_now(struct wlr_output *output);
+
+/**
+ * Delay the frame event of the refresh cycle which just started, if
+ * predictive frame scheduling is enabled. Returns false if the frame event
+ * needs to be sent right away.
+ */
+bool output_frame_scheduler_delay_frame(struct wlr_output *output);
+void output_frame_scheduler_handle_commit(struct wlr_output *output,
+	const struct wlr_output_state *state, const struct timespec *now);
+void output_frame_scheduler_handle_present(struct wlr_output *output,
+	const struct wlr_output_event_present *event);
+void output_frame_scheduler_finish(struct wlr_output *output);
+
 bool output_prepare_commit(struct wlr_output *output, const struct wlr_output_state *state);
 void output_apply_commit(struct wlr_output *output, const struct wlr_output_state *state);
 
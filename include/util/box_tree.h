@@ -0,0 +1,59 @@
+#ifndef UTIL_BOX_TREE_H
+#define UTIL_BOX_TREE_H
+
+#include <stdbool.h>
+#include <pixman.h>
+#include <wayland-util.h>
+
+/**
+ * `struct box_tree` is a dynamic bounding volume hierarchy: a height-balanced
+ * binary tree of axis-aligned boxes. Leaves carry a user pointer and can be
+ * inserted, moved and removed incrementally. Queries for all leaves
+ * overlapping a box run in O(log n + k) for k results.
+ *
+ * Leaves are identified by the integer returned by box_tree_insert(). The
+ * identifier stays valid until the leaf is removed or moved.
+ */
+struct box_tree {
+	struct wl_array nodes; // struct box_tree_node
+	int root; // -1 if empty
+	int free_list; // -1 if empty
+	size_t leaves;
+};
+
+typedef bool (*box_tree_iterator_func_t)(void *data,
+	const pixman_box32_t *box, void *user_data);
+
+void box_tree_init(struct box_tree *tree);
+
+void box_tree_finish(struct box_tree *tree);
+
+/**
+ * Insert a leaf covering `box`. Empty boxes are accepted but never match
+ * a query.
+ *
+ * Returns the leaf identifier, or -1 on allocation failure.
+ */
+int box_tree_insert(struct box_tree *tree, pixman_box32_t box, void *data);
+
+void box_tree_remove(struct box_tree *tree, int leaf);
+
+/**
+ * Change the box covered by a leaf. Returns the new leaf identifier, or -1
+ * on allocation failure (in which case the leaf has been removed).
+ */
+int box_tree_move(struct box_tree *tree, int leaf, pixman_box32_t box);
+
+const pixman_box32_t *box_tree_get_box(struct box_tree *tree, int leaf);
+
+/**
+ * Call `iterator` for each leaf overlapping `box`. Iteration stops as soon
+ * as the iterator returns true, in which case true is returned. The tree
+ * must not be modified from the iterator.
+ *
+ * The order in which leaves are visited is unspecified.
+ */
+bool box_tree_query(struct box_tree *tree, const pixman_box32_t *box,
+	box_tree_iterator_func_t iterator, void *user_data);
+
+#endif
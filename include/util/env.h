@@ -20,4 +20,12 @@ bool env_parse_bool(const char *option);
  */
 size_t env_parse_switch(const char *option, const char **switches);
 
+/**
+ * Parse a non-negative integer from an environment variable.
+ *
+ * On success, the parsed value is returned. If the variable is unset or on
+ * error, default_value is returned.
+ */
+long env_parse_uint(const char *option, long default_value);
+
 #endif
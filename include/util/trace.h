@@ -0,0 +1,62 @@
+#ifndef UTIL_TRACE_H
+#define UTIL_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+
+/**
+ * Tracing of the frame pipeline, in the Chrome trace event format (which
+ * Perfetto can open as well).
+ *
+ * Tracing is compiled in with the tracing build option, and enabled at
+ * runtime by setting WLR_TRACE to the path of the trace file. Events are
+ * recorded in a ring buffer, which is written to the trace file when the
+ * process exits and when it receives SIGUSR2.
+ *
+ * Event names must be string literals. Events must only be recorded from the
+ * compositor thread.
+ */
+
+#if HAVE_TRACING
+
+enum trace_state {
+	TRACE_UNINITIALIZED,
+	TRACE_DISABLED,
+	TRACE_ENABLED,
+};
+
+extern enum trace_state trace_state;
+
+void trace_init(void);
+void trace_begin(const char *name);
+void trace_end(const char *name);
+void trace_counter(const char *name, int64_t value);
+void trace_instant(const char *name);
+
+static inline bool trace_is_enabled(void) {
+	if (trace_state == TRACE_UNINITIALIZED) {
+		trace_init();
+	}
+	return trace_state == TRACE_ENABLED;
+}
+
+#define TRACE_BEGIN(name) \
+	do { if (trace_is_enabled()) trace_begin(name); } while (0)
+#define TRACE_END(name) \
+	do { if (trace_is_enabled()) trace_end(name); } while (0)
+#define TRACE_COUNTER(name, value) \
+	do { if (trace_is_enabled()) trace_counter(name, value); } while (0)
+#define TRACE_INSTANT(name) \
+	do { if (trace_is_enabled()) trace_instant(name); } while (0)
+
+#else
+
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_COUNTER(name, value) do { (void)(value); } while (0)
+#define TRACE_INSTANT(name) do {} while (0)
+
+#endif
+
+#endif
@@ -25,6 +25,35 @@ struct wlr_backend *wlr_headless_backend_create(struct wl_event_loop *loop);
 struct wlr_output *wlr_headless_add_output(struct wlr_backend *backend,
 	unsigned int width, unsigned int height);
 
+/**
+ * Set the simulated scan-out latency of a headless output.
+ *
+ * Headless outputs present frames on the vblanks of a virtual clock aligned
+ * to their refresh rate. A frame is presented on the first vblank at least
+ * latency_nsec after its commit, plus a pseudo-random jitter of up to
+ * jitter_nsec. The jitter sequence of an output is always the same, so that
+ * runs can be reproduced. Frames are presented on the next vblank by
+ * default.
+ */
+void wlr_headless_output_set_scanout_latency(struct wlr_output *output,
+	int64_t latency_nsec, int64_t jitter_nsec);
+/**
+ * Let the caller drive the virtual clock of a headless output.
+ *
+ * When enabled, the clock stops and only moves forward when
+ * wlr_headless_output_advance_clock() is called. Presentation timestamps are
+ * taken from this clock.
+ */
+void wlr_headless_output_set_manual_clock(struct wlr_output *output,
+	bool manual);
+/**
+ * Move the manual clock of a headless output forward by nsec, which must not
+ * be negative, sending the present and frame events of the frames presented
+ * on the vblanks reached.
+ */
+void wlr_headless_output_advance_clock(struct wlr_output *output,
+	int64_t nsec);
+
 bool wlr_backend_is_headless(struct wlr_backend *backend);
 bool wlr_output_is_headless(struct wlr_output *output);
 
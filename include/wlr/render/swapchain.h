@@ -5,6 +5,7 @@
 #include <wayland-server-core.h>
 #include <wlr/render/drm_format_set.h>
 
+// Maximum number of buffers in a swapchain
 #define WLR_SWAPCHAIN_CAP 4
 
 struct wlr_swapchain_slot {
@@ -23,9 +24,14 @@ struct wlr_swapchain {
 	struct wlr_drm_format format;
 
 	struct wlr_swapchain_slot slots[WLR_SWAPCHAIN_CAP];
+	// Number of buffers the swapchain keeps allocated. Starts at two, grows
+	// when all buffers are busy or frames are missed, and shrinks back once
+	// the extra buffers haven't been needed for a while.
+	size_t depth;
 
 	struct {
 		struct wl_listener allocator_destroy;
+		int64_t last_pressure_msec;
 	} WLR_PRIVATE;
 };
 
@@ -40,6 +46,13 @@ void wlr_swapchain_destroy(struct wlr_swapchain *swapchain);
  * unlock it by calling wlr_buffer_unlock.
  */
 struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain);
+/**
+ * Let the swapchain know that a frame rendered into one of its buffers has
+ * been presented late. The swapchain grows to triple buffering and allocates
+ * the extra buffer right away, so that rendering the next frame doesn't need
+ * to wait for the previous one.
+ */
+void wlr_swapchain_report_missed_frame(struct wlr_swapchain *swapchain);
 /**
  * Returns true if this buffer has been created by this swapchain, and false
  * otherwise.
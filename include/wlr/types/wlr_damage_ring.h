@@ -29,12 +29,35 @@ struct wlr_damage_ring_buffer {
 	} WLR_PRIVATE;
 };
 
+/**
+ * Statistics about damage simplification, accumulated over all the regions
+ * simplified by a damage ring.
+ */
+struct wlr_damage_ring_stats {
+	// Number of regions simplified
+	uint64_t simplified;
+	// Sums of the rectangle counts and areas, before and after simplification
+	uint64_t rects_before, rects_after;
+	uint64_t area_before, area_after;
+};
+
 struct wlr_damage_ring {
 	// Difference between the current buffer and the previous one
 	pixman_region32_t current;
 
+	// Damage simplification policy, which may be changed after
+	// wlr_damage_ring_init(). Rectangles are merged into their bounding box if
+	// less than merge_waste_ratio of the bounding box area isn't damaged.
+	// Regions are then cut down to at most max_rects rectangles, or left as
+	// is if max_rects is zero.
+	float merge_waste_ratio;
+	int max_rects;
+
+	struct wlr_damage_ring_stats stats;
+
 	struct {
 		struct wl_list buffers; // wlr_damage_ring_buffer.link
+		struct wl_array boxes; // pixman_box32_t, scratch space
 	} WLR_PRIVATE;
 };
 
@@ -45,6 +68,8 @@ void wlr_damage_ring_finish(struct wlr_damage_ring *ring);
 /**
  * Add a region to the current damage. The region must be in the buffer-local
  * coordinate space.
+ *
+ * The current damage is simplified if it has more than max_rects rectangles.
  */
 void wlr_damage_ring_add(struct wlr_damage_ring *ring,
 	const pixman_region32_t *damage);
@@ -71,7 +96,8 @@ void wlr_damage_ring_add_whole(struct wlr_damage_ring *ring);
  * Users should damage the ring if an error occurs while rendering or
  * submitting the new buffer to the backend.
  *
- * The returned damage will be in the buffer-local coordinate space.
+ * The returned damage will be in the buffer-local coordinate space, and is
+ * simplified according to the damage ring policy.
  */
 void wlr_damage_ring_rotate_buffer(struct wlr_damage_ring *ring,
 	struct wlr_buffer *buffer, pixman_region32_t *damage);
@@ -0,0 +1,123 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_FRAME_STATS_H
+#define WLR_TYPES_WLR_FRAME_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/log.h>
+
+struct wlr_output;
+struct wlr_render_timer;
+
+enum wlr_frame_stats_metric {
+	// CPU time spent building a frame before rendering it
+	WLR_FRAME_STATS_BUILD,
+	// CPU time spent recording and submitting the render pass
+	WLR_FRAME_STATS_RENDER_CPU,
+	// Render time reported by the renderer's timer, including the time
+	// spent on the GPU if any
+	WLR_FRAME_STATS_RENDER_GPU,
+	// Time between the commit of a frame and its presentation
+	WLR_FRAME_STATS_PRESENT_LATENCY,
+};
+
+#define WLR_FRAME_STATS_METRIC_COUNT (WLR_FRAME_STATS_PRESENT_LATENCY + 1)
+// Number of samples the statistics are computed over
+#define WLR_FRAME_STATS_WINDOW 128
+
+struct wlr_frame_stats_summary {
+	size_t samples; // zero if the metric hasn't been sampled
+	int64_t min_ns, avg_ns, p99_ns, max_ns;
+};
+
+/**
+ * Rolling frame-time statistics of an output.
+ *
+ * The scene-graph feeds the build and render metrics of the frames it
+ * renders, and hands over a render timer which is read once the frame has
+ * been presented. Compositors rendering on their own can feed the same
+ * metrics with wlr_frame_stats_add_sample() and
+ * wlr_frame_stats_add_render_timer(). Presentation latency and dropped frames
+ * are tracked from the output's commit and present events.
+ */
+struct wlr_frame_stats {
+	struct wlr_output *output;
+
+	// Frames presented and frames committed but not presented, since the
+	// statistics were created or reset
+	uint64_t presented, dropped;
+
+	struct {
+		struct wlr_addon addon;
+
+		struct {
+			int64_t samples[WLR_FRAME_STATS_WINDOW]; // ring buffer
+			size_t len; // number of samples recorded so far
+		} metrics[WLR_FRAME_STATS_METRIC_COUNT];
+
+		// Render timer of the frame about to be committed
+		struct wlr_render_timer *render_timer;
+		// Frames committed and waiting for their present event, oldest
+		// first
+		struct wl_array inflight; // struct wlr_frame_stats_inflight
+
+		struct wl_listener output_commit;
+		struct wl_listener output_present;
+	} WLR_PRIVATE;
+};
+
+/**
+ * Get the frame statistics of an output, starting to collect them if this is
+ * the first call. The statistics are destroyed along with the output.
+ */
+struct wlr_frame_stats *wlr_frame_stats_get(struct wlr_output *output);
+
+/**
+ * Get the frame statistics of an output if they're being collected, without
+ * starting to collect them otherwise.
+ */
+struct wlr_frame_stats *wlr_frame_stats_try_get(struct wlr_output *output);
+
+/**
+ * Record a sample of a metric for the frame being built.
+ */
+void wlr_frame_stats_add_sample(struct wlr_frame_stats *stats,
+	enum wlr_frame_stats_metric metric, int64_t duration_ns);
+
+/**
+ * Hand over the render timer of the frame being built. The timer is read
+ * and destroyed once the frame has been presented, or when the next frame
+ * hands over its own timer if this frame never gets committed.
+ */
+void wlr_frame_stats_add_render_timer(struct wlr_frame_stats *stats,
+	struct wlr_render_timer *timer);
+
+/**
+ * Compute the statistics of a metric over its last WLR_FRAME_STATS_WINDOW
+ * samples. Returns false if the metric hasn't been sampled.
+ */
+bool wlr_frame_stats_get_summary(struct wlr_frame_stats *stats,
+	enum wlr_frame_stats_metric metric, struct wlr_frame_stats_summary *summary);
+
+/**
+ * Drop all the samples and counters collected so far.
+ */
+void wlr_frame_stats_reset(struct wlr_frame_stats *stats);
+
+/**
+ * Write the statistics to the log.
+ */
+void wlr_frame_stats_log(struct wlr_frame_stats *stats,
+	enum wlr_log_importance verbosity);
+
+#endif
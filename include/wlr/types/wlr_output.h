@@ -235,6 +235,31 @@ struct wlr_output {
 
 	struct {
 		struct wl_listener display_destroy;
+
+		// Sequence number and time of the last commit with a buffer
+		uint32_t buffer_commit_seq;
+		struct timespec buffer_commit_time;
+
+		// Predictive frame scheduling, see
+		// wlr_output_set_predictive_frame_scheduling()
+		bool frame_scheduling;
+		struct wl_event_source *frame_timer;
+		bool frame_delayed; // the frame_timer is armed
+		// Time at which the last frame event was sent, zero once a commit
+		// answered it
+		struct timespec frame_time;
+		// Time the compositor took to answer the last frame events
+		int64_t frame_durations[16];
+		size_t frame_durations_len;
+		// Time and refresh period of the last presentation
+		struct timespec present_time;
+		int present_refresh; // nsec
+		// Refresh cycle targeted by the delayed frame event, then by the
+		// commit answering it. Zero if none.
+		struct timespec frame_deadline, commit_deadline;
+		uint32_t commit_deadline_seq;
+		// Frame events left to send right away after a missed deadline
+		int frame_fallback;
 	} WLR_PRIVATE;
 };
 
@@ -370,6 +395,21 @@ bool wlr_output_commit_state(struct wlr_output *output,
  * it is a no-op.
  */
 void wlr_output_schedule_frame(struct wlr_output *output);
+/**
+ * Enable or disable predictive frame scheduling.
+ *
+ * When enabled, the `frame` event following a refresh cycle is delayed to
+ * shortly before the deadline of the next one. The deadline is predicted from
+ * the time the compositor took to commit a new frame after the last `frame`
+ * events, plus the GPU render time recorded by struct wlr_frame_stats if any.
+ * This reduces latency at the cost of the risk of missing a refresh cycle, in
+ * which case `frame` events are sent right away for a while.
+ *
+ * Defaults to the value of the WLR_OUTPUT_PREDICTIVE_FRAMES environment
+ * variable.
+ */
+void wlr_output_set_predictive_frame_scheduling(struct wlr_output *output,
+	bool enabled);
 /**
  * Returns the maximum length of each gamma ramp, or 0 if unsupported.
  */
@@ -25,6 +25,7 @@
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_damage_ring.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_output_layer.h>
 #include <wlr/util/addon.h>
 #include <wlr/util/box.h>
 
@@ -77,6 +78,9 @@ struct wlr_scene_node {
 
 	struct {
 		pixman_region32_t visible;
+
+		int index_leaf; // -1 if not in the scene's spatial index
+		uint32_t order; // position in rendering order, see scene_update_order()
 	} WLR_PRIVATE;
 };
 
@@ -91,6 +95,13 @@ struct wlr_scene_tree {
 	struct wlr_scene_node node;
 
 	struct wl_list children; // wlr_scene_node.link
+
+	struct {
+		// Union of the opaque regions of enabled children, relative to the
+		// tree node. Only valid if opaque_dirty is false.
+		pixman_region32_t opaque;
+		bool opaque_dirty;
+	} WLR_PRIVATE;
 };
 
 /** The root scene-graph node. */
@@ -112,6 +123,23 @@ struct wlr_scene {
 		bool direct_scanout;
 		bool calculate_visibility;
 		bool highlight_transparent_region;
+		bool validate_index;
+		bool incremental_visibility;
+
+		// Bounding volume hierarchy of enabled rect and buffer nodes in
+		// layout-local coordinates. NULL if disabled.
+		struct box_tree *index;
+		bool order_dirty;
+
+		// Texture atlas small buffers are packed into. Created for the
+		// renderer of the first output rendered.
+		bool atlas_enabled;
+		struct wlr_atlas *atlas;
+		struct wl_listener atlas_renderer_destroy;
+
+		// Maximum number of scene buffers offloaded to output layers per
+		// output
+		size_t output_layers;
 	} WLR_PRIVATE;
 };
 
@@ -188,6 +216,8 @@ struct wlr_scene_buffer {
 	struct {
 		uint64_t active_outputs;
 		struct wlr_texture *texture;
+		// Used instead of the texture if the buffer could be packed
+		struct wlr_atlas_entry *atlas_entry;
 		struct wlr_linux_dmabuf_feedback_v1_init_options prev_feedback_options;
 
 		bool own_buffer;
@@ -202,6 +232,30 @@ struct wlr_scene_buffer {
 	} WLR_PRIVATE;
 };
 
+#define WLR_SCENE_OUTPUT_LAYERS_CAP 4
+
+struct wlr_scene_layer_plan_entry {
+	// Only used for comparisons, may be dangling
+	const struct wlr_scene_buffer *scene_buffer;
+	struct wlr_fbox src_box;
+	struct wlr_box dst_box; // output-buffer-local coordinates
+	// Properties of the buffer handed over to the backend which may change
+	// whether it accepts the layer
+	int buffer_width, buffer_height;
+	uint32_t buffer_caps; // bitfield of enum wlr_buffer_cap
+	uint32_t format;
+	uint64_t modifier; // only set for DMA-BUFs
+};
+
+/**
+ * Scene buffers offloaded to the output layers of a scene output, from the
+ * bottom-most to the top-most.
+ */
+struct wlr_scene_layer_plan {
+	size_t len;
+	struct wlr_scene_layer_plan_entry entries[WLR_SCENE_OUTPUT_LAYERS_CAP];
+};
+
 /** A viewport for an output in the scene-graph */
 struct wlr_scene_output {
 	struct wlr_output *output;
@@ -233,15 +287,46 @@ struct wlr_scene_output {
 		struct wl_list damage_highlight_regions;
 
 		struct wl_array render_list;
+		// The render list is reused across frames until the scene-graph
+		// changes structurally or the output's logical box changes
+		bool render_list_dirty;
+		struct wlr_box render_list_box;
+		bool render_list_fractional_scale;
+		uint64_t render_list_rebuilds, render_list_reuses;
 
 		struct wlr_drm_syncobj_timeline *in_timeline;
 		uint64_t in_point;
+
+		// Output layers the top-most scene buffers are offloaded to, created
+		// on demand
+		struct wlr_output_layer *layers[WLR_SCENE_OUTPUT_LAYERS_CAP];
+		struct wlr_output_layer_state layer_states[WLR_SCENE_OUTPUT_LAYERS_CAP];
+		size_t layers_len;
+		// Whether the last committed state displayed a layer
+		bool layers_active;
+		// Plan of the last frame built, and last plans the backend accepted
+		// and rejected. Plans equal to the accepted or rejected ones aren't
+		// tested again.
+		struct wlr_scene_layer_plan layers_prev, layers_accepted, layers_rejected;
+		// Rejected plans delay the next attempt by an increasing number of
+		// frames
+		uint64_t layers_frame, layers_retry_frame;
+		uint32_t layers_backoff;
 	} WLR_PRIVATE;
 };
 
 struct wlr_scene_timer {
 	int64_t pre_render_duration;
 	struct wlr_render_timer *render_timer;
+
+	// Number of frames for which the scene output's render list has been
+	// rebuilt or reused, since the scene output was created
+	uint64_t render_list_rebuilds, render_list_reuses;
+	// Number of entries in the render list for this frame
+	size_t render_list_len;
+	// Area of the damage rendered for this frame, in buffer-local pixels.
+	// Zero if the frame was scanned out directly.
+	uint64_t damage_area;
 };
 
 /** A layer shell scene helper */
@@ -28,6 +28,7 @@ struct wlr_shm {
 	struct {
 		uint32_t *formats;
 		size_t formats_len;
+		bool populate;
 
 		struct wl_listener display_destroy;
 	} WLR_PRIVATE;
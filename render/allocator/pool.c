@@ -0,0 +1,94 @@
+#include <assert.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "render/allocator/pool.h"
+#include "util/env.h"
+#include "util/time.h"
+
+#define DEFAULT_MAX_SIZE_MIB 64
+#define DEFAULT_MAX_IDLE_MSEC 5000
+
+void buffer_pool_init(struct buffer_pool *pool,
+		void (*destroy_entry)(struct buffer_pool_entry *entry)) {
+	*pool = (struct buffer_pool){
+		.max_size = (size_t)env_parse_uint("WLR_ALLOCATOR_POOL_SIZE",
+			DEFAULT_MAX_SIZE_MIB) * 1024 * 1024,
+		.max_idle_msec = env_parse_uint("WLR_ALLOCATOR_POOL_IDLE_MS",
+			DEFAULT_MAX_IDLE_MSEC),
+		.destroy_entry = destroy_entry,
+	};
+	wl_list_init(&pool->entries);
+}
+
+static void pool_remove(struct buffer_pool *pool, struct buffer_pool_entry *entry) {
+	assert(pool->size >= entry->size);
+	pool->size -= entry->size;
+	wl_list_remove(&entry->link);
+}
+
+void buffer_pool_finish(struct buffer_pool *pool) {
+	struct buffer_pool_entry *entry, *tmp;
+	wl_list_for_each_safe(entry, tmp, &pool->entries, link) {
+		pool_remove(pool, entry);
+		pool->destroy_entry(entry);
+	}
+}
+
+/**
+ * Destroy the entries which have been idle for too long, then the oldest
+ * ones until the pool fits in its cap.
+ */
+static void pool_trim(struct buffer_pool *pool) {
+	int64_t now = get_current_time_msec();
+
+	struct buffer_pool_entry *entry, *tmp;
+	wl_list_for_each_reverse_safe(entry, tmp, &pool->entries, link) {
+		if (pool->size <= pool->max_size &&
+				now - entry->release_msec < pool->max_idle_msec) {
+			break;
+		}
+		pool_remove(pool, entry);
+		pool->destroy_entry(entry);
+	}
+}
+
+size_t buffer_pool_bucket_size(size_t size) {
+	size_t page_size = (size_t)sysconf(_SC_PAGE_SIZE);
+	if (size <= 4 * page_size) {
+		return (size + page_size - 1) & ~(page_size - 1);
+	}
+
+	// Round up to a power-of-two step between an eighth and a quarter of
+	// the size, and at least a page so that buckets stay page-aligned. This
+	// wastes less than a quarter of the size.
+	size_t step = page_size;
+	while (step * 8 <= size) {
+		step *= 2;
+	}
+	return (size + step - 1) & ~(step - 1);
+}
+
+struct buffer_pool_entry *buffer_pool_take(struct buffer_pool *pool, size_t size) {
+	pool_trim(pool);
+
+	struct buffer_pool_entry *entry;
+	wl_list_for_each(entry, &pool->entries, link) {
+		if (entry->size == size) {
+			pool_remove(pool, entry);
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+bool buffer_pool_put(struct buffer_pool *pool, struct buffer_pool_entry *entry) {
+	if (entry->size > pool->max_size) {
+		return false;
+	}
+
+	entry->release_msec = get_current_time_msec();
+	wl_list_insert(&pool->entries, &entry->link);
+	pool->size += entry->size;
+	pool_trim(pool);
+	return true;
+}
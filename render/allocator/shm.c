@@ -21,13 +21,30 @@ static struct wlr_shm_buffer *shm_buffer_from_buffer(
 	return buffer;
 }
 
-static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
-	struct wlr_shm_buffer *buffer = shm_buffer_from_buffer(wlr_buffer);
+static void buffer_free(struct wlr_shm_buffer *buffer) {
 	munmap(buffer->data, buffer->size);
 	close(buffer->shm.fd);
 	free(buffer);
 }
 
+static void pool_destroy_entry(struct buffer_pool_entry *entry) {
+	struct wlr_shm_buffer *buffer = wl_container_of(entry, buffer, pool_entry);
+	buffer_free(buffer);
+}
+
+static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct wlr_shm_buffer *buffer = shm_buffer_from_buffer(wlr_buffer);
+	wl_list_remove(&buffer->link);
+
+	// Keep the file and its mapping around for the next buffer
+	buffer->pool_entry.size = buffer->size;
+	if (buffer->allocator != NULL &&
+			buffer_pool_put(&buffer->allocator->pool, &buffer->pool_entry)) {
+		return;
+	}
+	buffer_free(buffer);
+}
+
 static bool buffer_get_shm(struct wlr_buffer *wlr_buffer,
 		struct wlr_shm_attributes *shm) {
 	struct wlr_shm_buffer *buffer = shm_buffer_from_buffer(wlr_buffer);
@@ -58,6 +75,8 @@ static const struct wlr_buffer_impl buffer_impl = {
 static struct wlr_buffer *allocator_create_buffer(
 		struct wlr_allocator *wlr_allocator, int width, int height,
 		const struct wlr_drm_format *format) {
+	struct wlr_shm_allocator *allocator = wl_container_of(wlr_allocator, allocator, base);
+
 	const struct wlr_pixel_format_info *info =
 		drm_get_pixel_format_info(format->format);
 	if (info == NULL) {
@@ -65,41 +84,63 @@ static struct wlr_buffer *allocator_create_buffer(
 		return NULL;
 	}
 
-	struct wlr_shm_buffer *buffer = calloc(1, sizeof(*buffer));
-	if (buffer == NULL) {
-		return NULL;
-	}
-	wlr_buffer_init(&buffer->base, &buffer_impl, width, height);
-
 	// TODO: consider using a single file for multiple buffers
 	int stride = pixel_format_info_min_stride(info, width); // TODO: align?
-	buffer->size = stride * height;
-	buffer->shm.fd = allocate_shm_file(buffer->size);
-	if (buffer->shm.fd < 0) {
-		free(buffer);
-		return NULL;
+	size_t size = buffer_pool_bucket_size((size_t)stride * height);
+
+	struct wlr_shm_buffer *buffer;
+	struct buffer_pool_entry *entry = buffer_pool_take(&allocator->pool, size);
+	if (entry != NULL) {
+		buffer = wl_container_of(entry, buffer, pool_entry);
+	} else {
+		buffer = calloc(1, sizeof(*buffer));
+		if (buffer == NULL) {
+			return NULL;
+		}
+
+		buffer->size = size;
+		buffer->shm.fd = allocate_shm_file(buffer->size);
+		if (buffer->shm.fd < 0) {
+			free(buffer);
+			return NULL;
+		}
+
+		buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			buffer->shm.fd, 0);
+		if (buffer->data == MAP_FAILED) {
+			wlr_log_errno(WLR_ERROR, "mmap failed");
+			close(buffer->shm.fd);
+			free(buffer);
+			return NULL;
+		}
 	}
 
+	wlr_buffer_init(&buffer->base, &buffer_impl, width, height);
+
 	buffer->shm.format = format->format;
 	buffer->shm.width = width;
 	buffer->shm.height = height;
 	buffer->shm.stride = stride;
 	buffer->shm.offset = 0;
 
-	buffer->data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED,
-		buffer->shm.fd, 0);
-	if (buffer->data == MAP_FAILED) {
-		wlr_log_errno(WLR_ERROR, "mmap failed");
-		close(buffer->shm.fd);
-		free(buffer);
-		return NULL;
-	}
+	buffer->allocator = allocator;
+	wl_list_insert(&allocator->buffers, &buffer->link);
 
 	return &buffer->base;
 }
 
 static void allocator_destroy(struct wlr_allocator *wlr_allocator) {
-	free(wlr_allocator);
+	struct wlr_shm_allocator *allocator = wl_container_of(wlr_allocator, allocator, base);
+
+	struct wlr_shm_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &allocator->buffers, link) {
+		buffer->allocator = NULL;
+		wl_list_remove(&buffer->link);
+		wl_list_init(&buffer->link);
+	}
+	buffer_pool_finish(&allocator->pool);
+
+	free(allocator);
 }
 
 static const struct wlr_allocator_interface allocator_impl = {
@@ -115,6 +156,9 @@ struct wlr_allocator *wlr_shm_allocator_create(void) {
 	wlr_allocator_init(&allocator->base, &allocator_impl,
 		WLR_BUFFER_CAP_DATA_PTR | WLR_BUFFER_CAP_SHM);
 
+	wl_list_init(&allocator->buffers);
+	buffer_pool_init(&allocator->pool, pool_destroy_entry);
+
 	wlr_log(WLR_DEBUG, "Created shm allocator");
 	return &allocator->base;
 }
@@ -29,49 +29,42 @@ static bool buffer_get_dmabuf(struct wlr_buffer *wlr_buffer, struct wlr_dmabuf_a
 	return true;
 }
 
-static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
-	struct wlr_udmabuf_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+static void buffer_free(struct wlr_udmabuf_buffer *buffer) {
 	wlr_dmabuf_attributes_finish(&buffer->dmabuf);
 	close(buffer->shm.fd);
 	free(buffer);
 }
 
+static void pool_destroy_entry(struct buffer_pool_entry *entry) {
+	struct wlr_udmabuf_buffer *buffer = wl_container_of(entry, buffer, pool_entry);
+	buffer_free(buffer);
+}
+
+static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct wlr_udmabuf_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	wl_list_remove(&buffer->link);
+
+	// Keep the memfd and its DMA-BUF around for the next buffer
+	buffer->pool_entry.size = buffer->size;
+	if (buffer->allocator != NULL &&
+			buffer_pool_put(&buffer->allocator->pool, &buffer->pool_entry)) {
+		return;
+	}
+	buffer_free(buffer);
+}
+
 static const struct wlr_buffer_impl buffer_impl = {
 	.destroy = buffer_destroy,
 	.get_shm = buffer_get_shm,
 	.get_dmabuf = buffer_get_dmabuf,
 };
 
-static struct wlr_buffer *allocator_create_buffer(
-		struct wlr_allocator *wlr_allocator, int width, int height,
-		const struct wlr_drm_format *format) {
-	struct wlr_udmabuf_allocator *allocator = wl_container_of(wlr_allocator, allocator, base);
-
-	const struct wlr_pixel_format_info *info =
-		drm_get_pixel_format_info(format->format);
-	if (info == NULL) {
-		wlr_log(WLR_ERROR, "Unsupported pixel format 0x%"PRIX32, format->format);
-		return NULL;
-	}
-
-	long page_size = sysconf(_SC_PAGE_SIZE);
-	if (page_size == -1) {
-		wlr_log_errno(WLR_ERROR, "Failed to query page size");
-		return NULL;
-	}
-
+static struct wlr_udmabuf_buffer *create_buffer_storage(
+		struct wlr_udmabuf_allocator *allocator, size_t size) {
 	struct wlr_udmabuf_buffer *buffer = calloc(1, sizeof(*buffer));
 	if (buffer == NULL) {
 		return NULL;
 	}
-	wlr_buffer_init(&buffer->base, &buffer_impl, width, height);
-
-	// TODO: consider using a single file for multiple buffers
-	int stride = pixel_format_info_min_stride(info, width); // TODO: align?
-	size_t size = stride * height;
-	if (size % page_size != 0) {
-		size += page_size - (size % page_size);
-	}
 
 	int memfd = memfd_create("wlroots", MFD_CLOEXEC | MFD_ALLOW_SEALING);
 	if (memfd < 0) {
@@ -102,13 +95,54 @@ static struct wlr_buffer *allocator_create_buffer(
 	}
 
 	buffer->size = size;
+	buffer->shm.fd = memfd;
+	buffer->dmabuf.fd[0] = dmabuf_fd;
+	return buffer;
+
+err_memfd:
+	close(memfd);
+err_buffer:
+	free(buffer);
+	return NULL;
+}
+
+static struct wlr_buffer *allocator_create_buffer(
+		struct wlr_allocator *wlr_allocator, int width, int height,
+		const struct wlr_drm_format *format) {
+	struct wlr_udmabuf_allocator *allocator = wl_container_of(wlr_allocator, allocator, base);
+
+	const struct wlr_pixel_format_info *info =
+		drm_get_pixel_format_info(format->format);
+	if (info == NULL) {
+		wlr_log(WLR_ERROR, "Unsupported pixel format 0x%"PRIX32, format->format);
+		return NULL;
+	}
+
+	// TODO: consider using a single file for multiple buffers
+	int stride = pixel_format_info_min_stride(info, width); // TODO: align?
+	// Bucket sizes are page-aligned, as required by udmabuf
+	size_t size = buffer_pool_bucket_size((size_t)stride * height);
+
+	struct wlr_udmabuf_buffer *buffer;
+	struct buffer_pool_entry *entry = buffer_pool_take(&allocator->pool, size);
+	if (entry != NULL) {
+		buffer = wl_container_of(entry, buffer, pool_entry);
+	} else {
+		buffer = create_buffer_storage(allocator, size);
+		if (buffer == NULL) {
+			return NULL;
+		}
+	}
+
+	wlr_buffer_init(&buffer->base, &buffer_impl, width, height);
+
 	buffer->shm = (struct wlr_shm_attributes){
 		.width = width,
 		.height = height,
 		.format = format->format,
 		.offset = 0,
 		.stride = stride,
-		.fd = memfd,
+		.fd = buffer->shm.fd,
 	};
 	buffer->dmabuf = (struct wlr_dmabuf_attributes){
 		.width = width,
@@ -118,20 +152,26 @@ static struct wlr_buffer *allocator_create_buffer(
 		.n_planes = 1,
 		.offset[0] = 0,
 		.stride[0] = stride,
-		.fd[0] = dmabuf_fd,
+		.fd[0] = buffer->dmabuf.fd[0],
 	};
 
-	return &buffer->base;
+	buffer->allocator = allocator;
+	wl_list_insert(&allocator->buffers, &buffer->link);
 
-err_memfd:
-	close(memfd);
-err_buffer:
-	free(buffer);
-	return NULL;
+	return &buffer->base;
 }
 
 static void allocator_destroy(struct wlr_allocator *wlr_allocator) {
 	struct wlr_udmabuf_allocator *allocator = wl_container_of(wlr_allocator, allocator, base);
+
+	struct wlr_udmabuf_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &allocator->buffers, link) {
+		buffer->allocator = NULL;
+		wl_list_remove(&buffer->link);
+		wl_list_init(&buffer->link);
+	}
+	buffer_pool_finish(&allocator->pool);
+
 	close(allocator->fd);
 	free(allocator);
 }
@@ -157,6 +197,8 @@ struct wlr_allocator *wlr_udmabuf_allocator_create(void) {
 		WLR_BUFFER_CAP_SHM | WLR_BUFFER_CAP_DMABUF);
 
 	allocator->fd = fd;
+	wl_list_init(&allocator->buffers);
+	buffer_pool_init(&allocator->pool, pool_destroy_entry);
 
 	return &allocator->base;
 }
@@ -0,0 +1,549 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/log.h>
+#include "render/atlas.h"
+#include "render/pixel_format.h"
+#include "util/trace.h"
+
+#define ATLAS_PAGE_SIZE 1024
+#define ATLAS_MAX_PAGES 4
+// Largest buffer side packed into the atlas
+#define ATLAS_MAX_SIZE 256
+// Border around each buffer, filled with its edge pixels so that bilinear
+// filtering doesn't bleed neighbours in
+#define ATLAS_GUTTER 1
+#define SHELF_ALIGN 8
+
+struct wlr_atlas_shelf {
+	int y, height;
+	int x; // start of the free space
+	size_t entries_len;
+};
+
+struct wlr_atlas_page {
+	struct wlr_buffer base;
+	struct wlr_atlas *atlas;
+	struct wl_list link; // wlr_atlas.pages
+
+	uint32_t format;
+	uint32_t bytes_per_block;
+	size_t stride;
+	void *data;
+	struct wlr_texture *texture;
+
+	struct wl_array shelves; // struct wlr_atlas_shelf, top to bottom
+	struct wl_list entries; // wlr_atlas_entry.link
+	int used_area;
+};
+
+struct wlr_atlas_entry {
+	struct wlr_atlas *atlas;
+	struct wlr_atlas_page *page; // NULL if the atlas has been destroyed
+	struct wl_list link; // wlr_atlas_page.entries
+	size_t shelf;
+	struct wlr_box slot; // including the gutter
+
+	// Attached to the buffer it was packed from until the buffer is destroyed
+	// or its contents change, so that nodes showing it share the entry
+	struct wlr_addon addon; // wlr_buffer.addons, owned by the atlas
+	bool attached;
+	size_t n_refs;
+};
+
+static void entry_detach(struct wlr_atlas_entry *entry) {
+	if (!entry->attached) {
+		return;
+	}
+	wlr_addon_finish(&entry->addon);
+	entry->attached = false;
+}
+
+static void entry_handle_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_atlas_entry *entry = wl_container_of(addon, entry, addon);
+	entry_detach(entry);
+}
+
+static const struct wlr_addon_interface entry_addon_impl = {
+	.name = "wlr_atlas_entry",
+	.destroy = entry_handle_addon_destroy,
+};
+
+static const struct wlr_buffer_impl page_buffer_impl;
+
+static struct wlr_atlas_page *page_from_buffer(struct wlr_buffer *wlr_buffer) {
+	assert(wlr_buffer->impl == &page_buffer_impl);
+	struct wlr_atlas_page *page = wl_container_of(wlr_buffer, page, base);
+	return page;
+}
+
+static void page_buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct wlr_atlas_page *page = page_from_buffer(wlr_buffer);
+	free(page->data);
+	free(page);
+}
+
+static bool page_buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
+		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
+	struct wlr_atlas_page *page = page_from_buffer(wlr_buffer);
+	*data = page->data;
+	*format = page->format;
+	*stride = page->stride;
+	return true;
+}
+
+static void page_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
+	// This space is intentionally left blank
+}
+
+static const struct wlr_buffer_impl page_buffer_impl = {
+	.destroy = page_buffer_destroy,
+	.begin_data_ptr_access = page_buffer_begin_data_ptr_access,
+	.end_data_ptr_access = page_buffer_end_data_ptr_access,
+};
+
+static struct wlr_atlas_page *page_create(struct wlr_atlas *atlas,
+		uint32_t format, uint32_t bytes_per_block) {
+	struct wlr_atlas_page *page = calloc(1, sizeof(*page));
+	if (page == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	wlr_buffer_init(&page->base, &page_buffer_impl, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+
+	page->atlas = atlas;
+	page->format = format;
+	page->bytes_per_block = bytes_per_block;
+	page->stride = (size_t)ATLAS_PAGE_SIZE * bytes_per_block;
+	page->data = calloc(ATLAS_PAGE_SIZE, page->stride);
+	wl_array_init(&page->shelves);
+	wl_list_init(&page->entries);
+	if (page->data == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		wlr_buffer_drop(&page->base);
+		return NULL;
+	}
+
+	page->texture = wlr_texture_from_buffer(atlas->renderer, &page->base);
+	if (page->texture == NULL) {
+		wlr_log(WLR_DEBUG, "Failed to create atlas page texture");
+		wlr_buffer_drop(&page->base);
+		return NULL;
+	}
+
+	wl_list_insert(&atlas->pages, &page->link);
+	atlas->pages_len++;
+	TRACE_COUNTER("atlas_pages", (int64_t)atlas->pages_len);
+	return page;
+}
+
+static void page_destroy(struct wlr_atlas_page *page) {
+	// The buffers of these entries can be packed again into another entry
+	struct wlr_atlas_entry *entry;
+	wl_list_for_each(entry, &page->entries, link) {
+		entry->page = NULL;
+		entry_detach(entry);
+	}
+
+	wl_list_remove(&page->link);
+	page->atlas->pages_len--;
+	TRACE_COUNTER("atlas_pages", (int64_t)page->atlas->pages_len);
+
+	wlr_texture_destroy(page->texture);
+	wl_array_release(&page->shelves);
+	wlr_buffer_drop(&page->base);
+}
+
+/**
+ * Find a slot for a width × height rectangle with a shelf packer. Returns the
+ * index of the shelf, or -1 if the page is full.
+ */
+static ssize_t page_alloc(struct wlr_atlas_page *page, int width, int height,
+		struct wlr_box *slot) {
+	struct wlr_atlas_shelf *shelves = page->shelves.data;
+	size_t shelves_len = page->shelves.size / sizeof(*shelves);
+
+	// Prefer the lowest shelf which doesn't waste too much of its height,
+	// any empty shelf being reusable as a whole
+	ssize_t best = -1;
+	for (size_t i = 0; i < shelves_len; i++) {
+		const struct wlr_atlas_shelf *shelf = &shelves[i];
+		if (shelf->height < height || ATLAS_PAGE_SIZE - shelf->x < width) {
+			continue;
+		}
+		if (shelf->entries_len > 0 && shelf->height > height + height / 2 + SHELF_ALIGN) {
+			continue;
+		}
+		if (best < 0 || shelf->height < shelves[best].height) {
+			best = i;
+		}
+	}
+
+	if (best < 0) {
+		int end = 0;
+		if (shelves_len > 0) {
+			end = shelves[shelves_len - 1].y + shelves[shelves_len - 1].height;
+		}
+		int shelf_height = (height + SHELF_ALIGN - 1) & ~(SHELF_ALIGN - 1);
+		if (ATLAS_PAGE_SIZE - end < shelf_height) {
+			return -1;
+		}
+
+		struct wlr_atlas_shelf *shelf = wl_array_add(&page->shelves, sizeof(*shelf));
+		if (shelf == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			return -1;
+		}
+		*shelf = (struct wlr_atlas_shelf){
+			.y = end,
+			.height = shelf_height,
+		};
+		shelves = page->shelves.data;
+		best = shelves_len;
+	}
+
+	struct wlr_atlas_shelf *shelf = &shelves[best];
+	*slot = (struct wlr_box){
+		.x = shelf->x,
+		.y = shelf->y,
+		.width = width,
+		.height = height,
+	};
+	shelf->x += width;
+	shelf->entries_len++;
+	page->used_area += width * height;
+	return best;
+}
+
+static void page_free(struct wlr_atlas_page *page, size_t shelf_index,
+		const struct wlr_box *slot) {
+	struct wlr_atlas_shelf *shelves = page->shelves.data;
+	struct wlr_atlas_shelf *shelf = &shelves[shelf_index];
+	shelf->entries_len--;
+	if (shelf->entries_len == 0) {
+		shelf->x = 0;
+	} else if (slot->x + slot->width == shelf->x) {
+		shelf->x = slot->x;
+	}
+
+	// Give the space of empty shelves at the bottom back to the page
+	size_t shelves_len = page->shelves.size / sizeof(*shelves);
+	while (shelves_len > 0 && shelves[shelves_len - 1].entries_len == 0) {
+		shelves_len--;
+	}
+	page->shelves.size = shelves_len * sizeof(*shelves);
+
+	page->used_area -= slot->width * slot->height;
+}
+
+static bool page_upload(struct wlr_atlas_page *page, const pixman_region32_t *damage) {
+	if (!wlr_texture_update_from_buffer(page->texture, &page->base, damage)) {
+		wlr_log(WLR_DEBUG, "Failed to upload atlas page");
+		return false;
+	}
+	return true;
+}
+
+static int compare_entry_height(const void *_a, const void *_b) {
+	const struct wlr_atlas_entry *a = *(struct wlr_atlas_entry *const *)_a;
+	const struct wlr_atlas_entry *b = *(struct wlr_atlas_entry *const *)_b;
+	return b->slot.height - a->slot.height;
+}
+
+/**
+ * Move the entries of the emptiest page of a format into a fresh page,
+ * getting rid of the holes left by destroyed entries.
+ */
+static struct wlr_atlas_page *atlas_compact(struct wlr_atlas *atlas, uint32_t format) {
+	struct wlr_atlas_page *old = NULL, *page;
+	wl_list_for_each(page, &atlas->pages, link) {
+		if (page->format == format && (old == NULL || page->used_area < old->used_area)) {
+			old = page;
+		}
+	}
+	// Not worth it if the page wouldn't end up half empty
+	if (old == NULL || old->used_area > ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE / 2) {
+		return NULL;
+	}
+
+	size_t entries_len = wl_list_length(&old->entries);
+	struct wlr_atlas_entry **entries = calloc(entries_len, sizeof(*entries));
+	struct wlr_box *slots = calloc(entries_len, sizeof(*slots));
+	ssize_t *shelves = calloc(entries_len, sizeof(*shelves));
+	struct wlr_atlas_page *new = NULL;
+	if (entries == NULL || slots == NULL || shelves == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		goto out;
+	}
+
+	new = page_create(atlas, format, old->bytes_per_block);
+	if (new == NULL) {
+		goto out;
+	}
+
+	// Tallest first packs shelves the tightest
+	size_t i = 0;
+	struct wlr_atlas_entry *entry;
+	wl_list_for_each(entry, &old->entries, link) {
+		entries[i++] = entry;
+	}
+	qsort(entries, entries_len, sizeof(*entries), compare_entry_height);
+
+	for (i = 0; i < entries_len; i++) {
+		shelves[i] = page_alloc(new, entries[i]->slot.width, entries[i]->slot.height,
+			&slots[i]);
+		if (shelves[i] < 0) {
+			page_destroy(new);
+			new = NULL;
+			goto out;
+		}
+	}
+
+	size_t row_len = 0;
+	for (i = 0; i < entries_len; i++) {
+		entry = entries[i];
+		row_len = (size_t)entry->slot.width * old->bytes_per_block;
+		for (int y = 0; y < entry->slot.height; y++) {
+			memcpy((uint8_t *)new->data + (size_t)(slots[i].y + y) * new->stride +
+				(size_t)slots[i].x * new->bytes_per_block,
+				(const uint8_t *)old->data + (size_t)(entry->slot.y + y) * old->stride +
+				(size_t)entry->slot.x * old->bytes_per_block, row_len);
+		}
+	}
+
+	// Entries only hold a copy of their buffer, so they must not be moved
+	// out of the old page before the new one is uploaded
+	pixman_region32_t damage;
+	pixman_region32_init_rect(&damage, 0, 0, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+	bool ok = page_upload(new, &damage);
+	pixman_region32_fini(&damage);
+	if (!ok) {
+		page_destroy(new);
+		new = NULL;
+		goto out;
+	}
+
+	for (i = 0; i < entries_len; i++) {
+		entry = entries[i];
+		wl_list_remove(&entry->link);
+		wl_list_insert(&new->entries, &entry->link);
+		entry->page = new;
+		entry->shelf = shelves[i];
+		entry->slot = slots[i];
+	}
+
+	TRACE_INSTANT("atlas_compact");
+	page_destroy(old);
+
+out:
+	free(entries);
+	free(slots);
+	free(shelves);
+	return new;
+}
+
+static void copy_with_gutter(struct wlr_atlas_page *page, const struct wlr_box *slot,
+		const void *data, size_t stride, int width, int height) {
+	size_t bpp = page->bytes_per_block;
+	size_t row_len = (size_t)width * bpp;
+
+	for (int y = 0; y < slot->height; y++) {
+		int src_y = y - ATLAS_GUTTER;
+		if (src_y < 0) {
+			src_y = 0;
+		} else if (src_y >= height) {
+			src_y = height - 1;
+		}
+
+		const uint8_t *src = (const uint8_t *)data + (size_t)src_y * stride;
+		uint8_t *dst = (uint8_t *)page->data + (size_t)(slot->y + y) * page->stride +
+			(size_t)slot->x * bpp;
+		for (int x = 0; x < ATLAS_GUTTER; x++) {
+			memcpy(dst + x * bpp, src, bpp);
+			memcpy(dst + (ATLAS_GUTTER + width + x) * bpp, src + row_len - bpp, bpp);
+		}
+		memcpy(dst + ATLAS_GUTTER * bpp, src, row_len);
+	}
+}
+
+struct wlr_atlas_entry *atlas_add(struct wlr_atlas *atlas, struct wlr_buffer *buffer) {
+	assert(!atlas->destroyed);
+
+	struct wlr_addon *addon = wlr_addon_find(&buffer->addons, atlas, &entry_addon_impl);
+	if (addon != NULL) {
+		struct wlr_atlas_entry *entry = wl_container_of(addon, entry, addon);
+		entry->n_refs++;
+		return entry;
+	}
+
+	if (buffer->width <= 0 || buffer->height <= 0 ||
+			buffer->width > ATLAS_MAX_SIZE || buffer->height > ATLAS_MAX_SIZE) {
+		return NULL;
+	}
+
+	void *data;
+	uint32_t format;
+	size_t stride;
+	if (!wlr_buffer_begin_data_ptr_access(buffer,
+			WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
+		return NULL;
+	}
+
+	const struct wlr_pixel_format_info *info = drm_get_pixel_format_info(format);
+	if (info == NULL || pixel_format_info_pixels_per_block(info) != 1) {
+		wlr_buffer_end_data_ptr_access(buffer);
+		return NULL;
+	}
+
+	struct wlr_atlas_entry *entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		wlr_buffer_end_data_ptr_access(buffer);
+		return NULL;
+	}
+
+	int slot_width = buffer->width + 2 * ATLAS_GUTTER;
+	int slot_height = buffer->height + 2 * ATLAS_GUTTER;
+
+	struct wlr_atlas_page *page, *found = NULL;
+	ssize_t shelf = -1;
+	wl_list_for_each(page, &atlas->pages, link) {
+		if (page->format != format) {
+			continue;
+		}
+		shelf = page_alloc(page, slot_width, slot_height, &entry->slot);
+		if (shelf >= 0) {
+			found = page;
+			break;
+		}
+	}
+	if (found == NULL) {
+		if (atlas->pages_len < ATLAS_MAX_PAGES) {
+			found = page_create(atlas, format, info->bytes_per_block);
+		} else {
+			found = atlas_compact(atlas, format);
+		}
+		if (found != NULL) {
+			shelf = page_alloc(found, slot_width, slot_height, &entry->slot);
+		}
+	}
+	if (shelf < 0) {
+		if (found != NULL && wl_list_empty(&found->entries)) {
+			page_destroy(found);
+		}
+		free(entry);
+		wlr_buffer_end_data_ptr_access(buffer);
+		return NULL;
+	}
+
+	copy_with_gutter(found, &entry->slot, data, stride, buffer->width, buffer->height);
+	wlr_buffer_end_data_ptr_access(buffer);
+
+	pixman_region32_t damage;
+	pixman_region32_init_rect(&damage, entry->slot.x, entry->slot.y,
+		entry->slot.width, entry->slot.height);
+	bool ok = page_upload(found, &damage);
+	pixman_region32_fini(&damage);
+	if (!ok) {
+		page_free(found, shelf, &entry->slot);
+		if (wl_list_empty(&found->entries)) {
+			page_destroy(found);
+		}
+		free(entry);
+		return NULL;
+	}
+
+	entry->atlas = atlas;
+	entry->page = found;
+	entry->shelf = shelf;
+	wl_list_insert(&found->entries, &entry->link);
+	wlr_addon_init(&entry->addon, &buffer->addons, atlas, &entry_addon_impl);
+	entry->attached = true;
+	entry->n_refs = 1;
+	atlas->entries_len++;
+	return entry;
+}
+
+void atlas_invalidate_buffer(struct wlr_atlas *atlas, struct wlr_buffer *buffer) {
+	struct wlr_addon *addon = wlr_addon_find(&buffer->addons, atlas, &entry_addon_impl);
+	if (addon != NULL) {
+		struct wlr_atlas_entry *entry = wl_container_of(addon, entry, addon);
+		entry_detach(entry);
+	}
+}
+
+void atlas_entry_unref(struct wlr_atlas_entry *entry) {
+	if (entry == NULL) {
+		return;
+	}
+
+	assert(entry->n_refs > 0);
+	entry->n_refs--;
+	if (entry->n_refs > 0) {
+		return;
+	}
+
+	entry_detach(entry);
+
+	struct wlr_atlas *atlas = entry->atlas;
+	struct wlr_atlas_page *page = entry->page;
+	if (page != NULL) {
+		page_free(page, entry->shelf, &entry->slot);
+		wl_list_remove(&entry->link);
+		if (wl_list_empty(&page->entries)) {
+			page_destroy(page);
+		}
+	}
+	free(entry);
+
+	atlas->entries_len--;
+	if (atlas->destroyed && atlas->entries_len == 0) {
+		free(atlas);
+	}
+}
+
+struct wlr_texture *atlas_entry_get_texture(struct wlr_atlas_entry *entry,
+		struct wlr_box *box) {
+	if (entry->page == NULL) {
+		return NULL;
+	}
+
+	*box = (struct wlr_box){
+		.x = entry->slot.x + ATLAS_GUTTER,
+		.y = entry->slot.y + ATLAS_GUTTER,
+		.width = entry->slot.width - 2 * ATLAS_GUTTER,
+		.height = entry->slot.height - 2 * ATLAS_GUTTER,
+	};
+	return entry->page->texture;
+}
+
+struct wlr_atlas *atlas_create(struct wlr_renderer *renderer) {
+	struct wlr_atlas *atlas = calloc(1, sizeof(*atlas));
+	if (atlas == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	atlas->renderer = renderer;
+	wl_list_init(&atlas->pages);
+	return atlas;
+}
+
+void atlas_destroy(struct wlr_atlas *atlas) {
+	if (atlas == NULL) {
+		return;
+	}
+
+	struct wlr_atlas_page *page, *tmp;
+	wl_list_for_each_safe(page, tmp, &atlas->pages, link) {
+		page_destroy(page);
+	}
+
+	atlas->destroyed = true;
+	if (atlas->entries_len == 0) {
+		free(atlas);
+	}
+}
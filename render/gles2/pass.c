@@ -9,8 +9,7 @@
 #include "render/egl.h"
 #include "render/gles2.h"
 #include "types/wlr_matrix.h"
-
-#define MAX_QUADS 86 // 4kb
+#include "util/trace.h"
 
 static const struct wlr_render_pass_impl render_pass_impl;
 
@@ -20,12 +19,190 @@ static struct wlr_gles2_render_pass *get_render_pass(struct wlr_render_pass *wlr
 	return pass;
 }
 
+struct wlr_gles2_vertex {
+	GLfloat x, y; // buffer-local coordinates
+	GLfloat u, v; // texture coordinates
+};
+
+static void setup_blending(enum wlr_render_blend_mode mode) {
+	switch (mode) {
+	case WLR_RENDER_BLEND_MODE_PREMULTIPLIED:
+		glEnable(GL_BLEND);
+		break;
+	case WLR_RENDER_BLEND_MODE_NONE:
+		glDisable(GL_BLEND);
+		break;
+	}
+}
+
+void gles2_render_pass_flush_batch(struct wlr_gles2_render_pass *pass) {
+	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
+	const struct wlr_gles2_batch_state *state = &pass->batch.state;
+	if (pass->batch.verts.size == 0) {
+		return;
+	}
+
+	const struct wlr_gles2_vertex *verts = pass->batch.verts.data;
+	size_t verts_len = pass->batch.verts.size / sizeof(*verts);
+
+	push_gles2_debug(renderer);
+	setup_blending(state->blend_mode);
+
+	struct wlr_gles2_texture *texture = state->texture;
+	GLint pos_attrib, texcoord_attrib = -1;
+	if (texture != NULL) {
+		const struct wlr_gles2_tex_shader *shader = state->shader;
+		glUseProgram(shader->program);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(texture->target, texture->tex);
+
+		switch (state->filter_mode) {
+		case WLR_SCALE_FILTER_BILINEAR:
+			glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			break;
+		case WLR_SCALE_FILTER_NEAREST:
+			glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			break;
+		}
+
+		glUniform1i(shader->tex, 0);
+		glUniform1f(shader->alpha, state->alpha);
+		glUniformMatrix3fv(shader->proj, 1, GL_FALSE, pass->projection_matrix);
+		pos_attrib = shader->pos_attrib;
+		texcoord_attrib = shader->texcoord_attrib;
+	} else {
+		const struct wlr_render_color *color = &state->color;
+		glUseProgram(renderer->shaders.quad.program);
+		glUniform4f(renderer->shaders.quad.color, color->r, color->g, color->b, color->a);
+		glUniformMatrix3fv(renderer->shaders.quad.proj, 1, GL_FALSE,
+			pass->projection_matrix);
+		pos_attrib = renderer->shaders.quad.pos_attrib;
+	}
+
+	glEnableVertexAttribArray(pos_attrib);
+	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(*verts), &verts->x);
+	if (texcoord_attrib >= 0) {
+		glEnableVertexAttribArray(texcoord_attrib);
+		glVertexAttribPointer(texcoord_attrib, 2, GL_FLOAT, GL_FALSE,
+			sizeof(*verts), &verts->u);
+	}
+
+	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)verts_len);
+
+	glDisableVertexAttribArray(pos_attrib);
+	if (texcoord_attrib >= 0) {
+		glDisableVertexAttribArray(texcoord_attrib);
+	}
+	if (texture != NULL) {
+		glBindTexture(texture->target, 0);
+	}
+
+	pop_gles2_debug(renderer);
+
+	pass->draws++;
+	pass->quads += verts_len / 6;
+	pass->batch.verts.size = 0;
+	if (renderer->batch_pass == pass) {
+		renderer->batch_pass = NULL;
+	}
+}
+
+static bool batch_state_equal(const struct wlr_gles2_batch_state *a,
+		const struct wlr_gles2_batch_state *b) {
+	if (a->texture != b->texture || a->blend_mode != b->blend_mode) {
+		return false;
+	}
+	if (a->texture != NULL) {
+		return a->shader == b->shader && a->filter_mode == b->filter_mode &&
+			a->alpha == b->alpha;
+	}
+	return a->color.r == b->color.r && a->color.g == b->color.g &&
+		a->color.b == b->color.b && a->color.a == b->color.a;
+}
+
+/**
+ * Add the quads covering box and clip to the batch. tex_matrix maps the unit
+ * square of the box to texture coordinates, and is NULL for rects.
+ */
+static void batch_quads(struct wlr_gles2_render_pass *pass,
+		const struct wlr_gles2_batch_state *state, const struct wlr_box *box,
+		const pixman_region32_t *clip, const float *tex_matrix) {
+	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
+
+	pixman_region32_t region;
+	pixman_region32_init_rect(&region, box->x, box->y, box->width, box->height);
+
+	if (clip) {
+		pixman_region32_intersect(&region, &region, clip);
+	}
+
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(&region, &rects_len);
+	if (rects_len == 0) {
+		pixman_region32_fini(&region);
+		return;
+	}
+
+	if (pass->batch.verts.size > 0 && !batch_state_equal(&pass->batch.state, state)) {
+		gles2_render_pass_flush_batch(pass);
+	}
+
+	struct wlr_gles2_vertex *verts = wl_array_add(&pass->batch.verts,
+		(size_t)rects_len * 6 * sizeof(*verts));
+	if (verts == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		pixman_region32_fini(&region);
+		return;
+	}
+
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *rect = &rects[i];
+		const int corners[6][2] = {
+			{ rect->x1, rect->y1 },
+			{ rect->x2, rect->y1 },
+			{ rect->x1, rect->y2 },
+			{ rect->x2, rect->y1 },
+			{ rect->x2, rect->y2 },
+			{ rect->x1, rect->y2 },
+		};
+
+		for (size_t j = 0; j < 6; j++) {
+			struct wlr_gles2_vertex *vert = &verts[i * 6 + j];
+			vert->x = corners[j][0];
+			vert->y = corners[j][1];
+			vert->u = vert->v = 0;
+			if (tex_matrix != NULL) {
+				GLfloat x = (GLfloat)(corners[j][0] - box->x) / box->width;
+				GLfloat y = (GLfloat)(corners[j][1] - box->y) / box->height;
+				vert->u = tex_matrix[0] * x + tex_matrix[1] * y + tex_matrix[2];
+				vert->v = tex_matrix[3] * x + tex_matrix[4] * y + tex_matrix[5];
+			}
+		}
+	}
+
+	pixman_region32_fini(&region);
+
+	pass->batch.state = *state;
+	renderer->batch_pass = pass;
+	if (!renderer->batching) {
+		gles2_render_pass_flush_batch(pass);
+	}
+}
+
 static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 	struct wlr_gles2_render_pass *pass = get_render_pass(wlr_pass);
 	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
 	struct wlr_gles2_render_timer *timer = pass->timer;
 	bool ok = false;
 
+	gles2_render_pass_flush_batch(pass);
+	wl_array_release(&pass->batch.verts);
+	TRACE_COUNTER("gles2_draws", pass->draws);
+	TRACE_COUNTER("gles2_quads", pass->quads);
+
 	push_gles2_debug(renderer);
 
 	if (timer) {
@@ -76,67 +253,8 @@ out:
 	return ok;
 }
 
-static void render(const struct wlr_box *box, const pixman_region32_t *clip, GLint attrib) {
-	pixman_region32_t region;
-	pixman_region32_init_rect(&region, box->x, box->y, box->width, box->height);
-
-	if (clip) {
-		pixman_region32_intersect(&region, &region, clip);
-	}
-
-	int rects_len;
-	const pixman_box32_t *rects = pixman_region32_rectangles(&region, &rects_len);
-	if (rects_len == 0) {
-		pixman_region32_fini(&region);
-		return;
-	}
-
-	glEnableVertexAttribArray(attrib);
-
-	for (int i = 0; i < rects_len;) {
-		int batch = rects_len - i < MAX_QUADS ? rects_len - i : MAX_QUADS;
-		int batch_end = batch + i;
-
-		size_t vert_index = 0;
-		GLfloat verts[MAX_QUADS * 6 * 2];
-		for (; i < batch_end; i++) {
-			const pixman_box32_t *rect = &rects[i];
-
-			verts[vert_index++] = (GLfloat)(rect->x1 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y1 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x2 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y1 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x1 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y2 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x2 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y1 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x2 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y2 - box->y) / box->height;
-			verts[vert_index++] = (GLfloat)(rect->x1 - box->x) / box->width;
-			verts[vert_index++] = (GLfloat)(rect->y2 - box->y) / box->height;
-		}
-
-		glVertexAttribPointer(attrib, 2, GL_FLOAT, GL_FALSE, 0, verts);
-		glDrawArrays(GL_TRIANGLES, 0, batch * 6);
-	}
-
-	glDisableVertexAttribArray(attrib);
-
-	pixman_region32_fini(&region);
-}
-
-static void set_proj_matrix(GLint loc, float proj[9], const struct wlr_box *box) {
-	float gl_matrix[9];
-	wlr_matrix_identity(gl_matrix);
-	wlr_matrix_translate(gl_matrix, box->x, box->y);
-	wlr_matrix_scale(gl_matrix, box->width, box->height);
-	wlr_matrix_multiply(gl_matrix, proj, gl_matrix);
-	glUniformMatrix3fv(loc, 1, GL_FALSE, gl_matrix);
-}
-
-static void set_tex_matrix(GLint loc, enum wl_output_transform trans,
-		const struct wlr_fbox *box) {
-	float tex_matrix[9];
+static void get_tex_matrix(float tex_matrix[static 9],
+		enum wl_output_transform trans, const struct wlr_fbox *box) {
 	wlr_matrix_identity(tex_matrix);
 	wlr_matrix_translate(tex_matrix, box->x, box->y);
 	wlr_matrix_scale(tex_matrix, box->width, box->height);
@@ -150,19 +268,6 @@ static void set_tex_matrix(GLint loc, enum wl_output_transform trans,
 		wlr_matrix_transform(tex_matrix, trans);
 	}
 	wlr_matrix_translate(tex_matrix, -.5, -.5);
-
-	glUniformMatrix3fv(loc, 1, GL_FALSE, tex_matrix);
-}
-
-static void setup_blending(enum wlr_render_blend_mode mode) {
-	switch (mode) {
-	case WLR_RENDER_BLEND_MODE_PREMULTIPLIED:
-		glEnable(GL_BLEND);
-		break;
-	case WLR_RENDER_BLEND_MODE_NONE:
-		glDisable(GL_BLEND);
-		break;
-	}
 }
 
 static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
@@ -171,6 +276,11 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
 	struct wlr_gles2_texture *texture = gles2_get_texture(options->texture);
 
+	// Only happens if the texture was updated after the pass began
+	if (texture->pending_uploads > 0) {
+		gles2_upload_ring_flush(renderer);
+	}
+
 	struct wlr_gles2_tex_shader *shader = NULL;
 
 	switch (texture->target) {
@@ -224,56 +334,36 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		}
 	}
 
-	setup_blending(!texture->has_alpha && alpha == 1.0 ?
-		WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
-
-	glUseProgram(shader->program);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(texture->target, texture->tex);
-
-	switch (options->filter_mode) {
-	case WLR_SCALE_FILTER_BILINEAR:
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		break;
-	case WLR_SCALE_FILTER_NEAREST:
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		break;
-	}
-
-	glUniform1i(shader->tex, 0);
-	glUniform1f(shader->alpha, alpha);
-	set_proj_matrix(shader->proj, pass->projection_matrix, &dst_box);
-	set_tex_matrix(shader->tex_proj, options->transform, &src_fbox);
-
-	render(&dst_box, options->clip, shader->pos_attrib);
-
-	glBindTexture(texture->target, 0);
 	pop_gles2_debug(renderer);
+
+	float tex_matrix[9];
+	get_tex_matrix(tex_matrix, options->transform, &src_fbox);
+
+	struct wlr_gles2_batch_state state = {
+		.texture = texture,
+		.shader = shader,
+		.blend_mode = !texture->has_alpha && alpha == 1.0 ?
+			WLR_RENDER_BLEND_MODE_NONE : options->blend_mode,
+		.filter_mode = options->filter_mode,
+		.alpha = alpha,
+	};
+	batch_quads(pass, &state, &dst_box, options->clip, tex_matrix);
 }
 
 static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_rect_options *options) {
 	struct wlr_gles2_render_pass *pass = get_render_pass(wlr_pass);
-	struct wlr_gles2_renderer *renderer = pass->buffer->renderer;
 
 	const struct wlr_render_color *color = &options->color;
 	struct wlr_box box;
 	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &box);
 
-	push_gles2_debug(renderer);
-	setup_blending(color->a == 1.0 ? WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
-
-	glUseProgram(renderer->shaders.quad.program);
-
-	set_proj_matrix(renderer->shaders.quad.proj, pass->projection_matrix, &box);
-	glUniform4f(renderer->shaders.quad.color, color->r, color->g, color->b, color->a);
-
-	render(&box, options->clip, renderer->shaders.quad.pos_attrib);
-
-	pop_gles2_debug(renderer);
+	struct wlr_gles2_batch_state state = {
+		.blend_mode = color->a == 1.0 ?
+			WLR_RENDER_BLEND_MODE_NONE : options->blend_mode,
+		.color = *color,
+	};
+	batch_quads(pass, &state, &box, options->clip, NULL);
 }
 
 static const struct wlr_render_pass_impl render_pass_impl = {
@@ -333,6 +423,11 @@ struct wlr_gles2_render_pass *begin_gles2_buffer_pass(struct wlr_gles2_buffer *b
 	matrix_projection(pass->projection_matrix, wlr_buffer->width, wlr_buffer->height,
 		WL_OUTPUT_TRANSFORM_FLIPPED_180);
 
+	// Draw what another pass still has batched while its framebuffer is bound
+	if (renderer->batch_pass != NULL) {
+		gles2_render_pass_flush_batch(renderer->batch_pass);
+	}
+
 	push_gles2_debug(renderer);
 	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
@@ -20,6 +20,7 @@
 #include "render/gles2.h"
 #include "render/pixel_format.h"
 #include "types/wlr_matrix.h"
+#include "util/env.h"
 #include "util/time.h"
 
 #include "common_vert_src.h"
@@ -217,6 +218,7 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 	}
 
 	push_gles2_debug(renderer);
+	gles2_upload_ring_finish(renderer);
 	glDeleteProgram(renderer->shaders.quad.program);
 	glDeleteProgram(renderer->shaders.tex_rgba.program);
 	glDeleteProgram(renderer->shaders.tex_rgbx.program);
@@ -249,6 +251,9 @@ static struct wlr_render_pass *gles2_begin_buffer_pass(struct wlr_renderer *wlr_
 		return NULL;
 	}
 
+	// Upload the texture updates staged since the last pass in one go
+	gles2_upload_ring_flush(renderer);
+
 	struct wlr_gles2_render_timer *timer = NULL;
 	if (options->timer) {
 		timer = gles2_get_render_timer(options->timer);
@@ -328,7 +333,7 @@ static int gles2_get_render_time(struct wlr_render_timer *wlr_timer) {
 	renderer->procs.glGetQueryObjectivEXT(timer->id,
 		GL_QUERY_RESULT_AVAILABLE_EXT, &available);
 	if (!available) {
-		wlr_log(WLR_ERROR, "timer was read too early, gpu isn't done!");
+		wlr_log(WLR_DEBUG, "timer was read too early, gpu isn't done!");
 		wlr_egl_restore_context(&prev_ctx);
 		return -1;
 	}
@@ -620,6 +625,32 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 		}
 	}
 
+	int gles_major = 0;
+	const char *version_str = (const char *)glGetString(GL_VERSION);
+	if (version_str == NULL || sscanf(version_str, "OpenGL ES %d.", &gles_major) != 1) {
+		gles_major = 2;
+	}
+	if (env_parse_bool("WLR_GLES2_NO_PBO_UPLOADS")) {
+		wlr_log(WLR_INFO, "Streaming texture uploads disabled");
+	} else if (gles_major >= 3) {
+		load_gl_proc(&renderer->procs.glMapBufferRange, "glMapBufferRange");
+		load_gl_proc(&renderer->procs.glUnmapBuffer, "glUnmapBuffer");
+		load_gl_proc(&renderer->procs.glFenceSync, "glFenceSync");
+		load_gl_proc(&renderer->procs.glClientWaitSync, "glClientWaitSync");
+		load_gl_proc(&renderer->procs.glDeleteSync, "glDeleteSync");
+	} else if (check_gl_ext(exts_str, "GL_NV_pixel_buffer_object") &&
+			check_gl_ext(exts_str, "GL_EXT_map_buffer_range") &&
+			check_gl_ext(exts_str, "GL_OES_mapbuffer") &&
+			check_gl_ext(exts_str, "GL_APPLE_sync")) {
+		load_gl_proc(&renderer->procs.glMapBufferRange, "glMapBufferRangeEXT");
+		load_gl_proc(&renderer->procs.glUnmapBuffer, "glUnmapBufferOES");
+		load_gl_proc(&renderer->procs.glFenceSync, "glFenceSyncAPPLE");
+		load_gl_proc(&renderer->procs.glClientWaitSync, "glClientWaitSyncAPPLE");
+		load_gl_proc(&renderer->procs.glDeleteSync, "glDeleteSyncAPPLE");
+	}
+
+	renderer->batching = !env_parse_bool("WLR_GLES2_NO_BATCHING");
+
 	if (renderer->exts.KHR_debug) {
 		glEnable(GL_DEBUG_OUTPUT_KHR);
 		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
@@ -650,10 +681,10 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 		goto error;
 	}
 	renderer->shaders.tex_rgba.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgba.tex_proj = glGetUniformLocation(prog, "tex_proj");
 	renderer->shaders.tex_rgba.tex = glGetUniformLocation(prog, "tex");
 	renderer->shaders.tex_rgba.alpha = glGetUniformLocation(prog, "alpha");
 	renderer->shaders.tex_rgba.pos_attrib = glGetAttribLocation(prog, "pos");
+	renderer->shaders.tex_rgba.texcoord_attrib = glGetAttribLocation(prog, "texcoord");
 
 	renderer->shaders.tex_rgbx.program = prog =
 		link_program(renderer, common_vert_src, tex_rgbx_frag_src);
@@ -661,10 +692,10 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 		goto error;
 	}
 	renderer->shaders.tex_rgbx.proj = glGetUniformLocation(prog, "proj");
-	renderer->shaders.tex_rgbx.tex_proj = glGetUniformLocation(prog, "tex_proj");
 	renderer->shaders.tex_rgbx.tex = glGetUniformLocation(prog, "tex");
 	renderer->shaders.tex_rgbx.alpha = glGetUniformLocation(prog, "alpha");
 	renderer->shaders.tex_rgbx.pos_attrib = glGetAttribLocation(prog, "pos");
+	renderer->shaders.tex_rgbx.texcoord_attrib = glGetAttribLocation(prog, "texcoord");
 
 	if (renderer->exts.OES_egl_image_external) {
 		renderer->shaders.tex_ext.program = prog =
@@ -673,10 +704,10 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 			goto error;
 		}
 		renderer->shaders.tex_ext.proj = glGetUniformLocation(prog, "proj");
-		renderer->shaders.tex_ext.tex_proj = glGetUniformLocation(prog, "tex_proj");
 		renderer->shaders.tex_ext.tex = glGetUniformLocation(prog, "tex");
 		renderer->shaders.tex_ext.alpha = glGetUniformLocation(prog, "alpha");
 		renderer->shaders.tex_ext.pos_attrib = glGetAttribLocation(prog, "pos");
+		renderer->shaders.tex_ext.texcoord_attrib = glGetAttribLocation(prog, "texcoord");
 	}
 
 	pop_gles2_debug(renderer);
@@ -28,6 +28,22 @@ struct wlr_gles2_texture *gles2_get_texture(
 	return texture;
 }
 
+/**
+ * Draw the quads batched by a render pass sampling the texture, before its
+ * contents change or it goes away.
+ */
+static void flush_batch_sampling(struct wlr_gles2_texture *texture) {
+	struct wlr_gles2_render_pass *pass = texture->renderer->batch_pass;
+	if (pass == NULL || pass->batch.state.texture != texture) {
+		return;
+	}
+
+	struct wlr_egl_context prev_ctx;
+	wlr_egl_make_current(texture->renderer->egl, &prev_ctx);
+	gles2_render_pass_flush_batch(pass);
+	wlr_egl_restore_context(&prev_ctx);
+}
+
 static bool gles2_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
 	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
@@ -67,9 +83,20 @@ static bool gles2_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 		return false;
 	}
 
+	flush_batch_sampling(texture);
+
 	struct wlr_egl_context prev_ctx;
 	wlr_egl_make_current(texture->renderer->egl, &prev_ctx);
 
+	if (gles2_upload_ring_stage(texture->renderer, texture, data, stride, damage)) {
+		wlr_egl_restore_context(&prev_ctx);
+		wlr_buffer_end_data_ptr_access(buffer);
+		return true;
+	}
+
+	// Updates already staged for this texture must land first
+	gles2_upload_ring_flush(texture->renderer);
+
 	push_gles2_debug(texture->renderer);
 
 	glBindTexture(GL_TEXTURE_2D, texture->tex);
@@ -106,7 +133,11 @@ static bool gles2_texture_update_from_buffer(struct wlr_texture *wlr_texture,
 }
 
 void gles2_texture_destroy(struct wlr_gles2_texture *texture) {
+	flush_batch_sampling(texture);
 	wl_list_remove(&texture->link);
+	if (texture->pending_uploads > 0) {
+		gles2_upload_ring_drop_texture(texture->renderer, texture);
+	}
 	if (texture->buffer != NULL) {
 		wlr_buffer_unlock(texture->buffer->buffer);
 	} else {
@@ -198,6 +229,10 @@ static bool gles2_texture_read_pixels(struct wlr_texture *wlr_texture,
 		return false;
 	}
 
+	if (texture->pending_uploads > 0) {
+		gles2_upload_ring_flush(texture->renderer);
+	}
+
 	if (!gles2_texture_bind(texture)) {
 		return false;
 	}
@@ -433,6 +468,15 @@ struct wlr_texture *gles2_texture_from_buffer(struct wlr_renderer *wlr_renderer,
 void wlr_gles2_texture_get_attribs(struct wlr_texture *wlr_texture,
 		struct wlr_gles2_texture_attribs *attribs) {
 	struct wlr_gles2_texture *texture = gles2_get_texture(wlr_texture);
+
+	// The caller may sample from the texture with its own GL code
+	if (texture->pending_uploads > 0) {
+		struct wlr_egl_context prev_ctx;
+		wlr_egl_make_current(texture->renderer->egl, &prev_ctx);
+		gles2_upload_ring_flush(texture->renderer);
+		wlr_egl_restore_context(&prev_ctx);
+	}
+
 	*attribs = (struct wlr_gles2_texture_attribs){
 		.target = texture->target,
 		.tex = texture->tex,
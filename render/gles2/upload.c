@@ -0,0 +1,316 @@
+#include <assert.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <wayland-util.h>
+#include <wlr/util/log.h>
+#include "render/gles2.h"
+#include "render/pixel_format.h"
+#include "util/trace.h"
+
+#define UPLOAD_RING_SIZE (16 * 1024 * 1024)
+#define UPLOAD_ALIGNMENT 16
+
+struct wlr_gles2_pending_upload {
+	struct wlr_gles2_texture *texture; // NULL if destroyed since
+	size_t offset;
+	GLint x, y;
+	GLsizei width, height;
+	GLenum format, type;
+};
+
+struct wlr_gles2_upload_batch {
+	GLsync fence;
+	size_t end; // head of the ring when the batch was submitted
+	size_t len; // bytes used by the batch, padding included
+};
+
+static bool ring_init(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_upload_ring *ring = &renderer->upload_ring;
+
+	glGenBuffers(1, &ring->pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, ring->pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, UPLOAD_RING_SIZE, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+	if (glGetError() != GL_NO_ERROR) {
+		wlr_log(WLR_ERROR, "Failed to allocate texture upload ring, "
+			"falling back to synchronous uploads");
+		glDeleteBuffers(1, &ring->pbo);
+		ring->pbo = 0;
+		renderer->procs.glMapBufferRange = NULL;
+		return false;
+	}
+
+	ring->size = UPLOAD_RING_SIZE;
+	wl_array_init(&ring->pending);
+	wl_array_init(&ring->batches);
+	return true;
+}
+
+/**
+ * Release the regions of the batches the GPU is done with, without waiting.
+ */
+static void ring_retire(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_upload_ring *ring = &renderer->upload_ring;
+
+	size_t batches_len = ring->batches.size / sizeof(struct wlr_gles2_upload_batch);
+	struct wlr_gles2_upload_batch *batches = ring->batches.data;
+	size_t retired = 0;
+	while (retired < batches_len) {
+		struct wlr_gles2_upload_batch *batch = &batches[retired];
+		GLenum status = renderer->procs.glClientWaitSync(batch->fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED_APPLE &&
+				status != GL_CONDITION_SATISFIED_APPLE) {
+			break;
+		}
+		renderer->procs.glDeleteSync(batch->fence);
+		ring->tail = batch->end;
+		ring->used -= batch->len;
+		retired++;
+	}
+
+	if (retired > 0) {
+		memmove(batches, &batches[retired],
+			(batches_len - retired) * sizeof(*batches));
+		ring->batches.size -= retired * sizeof(*batches);
+	}
+}
+
+/**
+ * Reserve len bytes of the ring, returning their offset, or -1 if the ring
+ * doesn't have enough space left.
+ */
+static ssize_t ring_alloc(struct wlr_gles2_upload_ring *ring, size_t len) {
+	size_t offset, padding = 0;
+	if (ring->used == 0) {
+		offset = 0;
+		ring->head = ring->tail = 0;
+	} else if (ring->head > ring->tail) {
+		if (len <= ring->size - ring->head) {
+			offset = ring->head;
+		} else if (len <= ring->tail) {
+			offset = 0;
+			padding = ring->size - ring->head;
+		} else {
+			return -1;
+		}
+	} else {
+		// The free space is between the head and the tail
+		if (len > ring->tail - ring->head) {
+			return -1;
+		}
+		offset = ring->head;
+	}
+
+	ring->head = offset + len;
+	ring->used += padding + len;
+	ring->staged += padding + len;
+	return offset;
+}
+
+bool gles2_upload_ring_stage(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_texture *texture, const void *data, size_t stride,
+		const pixman_region32_t *damage) {
+	struct wlr_gles2_upload_ring *ring = &renderer->upload_ring;
+	if (renderer->procs.glMapBufferRange == NULL) {
+		return false;
+	}
+	if (ring->pbo == 0 && !ring_init(renderer)) {
+		return false;
+	}
+
+	const struct wlr_gles2_pixel_format *fmt =
+		get_gles2_format_from_drm(texture->drm_format);
+	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(texture->drm_format);
+	assert(fmt && drm_fmt);
+
+	int rects_len = 0;
+	const pixman_box32_t *rects = pixman_region32_rectangles(damage, &rects_len);
+
+	// All rects of an update are staged together, so that the texture is
+	// either fully updated through the ring or not at all
+	size_t len = 0;
+	for (int i = 0; i < rects_len; i++) {
+		size_t row_len = (size_t)(rects[i].x2 - rects[i].x1) * drm_fmt->bytes_per_block;
+		size_t rect_len = row_len * (size_t)(rects[i].y2 - rects[i].y1);
+		len += (rect_len + UPLOAD_ALIGNMENT - 1) & ~(size_t)(UPLOAD_ALIGNMENT - 1);
+	}
+	if (len == 0 || len > ring->size) {
+		return false;
+	}
+
+	if (ring->map == NULL) {
+		// The fences guarantee that the GPU doesn't read from the regions
+		// being written, so the mapping doesn't need to be synchronized
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, ring->pbo);
+		ring->map = renderer->procs.glMapBufferRange(GL_PIXEL_UNPACK_BUFFER_NV,
+			0, ring->size, GL_MAP_WRITE_BIT_EXT | GL_MAP_UNSYNCHRONIZED_BIT_EXT);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		if (ring->map == NULL) {
+			wlr_log(WLR_ERROR, "Failed to map texture upload ring");
+			return false;
+		}
+	}
+
+	ring_retire(renderer);
+	ssize_t base = ring_alloc(ring, len);
+	if (base < 0) {
+		return false;
+	}
+
+	size_t offset = base;
+	for (int i = 0; i < rects_len; i++) {
+		pixman_box32_t rect = rects[i];
+		int width = rect.x2 - rect.x1;
+		int height = rect.y2 - rect.y1;
+		size_t row_len = (size_t)width * drm_fmt->bytes_per_block;
+
+		const uint8_t *src = (const uint8_t *)data + (size_t)rect.y1 * stride +
+			(size_t)rect.x1 * drm_fmt->bytes_per_block;
+		uint8_t *dst = ring->map + offset;
+		for (int y = 0; y < height; y++) {
+			memcpy(dst, src, row_len);
+			src += stride;
+			dst += row_len;
+		}
+
+		struct wlr_gles2_pending_upload *upload =
+			wl_array_add(&ring->pending, sizeof(*upload));
+		if (upload == NULL) {
+			// The rects staged so far are harmless, the caller re-uploads
+			// the whole damage synchronously after flushing them
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			return false;
+		}
+		*upload = (struct wlr_gles2_pending_upload){
+			.texture = texture,
+			.offset = offset,
+			.x = rect.x1,
+			.y = rect.y1,
+			.width = width,
+			.height = height,
+			.format = fmt->gl_format,
+			.type = fmt->gl_type,
+		};
+		texture->pending_uploads++;
+
+		offset += (row_len * height + UPLOAD_ALIGNMENT - 1) &
+			~(size_t)(UPLOAD_ALIGNMENT - 1);
+	}
+
+	return true;
+}
+
+void gles2_upload_ring_flush(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_upload_ring *ring = &renderer->upload_ring;
+	if (ring->map == NULL) {
+		return;
+	}
+
+	TRACE_BEGIN("gles2_upload_ring_flush");
+	push_gles2_debug(renderer);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, ring->pbo);
+	if (!renderer->procs.glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_NV)) {
+		// The contents of the buffer got lost, the damage of the affected
+		// textures is lost as well
+		wlr_log(WLR_ERROR, "Texture upload ring got corrupted");
+	}
+	ring->map = NULL;
+
+	// Rows are tightly packed in the ring
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	size_t uploads = 0;
+	struct wlr_gles2_pending_upload *upload;
+	wl_array_for_each(upload, &ring->pending) {
+		if (upload->texture == NULL) {
+			continue;
+		}
+		glBindTexture(GL_TEXTURE_2D, upload->texture->tex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, upload->x, upload->y,
+			upload->width, upload->height, upload->format, upload->type,
+			(const void *)(uintptr_t)upload->offset);
+		upload->texture->pending_uploads = 0;
+		uploads++;
+	}
+	ring->pending.size = 0;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+
+	TRACE_COUNTER("gles2_upload_ring_bytes", (int64_t)ring->staged);
+	TRACE_COUNTER("gles2_upload_ring_rects", (int64_t)uploads);
+
+	// The ring may have been mapped without anything fitting in it
+	if (ring->staged > 0) {
+		struct wlr_gles2_upload_batch *batch =
+			wl_array_add(&ring->batches, sizeof(*batch));
+		GLsync fence = renderer->procs.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE_APPLE, 0);
+		if (batch == NULL || fence == NULL) {
+			// Nothing will tell when the region can be reused, wait for it
+			wlr_log(WLR_ERROR, "Failed to fence texture upload ring, stalling");
+			if (fence != NULL) {
+				renderer->procs.glDeleteSync(fence);
+			}
+			if (batch != NULL) {
+				ring->batches.size -= sizeof(*batch);
+			}
+			glFinish();
+			struct wlr_gles2_upload_batch *prev;
+			wl_array_for_each(prev, &ring->batches) {
+				renderer->procs.glDeleteSync(prev->fence);
+			}
+			ring->batches.size = 0;
+			ring->used = 0;
+		} else {
+			*batch = (struct wlr_gles2_upload_batch){
+				.fence = fence,
+				.end = ring->head,
+				.len = ring->staged,
+			};
+		}
+	}
+	ring->staged = 0;
+
+	pop_gles2_debug(renderer);
+	TRACE_END("gles2_upload_ring_flush");
+}
+
+void gles2_upload_ring_drop_texture(struct wlr_gles2_renderer *renderer,
+		struct wlr_gles2_texture *texture) {
+	struct wlr_gles2_pending_upload *upload;
+	wl_array_for_each(upload, &renderer->upload_ring.pending) {
+		if (upload->texture == texture) {
+			upload->texture = NULL;
+		}
+	}
+	texture->pending_uploads = 0;
+}
+
+void gles2_upload_ring_finish(struct wlr_gles2_renderer *renderer) {
+	struct wlr_gles2_upload_ring *ring = &renderer->upload_ring;
+	if (ring->pbo == 0) {
+		return;
+	}
+
+	if (ring->map != NULL) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, ring->pbo);
+		renderer->procs.glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_NV);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+	}
+
+	struct wlr_gles2_upload_batch *batch;
+	wl_array_for_each(batch, &ring->batches) {
+		renderer->procs.glDeleteSync(batch->fence);
+	}
+	glDeleteBuffers(1, &ring->pbo);
+
+	wl_array_release(&ring->pending);
+	wl_array_release(&ring->batches);
+}
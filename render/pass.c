@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <string.h>
 #include <wlr/render/interface.h>
+#include "util/trace.h"
 
 void wlr_render_pass_init(struct wlr_render_pass *render_pass,
 		const struct wlr_render_pass_impl *impl) {
@@ -11,7 +12,10 @@ void wlr_render_pass_init(struct wlr_render_pass *render_pass,
 }
 
 bool wlr_render_pass_submit(struct wlr_render_pass *render_pass) {
-	return render_pass->impl->submit(render_pass);
+	TRACE_BEGIN("wlr_render_pass_submit");
+	bool ok = render_pass->impl->submit(render_pass);
+	TRACE_END("wlr_render_pass_submit");
+	return ok;
 }
 
 void wlr_render_pass_add_texture(struct wlr_render_pass *render_pass,
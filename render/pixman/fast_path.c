@@ -0,0 +1,295 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "render/pixman.h"
+
+// Number of pixels blended at once from the row buffer
+#define CHUNK_WIDTH 256
+
+/**
+ * Multiply each 8-bit channel of x by a / 255, rounded like pixman does.
+ */
+static inline uint32_t un8x4_mul_un8(uint32_t x, uint32_t a) {
+	uint32_t lo = (x & 0xff00ff) * a + 0x800080;
+	lo = ((lo + ((lo >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+	uint32_t hi = ((x >> 8) & 0xff00ff) * a + 0x800080;
+	hi = (hi + ((hi >> 8) & 0xff00ff)) & 0xff00ff00;
+	return lo | hi;
+}
+
+/**
+ * Add each 8-bit channel of x and y, saturating.
+ */
+static inline uint32_t un8x4_add_un8x4(uint32_t x, uint32_t y) {
+	uint32_t lo = (x & 0xff00ff) + (y & 0xff00ff);
+	lo |= 0x1000100 - ((lo >> 8) & 0xff00ff);
+	lo &= 0xff00ff;
+	uint32_t hi = ((x >> 8) & 0xff00ff) + ((y >> 8) & 0xff00ff);
+	hi |= 0x1000100 - ((hi >> 8) & 0xff00ff);
+	hi = (hi & 0xff00ff) << 8;
+	return lo | hi;
+}
+
+static void combine_src_c(uint32_t *dst, const uint32_t *src,
+		int width, uint8_t alpha, uint32_t src_or) {
+	for (int i = 0; i < width; i++) {
+		uint32_t s = src[i] | src_or;
+		dst[i] = alpha == 0xff ? s : un8x4_mul_un8(s, alpha);
+	}
+}
+
+static void combine_over_c(uint32_t *dst, const uint32_t *src,
+		int width, uint8_t alpha, uint32_t src_or) {
+	for (int i = 0; i < width; i++) {
+		uint32_t s = src[i] | src_or;
+		if (alpha != 0xff) {
+			s = un8x4_mul_un8(s, alpha);
+		}
+		uint32_t ia = ~s >> 24;
+		if (ia == 0) {
+			dst[i] = s;
+		} else if (s != 0) {
+			dst[i] = un8x4_add_un8x4(s, un8x4_mul_un8(dst[i], ia));
+		}
+	}
+}
+
+static bool c_is_supported(void) {
+	return true;
+}
+
+const struct wlr_pixman_fast_path_impl pixman_fast_path_c = {
+	.name = "c",
+	.is_supported = c_is_supported,
+	.combine_src = combine_src_c,
+	.combine_over = combine_over_c,
+};
+
+const struct wlr_pixman_fast_path_impl *const pixman_fast_path_impls[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	&pixman_fast_path_avx2,
+	&pixman_fast_path_sse2,
+#endif
+#if defined(__aarch64__) && WLR_LITTLE_ENDIAN
+	&pixman_fast_path_neon,
+#endif
+	&pixman_fast_path_c,
+	NULL,
+};
+
+const struct wlr_pixman_fast_path_impl *pixman_fast_path_get_best_impl(void) {
+	for (size_t i = 0; pixman_fast_path_impls[i] != NULL; i++) {
+		const struct wlr_pixman_fast_path_impl *impl = pixman_fast_path_impls[i];
+		if (impl->is_supported()) {
+			return impl;
+		}
+	}
+	abort(); // unreachable, the C implementation is always supported
+}
+
+/**
+ * Returns the value to OR source pixels with to make them compatible with
+ * the destination format, or false if the formats aren't 32-bit ARGB with
+ * the same channel order.
+ */
+static bool get_src_or(pixman_format_code_t src, pixman_format_code_t dst,
+		uint32_t *src_or) {
+	switch (dst) {
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_x8r8g8b8:
+		if (src != PIXMAN_a8r8g8b8 && src != PIXMAN_x8r8g8b8) {
+			return false;
+		}
+		*src_or = src == PIXMAN_x8r8g8b8 ? 0xff000000 : 0;
+		return true;
+	case PIXMAN_a8b8g8r8:
+	case PIXMAN_x8b8g8r8:
+		if (src != PIXMAN_a8b8g8r8 && src != PIXMAN_x8b8g8r8) {
+			return false;
+		}
+		*src_or = src == PIXMAN_x8b8g8r8 ? 0xff000000 : 0;
+		return true;
+	default:
+		return false;
+	}
+}
+
+enum fetch_mode {
+	// Source pixels are read at a constant offset from destination pixels
+	FETCH_TRANSLATE,
+	// Source pixels are read through an affine transform, sampling the
+	// nearest pixel
+	FETCH_NEAREST,
+};
+
+/**
+ * Check whether the transform of an operation is one of the cases handled
+ * by fast paths: a rotation or flip without scaling, or a 2x nearest
+ * upscale. Bilinear scaling is left to pixman, which has its own SIMD
+ * scalers and whose rounding we would have to replicate exactly.
+ */
+static bool is_fast_transform(const struct wlr_pixman_render_op *op) {
+	const pixman_fixed_t (*m)[3] = op->transform.matrix;
+	if (m[2][0] != 0 || m[2][1] != 0 || m[2][2] != pixman_fixed_1) {
+		return false;
+	}
+
+	pixman_fixed_t a = m[0][0], b = m[0][1], c = m[1][0], d = m[1][1];
+	bool axis_aligned = b == 0 && c == 0;
+	bool swapped = a == 0 && d == 0;
+	if (!axis_aligned && !swapped) {
+		return false;
+	}
+
+	pixman_fixed_t p = axis_aligned ? a : b, q = axis_aligned ? d : c;
+	if (abs(p) == pixman_fixed_1 && abs(q) == pixman_fixed_1) {
+		// Pixel centers are mapped to pixel centers, so filtering is a
+		// no-op as long as the translation is a whole number of pixels
+		return op->filter == PIXMAN_FILTER_NEAREST ||
+			(pixman_fixed_frac(m[0][2]) == 0 && pixman_fixed_frac(m[1][2]) == 0);
+	}
+
+	return axis_aligned && a == pixman_fixed_1 / 2 && d == pixman_fixed_1 / 2 &&
+		op->filter == PIXMAN_FILTER_NEAREST;
+}
+
+static inline uint32_t fetch_pixel(const struct wlr_pixman_render_op *op,
+		int x, int y, uint32_t src_or) {
+	if (x < 0 || y < 0 || x >= op->src_width || y >= op->src_height) {
+		return 0;
+	}
+	const uint32_t *row = (const uint32_t *)
+		((const uint8_t *)op->src_data + (size_t)y * op->src_stride);
+	return row[x] | src_or;
+}
+
+/**
+ * Fill buf with the source pixels of the width destination pixels starting
+ * at (x, y), relative to the destination box. Pixels outside of the source
+ * image are transparent.
+ */
+static void fetch_translate(const struct wlr_pixman_render_op *op,
+		uint32_t *buf, int x, int y, int width, uint32_t src_or) {
+	int sx = op->src_box.x + x, sy = op->src_box.y + y;
+	for (int i = 0; i < width; i++) {
+		buf[i] = fetch_pixel(op, sx + i, sy, src_or);
+	}
+}
+
+static void fetch_nearest(const struct wlr_pixman_render_op *op,
+		uint32_t *buf, int x, int y, int width, uint32_t src_or) {
+	const pixman_fixed_t (*m)[3] = op->transform.matrix;
+
+	// Sample at pixel centers, like pixman does
+	pixman_fixed_t dx = pixman_int_to_fixed(x) + pixman_fixed_1 / 2;
+	pixman_fixed_t dy = pixman_int_to_fixed(y) + pixman_fixed_1 / 2;
+	int64_t vx = ((int64_t)m[0][0] * dx + (int64_t)m[0][1] * dy) / pixman_fixed_1 + m[0][2];
+	int64_t vy = ((int64_t)m[1][0] * dx + (int64_t)m[1][1] * dy) / pixman_fixed_1 + m[1][2];
+
+	for (int i = 0; i < width; i++) {
+		int sx = (int)((vx - pixman_fixed_e) >> 16);
+		int sy = (int)((vy - pixman_fixed_e) >> 16);
+		buf[i] = fetch_pixel(op, sx, sy, src_or);
+		vx += m[0][0];
+		vy += m[1][0];
+	}
+}
+
+bool pixman_fast_path_render_op(const struct wlr_pixman_fast_path_impl *impl,
+		const struct wlr_pixman_render_op *op, pixman_image_t *dst,
+		const pixman_region32_t *clip) {
+	if (op->buffer == NULL) {
+		return false;
+	}
+
+	uint32_t src_or;
+	if (!get_src_or(op->src_format, pixman_image_get_format(dst), &src_or)) {
+		return false;
+	}
+
+	enum fetch_mode mode;
+	if (!op->has_transform) {
+		// pixman already turns plain copies into memcpy()
+		if (op->op == PIXMAN_OP_SRC && op->alpha == 0xFFFF) {
+			return false;
+		}
+		mode = FETCH_TRANSLATE;
+	} else if (is_fast_transform(op)) {
+		mode = FETCH_NEAREST;
+	} else {
+		return false;
+	}
+
+	wlr_pixman_combine_func_t combine;
+	switch (op->op) {
+	case PIXMAN_OP_SRC:
+		combine = impl->combine_src;
+		break;
+	case PIXMAN_OP_OVER:
+		combine = impl->combine_over;
+		break;
+	default:
+		return false;
+	}
+
+	// pixman converts solid colors to 8-bit channels by truncation
+	uint8_t alpha = op->alpha >> 8;
+
+	uint8_t *dst_data = (uint8_t *)pixman_image_get_data(dst);
+	int dst_stride = pixman_image_get_stride(dst);
+	int dst_width = pixman_image_get_width(dst);
+	int dst_height = pixman_image_get_height(dst);
+
+	pixman_box32_t bounds = {
+		.x1 = op->dst_box.x > 0 ? op->dst_box.x : 0,
+		.y1 = op->dst_box.y > 0 ? op->dst_box.y : 0,
+		.x2 = op->dst_box.x + op->dst_box.width,
+		.y2 = op->dst_box.y + op->dst_box.height,
+	};
+	if (bounds.x2 > dst_width) {
+		bounds.x2 = dst_width;
+	}
+	if (bounds.y2 > dst_height) {
+		bounds.y2 = dst_height;
+	}
+
+	uint32_t buf[CHUNK_WIDTH];
+
+	int rects_len;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles((pixman_region32_t *)clip, &rects_len);
+	for (int i = 0; i < rects_len; i++) {
+		int x1 = rects[i].x1 > bounds.x1 ? rects[i].x1 : bounds.x1;
+		int y1 = rects[i].y1 > bounds.y1 ? rects[i].y1 : bounds.y1;
+		int x2 = rects[i].x2 < bounds.x2 ? rects[i].x2 : bounds.x2;
+		int y2 = rects[i].y2 < bounds.y2 ? rects[i].y2 : bounds.y2;
+
+		for (int y = y1; y < y2; y++) {
+			uint32_t *dst_row = (uint32_t *)(dst_data + (size_t)y * dst_stride);
+			int rel_y = y - op->dst_box.y;
+
+			for (int x = x1; x < x2; x += CHUNK_WIDTH) {
+				int width = x2 - x < CHUNK_WIDTH ? x2 - x : CHUNK_WIDTH;
+				int rel_x = x - op->dst_box.x;
+
+				if (mode == FETCH_TRANSLATE) {
+					int sx = op->src_box.x + rel_x, sy = op->src_box.y + rel_y;
+					if (sx >= 0 && sy >= 0 && sy < op->src_height &&
+							sx + width <= op->src_width) {
+						// Read straight from the source
+						const uint32_t *src_row = (const uint32_t *)
+							((const uint8_t *)op->src_data + (size_t)sy * op->src_stride);
+						combine(&dst_row[x], &src_row[sx], width, alpha, src_or);
+						continue;
+					}
+					fetch_translate(op, buf, rel_x, rel_y, width, src_or);
+				} else {
+					fetch_nearest(op, buf, rel_x, rel_y, width, src_or);
+				}
+
+				combine(&dst_row[x], buf, width, alpha, 0);
+			}
+		}
+	}
+
+	return true;
+}
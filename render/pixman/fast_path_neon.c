@@ -0,0 +1,64 @@
+#include <arm_neon.h>
+#include "render/pixman.h"
+
+// NEON is part of the AArch64 baseline, so these kernels are always usable.
+// Pixels are processed two at a time, alpha being byte 3 of each pixel.
+
+// Multiply 8-bit lanes, dividing by 255 with rounding
+static inline uint8x8_t mul_un8_neon(uint8x8_t a, uint8x8_t b) {
+	uint16x8_t t = vaddq_u16(vmull_u8(a, b), vdupq_n_u16(0x80));
+	return vaddhn_u16(t, vshrq_n_u16(t, 8));
+}
+
+static void combine_src_neon(uint32_t *dst, const uint32_t *src,
+		int width, uint8_t alpha, uint32_t src_or) {
+	const uint32x2_t or_mask = vdup_n_u32(src_or);
+	const uint8x8_t m = vdup_n_u8(alpha);
+
+	int i = 0;
+	for (; i + 2 <= width; i += 2) {
+		uint8x8_t s = vreinterpret_u8_u32(vorr_u32(vld1_u32(&src[i]), or_mask));
+		if (alpha != 0xff) {
+			s = mul_un8_neon(s, m);
+		}
+		vst1_u32(&dst[i], vreinterpret_u32_u8(s));
+	}
+
+	// Leftover pixels
+	pixman_fast_path_c.combine_src(&dst[i], &src[i], width - i, alpha, src_or);
+}
+
+static void combine_over_neon(uint32_t *dst, const uint32_t *src,
+		int width, uint8_t alpha, uint32_t src_or) {
+	const uint32x2_t or_mask = vdup_n_u32(src_or);
+	const uint8x8_t m = vdup_n_u8(alpha);
+	// Table lookup indices broadcasting the alpha byte of each pixel
+	const uint8x8_t alpha_index = vcreate_u8(0x0707070703030303ULL);
+
+	int i = 0;
+	for (; i + 2 <= width; i += 2) {
+		uint8x8_t s = vreinterpret_u8_u32(vorr_u32(vld1_u32(&src[i]), or_mask));
+		if (alpha != 0xff) {
+			s = mul_un8_neon(s, m);
+		}
+
+		uint8x8_t ia = vmvn_u8(vtbl1_u8(s, alpha_index));
+		uint8x8_t d = vreinterpret_u8_u32(vld1_u32(&dst[i]));
+		d = vqadd_u8(s, mul_un8_neon(d, ia));
+		vst1_u32(&dst[i], vreinterpret_u32_u8(d));
+	}
+
+	// Leftover pixels
+	pixman_fast_path_c.combine_over(&dst[i], &src[i], width - i, alpha, src_or);
+}
+
+static bool neon_is_supported(void) {
+	return true;
+}
+
+const struct wlr_pixman_fast_path_impl pixman_fast_path_neon = {
+	.name = "neon",
+	.is_supported = neon_is_supported,
+	.combine_src = combine_src_neon,
+	.combine_over = combine_over_neon,
+};
@@ -0,0 +1,187 @@
+#include <immintrin.h>
+#include "render/pixman.h"
+
+// The kernels are compiled for their instruction set with target attributes
+// and only selected if the CPU supports it, so that the rest of wlroots can
+// be built for a baseline CPU.
+
+// Multiply 16-bit lanes holding 8-bit values, dividing by 255 with rounding
+__attribute__((target("sse2")))
+static inline __m128i mul_un8_sse2(__m128i a, __m128i b) {
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(0x80));
+	return _mm_mulhi_epu16(t, _mm_set1_epi16(0x101));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i expand_alpha_sse2(__m128i x) {
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+__attribute__((target("sse2")))
+static void combine_src_sse2(uint32_t *dst, const uint32_t *src,
+		int width, uint8_t alpha, uint32_t src_or) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i or_mask = _mm_set1_epi32((int)src_or);
+	const __m128i m = _mm_set1_epi16(alpha);
+
+	int i = 0;
+	for (; i + 4 <= width; i += 4) {
+		__m128i s = _mm_or_si128(_mm_loadu_si128((const __m128i *)&src[i]), or_mask);
+		if (alpha != 0xff) {
+			__m128i lo = mul_un8_sse2(_mm_unpacklo_epi8(s, zero), m);
+			__m128i hi = mul_un8_sse2(_mm_unpackhi_epi8(s, zero), m);
+			s = _mm_packus_epi16(lo, hi);
+		}
+		_mm_storeu_si128((__m128i *)&dst[i], s);
+	}
+
+	// Leftover pixels
+	pixman_fast_path_c.combine_src(&dst[i], &src[i], width - i, alpha, src_or);
+}
+
+__attribute__((target("sse2")))
+static void combine_over_sse2(uint32_t *dst, const uint32_t *src,
+		int width, uint8_t alpha, uint32_t src_or) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i or_mask = _mm_set1_epi32((int)src_or);
+	const __m128i m = _mm_set1_epi16(alpha);
+	const __m128i ff = _mm_set1_epi16(0xff);
+	const __m128i alpha_mask = _mm_set1_epi32((int)0xff000000);
+
+	int i = 0;
+	for (; i + 4 <= width; i += 4) {
+		__m128i s = _mm_or_si128(_mm_loadu_si128((const __m128i *)&src[i]), or_mask);
+		__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+		__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+		if (alpha != 0xff) {
+			s_lo = mul_un8_sse2(s_lo, m);
+			s_hi = mul_un8_sse2(s_hi, m);
+			s = _mm_packus_epi16(s_lo, s_hi);
+		}
+
+		__m128i a = _mm_and_si128(s, alpha_mask);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, alpha_mask)) == 0xffff) {
+			// All opaque
+			_mm_storeu_si128((__m128i *)&dst[i], s);
+			continue;
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xffff) {
+			// All transparent
+			continue;
+		}
+
+		__m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+		__m128i ia_lo = _mm_xor_si128(expand_alpha_sse2(s_lo), ff);
+		__m128i ia_hi = _mm_xor_si128(expand_alpha_sse2(s_hi), ff);
+		__m128i d_lo = mul_un8_sse2(_mm_unpacklo_epi8(d, zero), ia_lo);
+		__m128i d_hi = mul_un8_sse2(_mm_unpackhi_epi8(d, zero), ia_hi);
+		d = _mm_adds_epu8(s, _mm_packus_epi16(d_lo, d_hi));
+		_mm_storeu_si128((__m128i *)&dst[i], d);
+	}
+
+	// Leftover pixels
+	pixman_fast_path_c.combine_over(&dst[i], &src[i], width - i, alpha, src_or);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mul_un8_avx2(__m256i a, __m256i b) {
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(0x80));
+	return _mm256_mulhi_epu16(t, _mm256_set1_epi16(0x101));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i expand_alpha_avx2(__m256i x) {
+	x = _mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm256_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// Unpacking and packing both work within 128-bit lanes, so pixels stay in
+// order across a round-trip
+__attribute__((target("avx2")))
+static void combine_src_avx2(uint32_t *dst, const uint32_t *src,
+		int width, uint8_t alpha, uint32_t src_or) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i or_mask = _mm256_set1_epi32((int)src_or);
+	const __m256i m = _mm256_set1_epi16(alpha);
+
+	int i = 0;
+	for (; i + 8 <= width; i += 8) {
+		__m256i s = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)&src[i]), or_mask);
+		if (alpha != 0xff) {
+			__m256i lo = mul_un8_avx2(_mm256_unpacklo_epi8(s, zero), m);
+			__m256i hi = mul_un8_avx2(_mm256_unpackhi_epi8(s, zero), m);
+			s = _mm256_packus_epi16(lo, hi);
+		}
+		_mm256_storeu_si256((__m256i *)&dst[i], s);
+	}
+
+	// Leftover pixels
+	pixman_fast_path_c.combine_src(&dst[i], &src[i], width - i, alpha, src_or);
+}
+
+__attribute__((target("avx2")))
+static void combine_over_avx2(uint32_t *dst, const uint32_t *src,
+		int width, uint8_t alpha, uint32_t src_or) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i or_mask = _mm256_set1_epi32((int)src_or);
+	const __m256i m = _mm256_set1_epi16(alpha);
+	const __m256i ff = _mm256_set1_epi16(0xff);
+	const __m256i alpha_mask = _mm256_set1_epi32((int)0xff000000);
+
+	int i = 0;
+	for (; i + 8 <= width; i += 8) {
+		__m256i s = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)&src[i]), or_mask);
+		__m256i s_lo = _mm256_unpacklo_epi8(s, zero);
+		__m256i s_hi = _mm256_unpackhi_epi8(s, zero);
+		if (alpha != 0xff) {
+			s_lo = mul_un8_avx2(s_lo, m);
+			s_hi = mul_un8_avx2(s_hi, m);
+			s = _mm256_packus_epi16(s_lo, s_hi);
+		}
+
+		__m256i a = _mm256_and_si256(s, alpha_mask);
+		if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, alpha_mask)) == 0xffffffff) {
+			// All opaque
+			_mm256_storeu_si256((__m256i *)&dst[i], s);
+			continue;
+		}
+		if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi32(s, zero)) == 0xffffffff) {
+			// All transparent
+			continue;
+		}
+
+		__m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+		__m256i ia_lo = _mm256_xor_si256(expand_alpha_avx2(s_lo), ff);
+		__m256i ia_hi = _mm256_xor_si256(expand_alpha_avx2(s_hi), ff);
+		__m256i d_lo = mul_un8_avx2(_mm256_unpacklo_epi8(d, zero), ia_lo);
+		__m256i d_hi = mul_un8_avx2(_mm256_unpackhi_epi8(d, zero), ia_hi);
+		d = _mm256_adds_epu8(s, _mm256_packus_epi16(d_lo, d_hi));
+		_mm256_storeu_si256((__m256i *)&dst[i], d);
+	}
+
+	// Leftover pixels
+	pixman_fast_path_c.combine_over(&dst[i], &src[i], width - i, alpha, src_or);
+}
+
+static bool sse2_is_supported(void) {
+	return __builtin_cpu_supports("sse2");
+}
+
+static bool avx2_is_supported(void) {
+	return __builtin_cpu_supports("avx2");
+}
+
+const struct wlr_pixman_fast_path_impl pixman_fast_path_sse2 = {
+	.name = "sse2",
+	.is_supported = sse2_is_supported,
+	.combine_src = combine_src_sse2,
+	.combine_over = combine_over_sse2,
+};
+
+const struct wlr_pixman_fast_path_impl pixman_fast_path_avx2 = {
+	.name = "avx2",
+	.is_supported = avx2_is_supported,
+	.combine_src = combine_src_avx2,
+	.combine_over = combine_over_avx2,
+};
@@ -1,7 +1,16 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wlr/util/log.h>
 #include "render/pixman.h"
 
+// Smallest number of rows rendered by a single job when splitting a pass
+// across threads
+#define MIN_TILE_HEIGHT 32
+// Number of jobs per thread, so that uneven tiles can be balanced
+#define TILES_PER_THREAD 4
+
 static const struct wlr_render_pass_impl render_pass_impl;
 
 static struct wlr_pixman_render_pass *get_render_pass(struct wlr_render_pass *wlr_pass) {
@@ -16,12 +25,382 @@ static struct wlr_pixman_texture *get_texture(struct wlr_texture *wlr_texture) {
 	return texture;
 }
 
-static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
-	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
+static pixman_image_t *get_solid_fill(struct wlr_pixman_renderer *renderer,
+		const struct pixman_color *color) {
+	for (size_t i = 0; i < WLR_PIXMAN_SOLID_FILL_CACHE_SIZE; i++) {
+		struct wlr_pixman_solid_fill *fill = &renderer->solid_fills[i];
+		if (fill->image != NULL && memcmp(&fill->color, color, sizeof(*color)) == 0) {
+			return pixman_image_ref(fill->image);
+		}
+	}
+
+	struct wlr_pixman_solid_fill *fill =
+		&renderer->solid_fills[renderer->solid_fills_next];
+	renderer->solid_fills_next =
+		(renderer->solid_fills_next + 1) % WLR_PIXMAN_SOLID_FILL_CACHE_SIZE;
+	if (fill->image != NULL) {
+		pixman_image_unref(fill->image);
+	}
+
+	fill->color = *color;
+	fill->image = pixman_image_create_solid_fill(color);
+	if (fill->image == NULL) {
+		return NULL;
+	}
+	return pixman_image_ref(fill->image);
+}
+
+static pixman_image_t *create_source_image(const struct wlr_pixman_render_op *op) {
+	pixman_image_t *src = pixman_image_create_bits_no_clear(op->src_format,
+		op->src_width, op->src_height, op->src_data, op->src_stride);
+	if (src != NULL && op->has_transform) {
+		pixman_image_set_transform(src, &op->transform);
+		pixman_image_set_filter(src, op->filter, NULL, 0);
+	}
+	return src;
+}
+
+/**
+ * Get the source image of an operation from its view, only updating the
+ * transform and filter if they changed since the view was last drawn.
+ */
+static pixman_image_t *get_source_image(const struct wlr_pixman_render_op *op) {
+	struct wlr_pixman_view *view = op->view;
+
+	// The data pointer changes if a client resizes its wl_shm_pool
+	if (view->image != NULL &&
+			(pixman_image_get_data(view->image) != op->src_data ||
+			pixman_image_get_stride(view->image) != op->src_stride)) {
+		pixman_image_unref(view->image);
+		view->image = NULL;
+	}
+
+	if (view->image == NULL) {
+		view->image = pixman_image_create_bits_no_clear(op->src_format,
+			op->src_width, op->src_height, op->src_data, op->src_stride);
+		if (view->image == NULL) {
+			return NULL;
+		}
+		view->has_transform = false;
+		view->filter = PIXMAN_FILTER_NEAREST;
+	}
+
+	if (op->has_transform) {
+		if (!view->has_transform || memcmp(&view->transform,
+				&op->transform, sizeof(op->transform)) != 0) {
+			pixman_image_set_transform(view->image, &op->transform);
+			view->transform = op->transform;
+			view->has_transform = true;
+		}
+		if (view->filter != op->filter) {
+			pixman_image_set_filter(view->image, op->filter, NULL, 0);
+			view->filter = op->filter;
+		}
+	} else if (view->has_transform) {
+		pixman_image_set_transform(view->image, NULL);
+		view->has_transform = false;
+	}
+
+	return pixman_image_ref(view->image);
+}
+
+/**
+ * Composite an operation onto dst. If cached is true, the images cached by
+ * the renderer and textures are used: this is only allowed from the
+ * compositor thread.
+ */
+static void render_op(struct wlr_pixman_renderer *renderer,
+		const struct wlr_pixman_render_op *op, pixman_image_t *dst,
+		pixman_region32_t *clip, bool cached) {
+	if (op->buffer == NULL) {
+		pixman_image_t *fill = cached ?
+			get_solid_fill(renderer, &op->color) :
+			pixman_image_create_solid_fill(&op->color);
+		if (fill == NULL) {
+			return;
+		}
+
+		pixman_image_set_clip_region32(dst, clip);
+		pixman_image_composite32(op->op, fill, NULL, dst,
+			0, 0, 0, 0, op->dst_box.x, op->dst_box.y,
+			op->dst_box.width, op->dst_box.height);
+		pixman_image_set_clip_region32(dst, NULL);
+
+		pixman_image_unref(fill);
+		return;
+	}
+
+	if (renderer->fast_path != NULL &&
+			pixman_fast_path_render_op(renderer->fast_path, op, dst, clip)) {
+		return;
+	}
+
+	// Worker threads use images private to this call, so that operations
+	// can run concurrently with each their own transform and filter
+	pixman_image_t *src = cached ?
+		get_source_image(op) : create_source_image(op);
+	if (src == NULL) {
+		return;
+	}
+
+	pixman_image_t *mask = NULL;
+	if (op->alpha != 0xFFFF) {
+		const struct pixman_color color = { .alpha = op->alpha };
+		mask = cached ? get_solid_fill(renderer, &color) :
+			pixman_image_create_solid_fill(&color);
+	}
+
+	pixman_image_set_clip_region32(dst, clip);
+	if (op->has_transform) {
+		// Now composite the result onto the pass buffer.  We specify a source origin of 0,0
+		// because the x,y part of source crop is already done using the transform. The
+		// width,height part of source crop is done here by the width and height we pass:
+		// because of the scaling, cropping at the end by dst_box.{width,height} is
+		// equivalent to if we cropped at the start by src_box.{width,height}.
+		pixman_image_composite32(op->op, src, mask, dst,
+			0, 0, // source x,y
+			0, 0, // mask x,y
+			op->dst_box.x, op->dst_box.y, // dest x,y
+			op->dst_box.width, op->dst_box.height // composite width,height
+		);
+	} else {
+		// No transforms or crop needed, just a straight blit from the source
+		pixman_image_composite32(op->op, src, mask, dst,
+			op->src_box.x, op->src_box.y, 0, 0, op->dst_box.x, op->dst_box.y,
+			op->src_box.width, op->src_box.height);
+	}
+	pixman_image_set_clip_region32(dst, NULL);
+
+	if (mask != NULL) {
+		pixman_image_unref(mask);
+	}
+	pixman_image_unref(src);
+}
+
+struct render_tiles_data {
+	struct wlr_pixman_render_pass *pass;
+	pixman_box32_t extents;
+	int tile_height;
+};
+
+static void render_tile(void *data, size_t index) {
+	struct render_tiles_data *tiles = data;
+	struct wlr_pixman_render_pass *pass = tiles->pass;
+	pixman_image_t *image = pass->buffer->image;
+
+	int y1 = tiles->extents.y1 + (int)index * tiles->tile_height;
+	int y2 = y1 + tiles->tile_height;
+	if (y2 > tiles->extents.y2) {
+		y2 = tiles->extents.y2;
+	}
+	if (y1 >= y2) {
+		return;
+	}
+
+	// The clip region is part of the image state, so each tile needs its
+	// own image for the destination buffer
+	pixman_image_t *dst = pixman_image_create_bits_no_clear(
+		pixman_image_get_format(image), pixman_image_get_width(image),
+		pixman_image_get_height(image), pixman_image_get_data(image),
+		pixman_image_get_stride(image));
+	if (dst == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create pixman image for tile");
+		return;
+	}
+
+	pixman_region32_t clip;
+	pixman_region32_init(&clip);
+
+	struct wlr_pixman_render_op *op;
+	wl_array_for_each(op, &pass->ops) {
+		pixman_region32_intersect_rect(&clip, &op->clip,
+			tiles->extents.x1, y1, tiles->extents.x2 - tiles->extents.x1, y2 - y1);
+		if (!pixman_region32_not_empty(&clip)) {
+			continue;
+		}
+		render_op(pass->buffer->renderer, op, dst, &clip, false);
+	}
+
+	pixman_region32_fini(&clip);
+	pixman_image_unref(dst);
+}
+
+/**
+ * Check whether an operation overwrites everything below it in its clip
+ * region.
+ */
+static bool render_op_is_opaque(const struct wlr_pixman_render_op *op) {
+	if (op->op == PIXMAN_OP_SRC) {
+		return true;
+	}
+
+	if (op->buffer == NULL) {
+		return op->color.alpha == 0xFFFF;
+	}
+
+	if (op->alpha != 0xFFFF || PIXMAN_FORMAT_A(op->src_format) != 0) {
+		return false;
+	}
+
+	// Pixels sampled outside of the source image are transparent, and
+	// bilinear filtering blends them into the edges
+	if (op->src_box.x < 0 || op->src_box.y < 0 ||
+			op->src_box.x + op->src_box.width > op->src_width ||
+			op->src_box.y + op->src_box.height > op->src_height) {
+		return false;
+	}
+	return !op->has_transform || op->filter == PIXMAN_FILTER_NEAREST;
+}
+
+/**
+ * Remove from the clip region of each operation the parts covered by opaque
+ * operations recorded after it, so that each pixel is written about once.
+ */
+static void cull_occluded_ops(struct wlr_pixman_render_pass *pass) {
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
+
+	struct wlr_pixman_render_op *ops = pass->ops.data;
+	size_t ops_len = pass->ops.size / sizeof(ops[0]);
+	for (size_t i = ops_len; i-- > 0;) {
+		struct wlr_pixman_render_op *op = &ops[i];
+		pixman_region32_subtract(&op->clip, &op->clip, &opaque);
+		if (pixman_region32_not_empty(&op->clip) && render_op_is_opaque(op)) {
+			pixman_region32_union(&opaque, &opaque, &op->clip);
+		}
+	}
+
+	pixman_region32_fini(&opaque);
+}
+
+static void render_ops(struct wlr_pixman_render_pass *pass) {
+	struct wlr_pixman_renderer *renderer = pass->buffer->renderer;
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	struct wlr_pixman_render_op *op;
+	wl_array_for_each(op, &pass->ops) {
+		pixman_region32_union(&damage, &damage, &op->clip);
+	}
+	pixman_box32_t extents = *pixman_region32_extents(&damage);
+	pixman_region32_fini(&damage);
+
+	int height = extents.y2 - extents.y1;
+	if (height <= 0) {
+		return;
+	}
+
+	size_t tiles_len = height / MIN_TILE_HEIGHT;
+	if (renderer->threads <= 1) {
+		tiles_len = 1;
+	} else if (tiles_len > renderer->threads * TILES_PER_THREAD) {
+		tiles_len = renderer->threads * TILES_PER_THREAD;
+	}
+
+	if (tiles_len > 1 && renderer->pool == NULL) {
+		renderer->pool = pixman_worker_pool_create(renderer->threads);
+		if (renderer->pool == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create pixman worker pool, "
+				"falling back to single-threaded rendering");
+			renderer->threads = 1;
+		}
+	}
+
+	if (tiles_len <= 1 || renderer->pool == NULL) {
+		wl_array_for_each(op, &pass->ops) {
+			if (pixman_region32_not_empty(&op->clip)) {
+				render_op(renderer, op, pass->buffer->image, &op->clip, true);
+			}
+		}
+		return;
+	}
+
+	struct render_tiles_data tiles = {
+		.pass = pass,
+		.extents = extents,
+		.tile_height = (height + tiles_len - 1) / tiles_len,
+	};
+	pixman_worker_pool_run(renderer->pool, render_tile, &tiles, tiles_len);
+}
+
+/**
+ * Open the texture buffers for reading and point operations to their data.
+ * Operations whose buffer can't be read are dropped.
+ */
+static void pass_begin_accesses(struct wlr_pixman_render_pass *pass) {
+	struct wlr_pixman_buffer_access *access;
+	wl_array_for_each(access, &pass->accesses) {
+		if (!wlr_buffer_begin_data_ptr_access(access->buffer,
+				WLR_BUFFER_DATA_PTR_ACCESS_READ, &access->data,
+				&access->format, &access->stride)) {
+			wlr_log(WLR_DEBUG, "Failed to read texture buffer");
+			access->data = NULL;
+		}
+	}
+
+	struct wlr_pixman_render_op *op;
+	wl_array_for_each(op, &pass->ops) {
+		if (op->buffer == NULL) {
+			continue;
+		}
+		wl_array_for_each(access, &pass->accesses) {
+			if (access->buffer == op->buffer) {
+				break;
+			}
+		}
+		if (access->data == NULL) {
+			pixman_region32_clear(&op->clip);
+			continue;
+		}
+		op->src_data = access->data;
+		op->src_stride = access->stride;
+	}
+}
+
+static void pass_end_accesses(struct wlr_pixman_render_pass *pass) {
+	struct wlr_pixman_buffer_access *access;
+	wl_array_for_each(access, &pass->accesses) {
+		if (access->data != NULL) {
+			wlr_buffer_end_data_ptr_access(access->buffer);
+			access->data = NULL;
+		}
+	}
+}
+
+static void pass_finish(struct wlr_pixman_render_pass *pass) {
+	struct wlr_pixman_render_op *op;
+	wl_array_for_each(op, &pass->ops) {
+		pixman_region32_fini(&op->clip);
+		if (op->view != NULL) {
+			pixman_view_unref(op->view);
+		}
+	}
+	wl_array_release(&pass->ops);
+
+	struct wlr_pixman_buffer_access *access;
+	wl_array_for_each(access, &pass->accesses) {
+		wlr_buffer_unlock(access->buffer);
+	}
+	wl_array_release(&pass->accesses);
 
 	wlr_buffer_end_data_ptr_access(pass->buffer->buffer);
 	wlr_buffer_unlock(pass->buffer->buffer);
 	free(pass);
+}
+
+static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
+	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
+
+	// Texture buffers are only read from now on: until then, they may be
+	// accessed by others, e.g. to create textures
+	pass_begin_accesses(pass);
+	cull_occluded_ops(pass);
+	render_ops(pass);
+	pass_end_accesses(pass);
+	if (pass->timer != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &pass->timer->end);
+	}
+	pass_finish(pass);
 
 	return true;
 }
@@ -36,19 +415,189 @@ static pixman_op_t get_pixman_blending(enum wlr_render_blend_mode mode) {
 	abort();
 }
 
-static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
-		const struct wlr_render_texture_options *options) {
-	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
-	struct wlr_pixman_texture *texture = get_texture(options->texture);
-	struct wlr_pixman_buffer *buffer = pass->buffer;
+/**
+ * Keep the buffer backing a texture locked until the pass is finished, since
+ * the texture may be destroyed before the pass is submitted. Several
+ * textures may share a buffer.
+ */
+static bool pass_lock_buffer(struct wlr_pixman_render_pass *pass,
+		struct wlr_buffer *buffer) {
+	struct wlr_pixman_buffer_access *access;
+	wl_array_for_each(access, &pass->accesses) {
+		if (access->buffer == buffer) {
+			return true;
+		}
+	}
+
+	access = wl_array_add(&pass->accesses, sizeof(*access));
+	if (access == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return false;
+	}
+
+	*access = (struct wlr_pixman_buffer_access){
+		.buffer = wlr_buffer_lock(buffer),
+	};
+	return true;
+}
+
+static struct wlr_pixman_render_op *pass_add_op(struct wlr_pixman_render_pass *pass,
+		const struct wlr_box *dst_box, const pixman_region32_t *clip) {
+	struct wlr_buffer *buffer = pass->buffer->buffer;
+
+	struct wlr_pixman_render_op *op = wl_array_add(&pass->ops, sizeof(*op));
+	if (op == NULL) {
+		wlr_log(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	*op = (struct wlr_pixman_render_op){
+		.dst_box = *dst_box,
+	};
+
+	pixman_region32_init_rect(&op->clip, 0, 0, buffer->width, buffer->height);
+	pixman_region32_intersect_rect(&op->clip, &op->clip,
+		dst_box->x, dst_box->y, dst_box->width, dst_box->height);
+	if (clip != NULL) {
+		pixman_region32_intersect(&op->clip, &op->clip, (pixman_region32_t *)clip);
+	}
 
-	if (texture->buffer != NULL && !begin_pixman_data_ptr_access(texture->buffer,
-			&texture->image, WLR_BUFFER_DATA_PTR_ACCESS_READ)) {
+	if (!pixman_region32_not_empty(&op->clip)) {
+		pixman_region32_fini(&op->clip);
+		pass->ops.size -= sizeof(*op);
+		return NULL;
+	}
+
+	return op;
+}
+
+static void compute_transform(struct wlr_pixman_cached_transform *entry) {
+	const struct wlr_pixman_transform_key *key = &entry->key;
+	struct wlr_box src_box = key->src_box;
+
+	// Rotate the source size into destination coordinates
+	struct wlr_box src_box_transformed;
+	wlr_box_transform(&src_box_transformed, &src_box, key->transform,
+		src_box.width, src_box.height);
+
+	entry->has_transform = key->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+		src_box_transformed.width != key->dst_width ||
+		src_box_transformed.height != key->dst_height;
+	if (!entry->has_transform) {
 		return;
 	}
 
-	pixman_op_t op = get_pixman_blending(options->blend_mode);
-	pixman_image_set_clip_region32(buffer->image, (pixman_region32_t *)options->clip);
+	// Cosinus/sinus values are extact integers for enum wl_output_transform entries
+	int tr_cos = 1, tr_sin = 0, tr_x = 0, tr_y = 0;
+	switch (key->transform) {
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		tr_cos = 0;
+		tr_sin = 1;
+		tr_y = src_box.width;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		tr_cos = -1;
+		tr_sin = 0;
+		tr_x = src_box.width;
+		tr_y = src_box.height;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		tr_cos = 0;
+		tr_sin = -1;
+		tr_x = src_box.height;
+		break;
+	}
+
+	// Pixman transforms are generally the opposite of what you expect because they
+	// apply to the coordinate system rather than the image.  The comments here
+	// refer to what happens to the image, so all the code between
+	// pixman_transform_init_identity() and the end of this function is probably
+	// best read backwards.  Also this means translations are in the opposite
+	// direction, imagine them as moving the origin around rather than moving the
+	// image.
+	//
+	// Beware that this doesn't work quite the same as wp_viewporter: We apply crop
+	// before transform and scale, whereas it defines crop in post-transform-scale
+	// coordinates.  But this only applies to internal wlroots code - the viewporter
+	// extension code makes sure that to clients everything works as it should.
+
+	struct pixman_transform *transform = &entry->transform;
+	pixman_transform_init_identity(transform);
+
+	// Apply scaling to get to the dst_box size.  Because the scaling is applied last
+	// it depends on the whether the rotation swapped width and height, which is why
+	// we use src_box_transformed instead of src_box.
+	pixman_transform_scale(transform, NULL,
+		pixman_double_to_fixed(src_box_transformed.width / (double)key->dst_width),
+		pixman_double_to_fixed(src_box_transformed.height / (double)key->dst_height));
+
+	// pixman rotates about the origin which again leaves everything outside of the
+	// viewport.  Translate the result so that its new top-left corner is back at the
+	// origin.
+	pixman_transform_translate(transform, NULL,
+		-pixman_int_to_fixed(tr_x), -pixman_int_to_fixed(tr_y));
+
+	// Apply the rotation
+	pixman_transform_rotate(transform, NULL,
+		pixman_int_to_fixed(tr_cos), pixman_int_to_fixed(tr_sin));
+
+	// Apply flip before rotation
+	if (key->transform >= WL_OUTPUT_TRANSFORM_FLIPPED) {
+		// The flip leaves everything left of the Y axis which is outside the
+		// viewport. So translate everything back into the viewport.
+		pixman_transform_translate(transform, NULL,
+			-pixman_int_to_fixed(src_box.width), pixman_int_to_fixed(0));
+		// Flip by applying a scale of -1 to the X axis
+		pixman_transform_scale(transform, NULL,
+			pixman_int_to_fixed(-1), pixman_int_to_fixed(1));
+	}
+
+	// Apply the translation for source crop so the origin is now at the top-left of
+	// the region we're actually using.  Do this last so all the other transforms
+	// apply on top of this.
+	pixman_transform_translate(transform, NULL,
+		pixman_int_to_fixed(src_box.x), pixman_int_to_fixed(src_box.y));
+}
+
+static bool transform_key_equal(const struct wlr_pixman_transform_key *a,
+		const struct wlr_pixman_transform_key *b) {
+	return a->transform == b->transform &&
+		wlr_box_equal(&a->src_box, &b->src_box) &&
+		a->dst_width == b->dst_width && a->dst_height == b->dst_height;
+}
+
+static const struct wlr_pixman_cached_transform *get_transform(
+		struct wlr_pixman_texture *texture, const struct wlr_pixman_transform_key *key) {
+	for (size_t i = 0; i < texture->transforms_len; i++) {
+		struct wlr_pixman_cached_transform *entry = &texture->transforms[i];
+		if (transform_key_equal(&entry->key, key)) {
+			return entry;
+		}
+	}
+
+	struct wlr_pixman_cached_transform *entry =
+		&texture->transforms[texture->transforms_next];
+	texture->transforms_next =
+		(texture->transforms_next + 1) % WLR_PIXMAN_TRANSFORM_CACHE_SIZE;
+	if (texture->transforms_len < WLR_PIXMAN_TRANSFORM_CACHE_SIZE) {
+		texture->transforms_len++;
+	}
+
+	*entry = (struct wlr_pixman_cached_transform){ .key = *key };
+	compute_transform(entry);
+	return entry;
+}
+
+static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
+		const struct wlr_render_texture_options *options) {
+	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
+	struct wlr_pixman_texture *texture = get_texture(options->texture);
 
 	struct wlr_fbox src_fbox;
 	wlr_render_texture_options_get_src_box(options, &src_fbox);
@@ -62,167 +611,73 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 	struct wlr_box dst_box;
 	wlr_render_texture_options_get_dst_box(options, &dst_box);
 
-	pixman_image_t *mask = NULL;
-	float alpha = wlr_render_texture_options_get_alpha(options);
-	if (alpha != 1) {
-		mask = pixman_image_create_solid_fill(&(struct pixman_color){
-			.alpha = 0xFFFF * alpha,
-		});
+	struct wlr_pixman_render_op *op = pass_add_op(pass, &dst_box, options->clip);
+	if (op == NULL) {
+		return;
+	}
+	if (!pass_lock_buffer(pass, texture->buffer)) {
+		pixman_region32_fini(&op->clip);
+		pass->ops.size -= sizeof(*op);
+		return;
 	}
 
-	// Rotate the source size into destination coordinates
-	struct wlr_box src_box_transformed;
-	wlr_box_transform(&src_box_transformed, &src_box, options->transform,
-		buffer->buffer->width, buffer->buffer->height);
-
-	if (options->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
-			src_box_transformed.width != dst_box.width ||
-			src_box_transformed.height != dst_box.height) {
-		// Cosinus/sinus values are extact integers for enum wl_output_transform entries
-		int tr_cos = 1, tr_sin = 0, tr_x = 0, tr_y = 0;
-		switch (options->transform) {
-		case WL_OUTPUT_TRANSFORM_NORMAL:
-		case WL_OUTPUT_TRANSFORM_FLIPPED:
-			break;
-		case WL_OUTPUT_TRANSFORM_90:
-		case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-			tr_cos = 0;
-			tr_sin = 1;
-			tr_y = src_box.width;
-			break;
-		case WL_OUTPUT_TRANSFORM_180:
-		case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-			tr_cos = -1;
-			tr_sin = 0;
-			tr_x = src_box.width;
-			tr_y = src_box.height;
-			break;
-		case WL_OUTPUT_TRANSFORM_270:
-		case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-			tr_cos = 0;
-			tr_sin = -1;
-			tr_x = src_box.height;
-			break;
-		}
-
-		// Pixman transforms are generally the opposite of what you expect because they
-		// apply to the coordinate system rather than the image.  The comments here
-		// refer to what happens to the image, so all the code between
-		// pixman_transform_init_identity() and pixman_image_set_transform() is probably
-		// best read backwards.  Also this means translations are in the opposite
-		// direction, imagine them as moving the origin around rather than moving the
-		// image.
-		//
-		// Beware that this doesn't work quite the same as wp_viewporter: We apply crop
-		// before transform and scale, whereas it defines crop in post-transform-scale
-		// coordinates.  But this only applies to internal wlroots code - the viewporter
-		// extension code makes sure that to clients everything works as it should.
-
-		struct pixman_transform transform;
-		pixman_transform_init_identity(&transform);
-
-		// Apply scaling to get to the dst_box size.  Because the scaling is applied last
-		// it depends on the whether the rotation swapped width and height, which is why
-		// we use src_box_transformed instead of src_box.
-		pixman_transform_scale(&transform, NULL,
-			pixman_double_to_fixed(src_box_transformed.width / (double)dst_box.width),
-			pixman_double_to_fixed(src_box_transformed.height / (double)dst_box.height));
-
-		// pixman rotates about the origin which again leaves everything outside of the
-		// viewport.  Translate the result so that its new top-left corner is back at the
-		// origin.
-		pixman_transform_translate(&transform, NULL,
-			-pixman_int_to_fixed(tr_x), -pixman_int_to_fixed(tr_y));
-
-		// Apply the rotation
-		pixman_transform_rotate(&transform, NULL,
-			pixman_int_to_fixed(tr_cos), pixman_int_to_fixed(tr_sin));
-
-		// Apply flip before rotation
-		if (options->transform >= WL_OUTPUT_TRANSFORM_FLIPPED) {
-			// The flip leaves everything left of the Y axis which is outside the
-			// viewport. So translate everything back into the viewport.
-			pixman_transform_translate(&transform, NULL,
-				-pixman_int_to_fixed(src_box.width), pixman_int_to_fixed(0));
-			// Flip by applying a scale of -1 to the X axis
-			pixman_transform_scale(&transform, NULL,
-				pixman_int_to_fixed(-1), pixman_int_to_fixed(1));
-		}
-
-		// Apply the translation for source crop so the origin is now at the top-left of
-		// the region we're actually using.  Do this last so all the other transforms
-		// apply on top of this.
-		pixman_transform_translate(&transform, NULL,
-			pixman_int_to_fixed(src_box.x), pixman_int_to_fixed(src_box.y));
-
-		pixman_image_set_transform(texture->image, &transform);
-
-		switch (options->filter_mode) {
-		case WLR_SCALE_FILTER_BILINEAR:
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
-			break;
-		case WLR_SCALE_FILTER_NEAREST:
-			pixman_image_set_filter(texture->image, PIXMAN_FILTER_NEAREST, NULL, 0);
-			break;
-		}
-
-		// Now composite the result onto the pass buffer.  We specify a source origin of 0,0
-		// because the x,y part of source crop is already done using the transform. The
-		// width,height part of source crop is done here by the width and height we pass:
-		// because of the scaling, cropping at the end by dst_box.{width,height} is
-		// equivalent to if we cropped at the start by src_box.{width,height}.
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			0, 0, // source x,y
-			0, 0, // mask x,y
-			dst_box.x, dst_box.y, // dest x,y
-			dst_box.width, dst_box.height // composite width,height
-		);
+	op->op = get_pixman_blending(options->blend_mode);
+	op->buffer = texture->buffer;
+	op->view = pixman_view_ref(texture->buffer_image->view);
+	op->src_format = texture->format;
+	op->src_width = texture->wlr_texture.width;
+	op->src_height = texture->wlr_texture.height;
+	op->src_box = src_box;
+	op->alpha = 0xFFFF;
 
-		pixman_image_set_transform(texture->image, NULL);
-	} else {
-		// No transforms or crop needed, just a straight blit from the source
-		pixman_image_set_transform(texture->image, NULL);
-		pixman_image_composite32(op, texture->image, mask, buffer->image,
-			src_box.x, src_box.y, 0, 0, dst_box.x, dst_box.y,
-			src_box.width, src_box.height);
+	float alpha = wlr_render_texture_options_get_alpha(options);
+	if (alpha != 1) {
+		op->alpha = 0xFFFF * alpha;
 	}
 
-	pixman_image_set_clip_region32(buffer->image, NULL);
+	struct wlr_pixman_transform_key key = {
+		.transform = options->transform,
+		.src_box = src_box,
+		.dst_width = dst_box.width,
+		.dst_height = dst_box.height,
+	};
 
-	if (texture->buffer != NULL) {
-		wlr_buffer_end_data_ptr_access(texture->buffer);
+	const struct wlr_pixman_cached_transform *cached = get_transform(texture, &key);
+	if (!cached->has_transform) {
+		return;
 	}
 
-	if (mask != NULL) {
-		pixman_image_unref(mask);
+	op->has_transform = true;
+	op->transform = cached->transform;
+	switch (options->filter_mode) {
+	case WLR_SCALE_FILTER_BILINEAR:
+		op->filter = PIXMAN_FILTER_BILINEAR;
+		break;
+	case WLR_SCALE_FILTER_NEAREST:
+		op->filter = PIXMAN_FILTER_NEAREST;
+		break;
 	}
 }
 
 static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 		const struct wlr_render_rect_options *options) {
 	struct wlr_pixman_render_pass *pass = get_render_pass(wlr_pass);
-	struct wlr_pixman_buffer *buffer = pass->buffer;
 	struct wlr_box box;
 	wlr_render_rect_options_get_box(options, pass->buffer->buffer, &box);
 
-	pixman_op_t op = get_pixman_blending(options->color.a == 1 ?
-		WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
+	struct wlr_pixman_render_op *op = pass_add_op(pass, &box, options->clip);
+	if (op == NULL) {
+		return;
+	}
 
-	struct pixman_color color = {
+	op->op = get_pixman_blending(options->color.a == 1 ?
+		WLR_RENDER_BLEND_MODE_NONE : options->blend_mode);
+	op->color = (struct pixman_color){
 		.red = options->color.r * 0xFFFF,
 		.green = options->color.g * 0xFFFF,
 		.blue = options->color.b * 0xFFFF,
 		.alpha = options->color.a * 0xFFFF,
 	};
-
-	pixman_image_t *fill = pixman_image_create_solid_fill(&color);
-
-	pixman_image_set_clip_region32(buffer->image, (pixman_region32_t *)options->clip);
-	pixman_image_composite32(op, fill, NULL, buffer->image,
-		0, 0, 0, 0, box.x, box.y, box.width, box.height);
-	pixman_image_set_clip_region32(buffer->image, NULL);
-
-	pixman_image_unref(fill);
 }
 
 static const struct wlr_render_pass_impl render_pass_impl = {
@@ -232,7 +687,7 @@ static const struct wlr_render_pass_impl render_pass_impl = {
 };
 
 struct wlr_pixman_render_pass *begin_pixman_render_pass(
-		struct wlr_pixman_buffer *buffer) {
+		struct wlr_pixman_buffer *buffer, struct wlr_pixman_render_timer *timer) {
 	struct wlr_pixman_render_pass *pass = calloc(1, sizeof(*pass));
 	if (pass == NULL) {
 		return NULL;
@@ -248,6 +703,14 @@ struct wlr_pixman_render_pass *begin_pixman_render_pass(
 
 	wlr_buffer_lock(buffer->buffer);
 	pass->buffer = buffer;
+	wl_array_init(&pass->ops);
+	wl_array_init(&pass->accesses);
+
+	if (timer != NULL) {
+		pass->timer = timer;
+		clock_gettime(CLOCK_MONOTONIC, &timer->start);
+		timer->end = (struct timespec){0};
+	}
 
 	return pass;
 }
@@ -2,6 +2,7 @@
 #include <drm_fourcc.h>
 #include <pixman.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <wayland-util.h>
 #include <wlr/render/interface.h>
 #include <wlr/util/box.h>
@@ -9,6 +10,12 @@
 
 #include "render/pixman.h"
 #include "types/wlr_buffer.h"
+#include "util/env.h"
+#include "util/time.h"
+#include "util/trace.h"
+
+// Upper bound for the number of threads picked automatically
+#define MAX_AUTO_THREADS 8
 
 static const struct wlr_renderer_impl renderer_impl;
 
@@ -80,12 +87,153 @@ static struct wlr_pixman_texture *get_texture(
 	return texture;
 }
 
+struct wlr_pixman_view *pixman_view_create(void) {
+	struct wlr_pixman_view *view = calloc(1, sizeof(*view));
+	if (view == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	view->n_refs = 1;
+	return view;
+}
+
+struct wlr_pixman_view *pixman_view_ref(struct wlr_pixman_view *view) {
+	view->n_refs++;
+	return view;
+}
+
+void pixman_view_unref(struct wlr_pixman_view *view) {
+	assert(view->n_refs > 0);
+	view->n_refs--;
+	if (view->n_refs > 0) {
+		return;
+	}
+
+	if (view->image != NULL) {
+		pixman_image_unref(view->image);
+	}
+	free(view);
+}
+
+static struct wlr_pixman_buffer_image *buffer_image_ref(
+		struct wlr_pixman_buffer_image *buffer_image) {
+	buffer_image->n_refs++;
+	return buffer_image;
+}
+
+static void buffer_image_unref(struct wlr_pixman_buffer_image *buffer_image) {
+	assert(buffer_image->n_refs > 0);
+	buffer_image->n_refs--;
+	if (buffer_image->n_refs > 0) {
+		return;
+	}
+
+	assert(!buffer_image->attached);
+	pixman_image_unref(buffer_image->image);
+	pixman_view_unref(buffer_image->view);
+	free(buffer_image);
+}
+
+/**
+ * Detach the images from their buffer. They are destroyed once the last
+ * texture using them is.
+ */
+static void buffer_image_detach(struct wlr_pixman_buffer_image *buffer_image) {
+	assert(buffer_image->attached);
+	wlr_addon_finish(&buffer_image->addon);
+	wl_list_remove(&buffer_image->link);
+	buffer_image->attached = false;
+	buffer_image_unref(buffer_image);
+}
+
+static void buffer_image_handle_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_pixman_buffer_image *buffer_image =
+		wl_container_of(addon, buffer_image, addon);
+	buffer_image_detach(buffer_image);
+}
+
+static const struct wlr_addon_interface buffer_image_addon_impl = {
+	.name = "wlr_pixman_buffer_image",
+	.destroy = buffer_image_handle_addon_destroy,
+};
+
+/**
+ * Get the images wrapping the memory of a buffer, as returned by a data
+ * pointer access. The images are only re-created if the memory moved, which
+ * happens when a client resizes its wl_shm_pool.
+ */
+static struct wlr_pixman_buffer_image *get_buffer_image(
+		struct wlr_pixman_renderer *renderer, struct wlr_buffer *buffer,
+		void *data, pixman_format_code_t format, size_t stride) {
+	struct wlr_pixman_buffer_image *buffer_image = NULL;
+	struct wlr_addon *addon =
+		wlr_addon_find(&buffer->addons, renderer, &buffer_image_addon_impl);
+	if (addon != NULL) {
+		buffer_image = wl_container_of(addon, buffer_image, addon);
+		pixman_image_t *image = buffer_image->image;
+		if (pixman_image_get_data(image) == data &&
+				pixman_image_get_format(image) == format &&
+				(size_t)pixman_image_get_stride(image) == stride) {
+			renderer->buffer_image_hits++;
+			TRACE_COUNTER("pixman_buffer_image_hits", renderer->buffer_image_hits);
+			return buffer_image;
+		}
+	}
+
+	renderer->buffer_image_misses++;
+	TRACE_COUNTER("pixman_buffer_image_misses", renderer->buffer_image_misses);
+
+	// The entry may be shared with other textures: leave it untouched until
+	// the new image has been created
+	pixman_image_t *image = pixman_image_create_bits_no_clear(format,
+		buffer->width, buffer->height, data, stride);
+	if (image == NULL) {
+		wlr_log(WLR_ERROR, "Failed to create pixman image");
+		return NULL;
+	}
+
+	if (buffer_image != NULL) {
+		// Textures using the old images keep a reference to them
+		pixman_image_unref(buffer_image->image);
+		buffer_image->image = image;
+		// Operations recorded earlier re-create the view when submitted
+		struct wlr_pixman_view *view = buffer_image->view;
+		if (view->image != NULL) {
+			pixman_image_unref(view->image);
+			view->image = NULL;
+		}
+		return buffer_image;
+	}
+
+	buffer_image = calloc(1, sizeof(*buffer_image));
+	if (buffer_image == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		pixman_image_unref(image);
+		return NULL;
+	}
+	buffer_image->view = pixman_view_create();
+	if (buffer_image->view == NULL) {
+		free(buffer_image);
+		pixman_image_unref(image);
+		return NULL;
+	}
+	buffer_image->renderer = renderer;
+	buffer_image->n_refs = 1;
+	buffer_image->attached = true;
+	buffer_image->image = image;
+	wlr_addon_init(&buffer_image->addon, &buffer->addons, renderer,
+		&buffer_image_addon_impl);
+	wl_list_insert(&renderer->buffer_images, &buffer_image->link);
+
+	return buffer_image;
+}
+
 static void texture_destroy(struct wlr_texture *wlr_texture) {
 	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
 	wl_list_remove(&texture->link);
 	pixman_image_unref(texture->image);
+	buffer_image_unref(texture->buffer_image);
 	wlr_buffer_unlock(texture->buffer);
-	free(texture->data);
 	free(texture);
 }
 
@@ -122,7 +270,46 @@ static uint32_t pixman_texture_preferred_read_format(struct wlr_texture *wlr_tex
 	return get_drm_format_from_pixman(pixman_format);
 }
 
+static bool texture_update_from_buffer(struct wlr_texture *wlr_texture,
+		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
+	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+
+	void *data = NULL;
+	uint32_t drm_format;
+	size_t stride;
+	if (!wlr_buffer_begin_data_ptr_access(buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+			&data, &drm_format, &stride)) {
+		return false;
+	}
+	wlr_buffer_end_data_ptr_access(buffer);
+
+	if (get_pixman_format_from_drm(drm_format) != texture->format) {
+		return false;
+	}
+
+	struct wlr_pixman_buffer_image *buffer_image = get_buffer_image(
+		texture->renderer, buffer, data, texture->format, stride);
+	if (buffer_image == NULL) {
+		return false;
+	}
+
+	// Textures read straight from buffer memory, so there is nothing to
+	// copy: re-bind the texture to the new buffer, whatever the damage
+	pixman_image_unref(texture->image);
+	texture->image = pixman_image_ref(buffer_image->image);
+	buffer_image_ref(buffer_image);
+	buffer_image_unref(texture->buffer_image);
+	texture->buffer_image = buffer_image;
+
+	wlr_buffer_lock(buffer);
+	wlr_buffer_unlock(texture->buffer);
+	texture->buffer = buffer;
+
+	return true;
+}
+
 static const struct wlr_texture_impl texture_impl = {
+	.update_from_buffer = texture_update_from_buffer,
 	.read_pixels = texture_read_pixels,
 	.preferred_read_format = pixman_texture_preferred_read_format,
 	.destroy = texture_destroy,
@@ -220,6 +407,7 @@ static struct wlr_pixman_texture *pixman_texture_create(
 
 	wlr_texture_init(&texture->wlr_texture, &renderer->wlr_renderer,
 		&texture_impl, width, height);
+	texture->renderer = renderer;
 
 	texture->format_info = drm_get_pixel_format_info(drm_format);
 	if (!texture->format_info) {
@@ -260,15 +448,16 @@ static struct wlr_texture *pixman_texture_from_buffer(
 		return NULL;
 	}
 
-	texture->image = pixman_image_create_bits_no_clear(texture->format,
-		buffer->width, buffer->height, data, stride);
-	if (!texture->image) {
-		wlr_log(WLR_ERROR, "Failed to create pixman image");
+	struct wlr_pixman_buffer_image *buffer_image = get_buffer_image(renderer,
+		buffer, data, texture->format, stride);
+	if (buffer_image == NULL) {
 		wl_list_remove(&texture->link);
 		free(texture);
 		return NULL;
 	}
 
+	texture->image = pixman_image_ref(buffer_image->image);
+	texture->buffer_image = buffer_image_ref(buffer_image);
 	texture->buffer = wlr_buffer_lock(buffer);
 
 	return &texture->wlr_texture;
@@ -287,11 +476,64 @@ static void pixman_destroy(struct wlr_renderer *wlr_renderer) {
 		wlr_texture_destroy(&tex->wlr_texture);
 	}
 
+	wlr_log(WLR_DEBUG, "Buffer images: %"PRIu64" hits, %"PRIu64" misses",
+		renderer->buffer_image_hits, renderer->buffer_image_misses);
+	struct wlr_pixman_buffer_image *buffer_image, *buffer_image_tmp;
+	wl_list_for_each_safe(buffer_image, buffer_image_tmp,
+			&renderer->buffer_images, link) {
+		buffer_image_detach(buffer_image);
+	}
+
+	for (size_t i = 0; i < WLR_PIXMAN_SOLID_FILL_CACHE_SIZE; i++) {
+		if (renderer->solid_fills[i].image != NULL) {
+			pixman_image_unref(renderer->solid_fills[i].image);
+		}
+	}
+
 	wlr_drm_format_set_finish(&renderer->drm_formats);
+	pixman_worker_pool_destroy(renderer->pool);
 
 	free(renderer);
 }
 
+static const struct wlr_render_timer_impl render_timer_impl;
+
+static struct wlr_pixman_render_timer *get_render_timer(
+		struct wlr_render_timer *wlr_timer) {
+	assert(wlr_timer->impl == &render_timer_impl);
+	struct wlr_pixman_render_timer *timer = wl_container_of(wlr_timer, timer, base);
+	return timer;
+}
+
+static struct wlr_render_timer *pixman_render_timer_create(
+		struct wlr_renderer *wlr_renderer) {
+	struct wlr_pixman_render_timer *timer = calloc(1, sizeof(*timer));
+	if (timer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	timer->base.impl = &render_timer_impl;
+	return &timer->base;
+}
+
+static int pixman_render_timer_get_duration_ns(struct wlr_render_timer *wlr_timer) {
+	struct wlr_pixman_render_timer *timer = get_render_timer(wlr_timer);
+	if (timer->end.tv_sec == 0 && timer->end.tv_nsec == 0) {
+		return -1;
+	}
+	return timespec_to_nsec(&timer->end) - timespec_to_nsec(&timer->start);
+}
+
+static void pixman_render_timer_destroy(struct wlr_render_timer *wlr_timer) {
+	struct wlr_pixman_render_timer *timer = get_render_timer(wlr_timer);
+	free(timer);
+}
+
+static const struct wlr_render_timer_impl render_timer_impl = {
+	.get_duration_ns = pixman_render_timer_get_duration_ns,
+	.destroy = pixman_render_timer_destroy,
+};
+
 static struct wlr_render_pass *pixman_begin_buffer_pass(struct wlr_renderer *wlr_renderer,
 		struct wlr_buffer *wlr_buffer, const struct wlr_buffer_pass_options *options) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
@@ -304,19 +546,39 @@ static struct wlr_render_pass *pixman_begin_buffer_pass(struct wlr_renderer *wlr
 		return NULL;
 	}
 
-	struct wlr_pixman_render_pass *pass = begin_pixman_render_pass(buffer);
+	struct wlr_pixman_render_timer *timer = NULL;
+	if (options->timer != NULL) {
+		timer = get_render_timer(options->timer);
+	}
+
+	struct wlr_pixman_render_pass *pass = begin_pixman_render_pass(buffer, timer);
 	if (pass == NULL) {
 		return NULL;
 	}
 	return &pass->base;
 }
 
+static size_t get_thread_count(void) {
+	long threads = env_parse_uint("WLR_PIXMAN_THREADS", 1);
+	if (threads == 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (threads > MAX_AUTO_THREADS) {
+			threads = MAX_AUTO_THREADS;
+		}
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	return threads;
+}
+
 static const struct wlr_renderer_impl renderer_impl = {
 	.get_texture_formats = pixman_get_texture_formats,
 	.get_render_formats = pixman_get_render_formats,
 	.texture_from_buffer = pixman_texture_from_buffer,
 	.destroy = pixman_destroy,
 	.begin_buffer_pass = pixman_begin_buffer_pass,
+	.render_timer_create = pixman_render_timer_create,
 };
 
 struct wlr_renderer *wlr_pixman_renderer_create(void) {
@@ -330,6 +592,19 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 	renderer->wlr_renderer.features.output_color_transform = false;
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	wl_list_init(&renderer->buffer_images);
+
+	renderer->threads = get_thread_count();
+	if (renderer->threads > 1) {
+		wlr_log(WLR_INFO, "Using %zu threads for pixman rendering",
+			renderer->threads);
+	}
+
+	if (!env_parse_bool("WLR_PIXMAN_NO_FAST_PATHS")) {
+		renderer->fast_path = pixman_fast_path_get_best_impl();
+		wlr_log(WLR_DEBUG, "Using %s pixman fast paths",
+			renderer->fast_path->name);
+	}
 
 	size_t len = 0;
 	const uint32_t *formats = get_pixman_drm_formats(&len);
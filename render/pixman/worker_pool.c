@@ -0,0 +1,138 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
+#include "render/pixman.h"
+
+static void run_jobs(struct wlr_pixman_worker_pool *pool) {
+	while (true) {
+		size_t i = atomic_fetch_add(&pool->next_job, 1);
+		if (i >= pool->jobs_len) {
+			break;
+		}
+		pool->func(pool->data, i);
+	}
+}
+
+static void *worker_main(void *data) {
+	struct wlr_pixman_worker_pool *pool = data;
+
+	// Workers are created before the first batch: don't read the current
+	// generation here, a batch may already have started
+	uint64_t generation = 0;
+	pthread_mutex_lock(&pool->mutex);
+	while (true) {
+		while (!pool->stop && pool->generation == generation) {
+			pthread_cond_wait(&pool->start_cond, &pool->mutex);
+		}
+		if (pool->stop) {
+			break;
+		}
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		run_jobs(pool);
+
+		pthread_mutex_lock(&pool->mutex);
+		assert(pool->running > 0);
+		pool->running--;
+		if (pool->running == 0) {
+			pthread_cond_signal(&pool->done_cond);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+struct wlr_pixman_worker_pool *pixman_worker_pool_create(size_t threads) {
+	assert(threads > 1);
+
+	struct wlr_pixman_worker_pool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	pool->workers = calloc(threads - 1, sizeof(pool->workers[0]));
+	if (pool->workers == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (size_t i = 0; i < threads - 1; i++) {
+		int ret = pthread_create(&pool->workers[i], NULL, worker_main, pool);
+		if (ret != 0) {
+			wlr_log(WLR_ERROR, "Failed to create pixman worker thread: %s",
+				strerror(ret));
+			break;
+		}
+		pool->workers_len++;
+	}
+
+	if (pool->workers_len == 0) {
+		pixman_worker_pool_destroy(pool);
+		return NULL;
+	}
+
+	wlr_log(WLR_DEBUG, "Created pixman worker pool with %zu threads",
+		pool->workers_len + 1);
+	return pool;
+}
+
+void pixman_worker_pool_destroy(struct wlr_pixman_worker_pool *pool) {
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (size_t i = 0; i < pool->workers_len; i++) {
+		pthread_join(pool->workers[i], NULL);
+	}
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->start_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->workers);
+	free(pool);
+}
+
+void pixman_worker_pool_run(struct wlr_pixman_worker_pool *pool,
+		wlr_pixman_job_func_t func, void *data, size_t jobs_len) {
+	if (jobs_len <= 1) {
+		for (size_t i = 0; i < jobs_len; i++) {
+			func(data, i);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	assert(pool->running == 0);
+	pool->func = func;
+	pool->data = data;
+	pool->jobs_len = jobs_len;
+	atomic_store(&pool->next_job, 0);
+	pool->running = pool->workers_len;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	run_jobs(pool);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->running > 0) {
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	}
+	pool->func = NULL;
+	pool->data = NULL;
+	pthread_mutex_unlock(&pool->mutex);
+}
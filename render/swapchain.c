@@ -5,6 +5,13 @@
 #include <wlr/render/swapchain.h>
 #include <wlr/types/wlr_buffer.h>
 #include "render/drm_format_set.h"
+#include "util/time.h"
+
+#define MIN_DEPTH 2
+// Depth the swapchain grows to when frames are missed
+#define MISSED_FRAME_DEPTH 3
+// Time after which buffers which haven't been needed are released
+#define QUIET_PERIOD_MSEC 5000
 
 static void swapchain_handle_allocator_destroy(struct wl_listener *listener,
 		void *data) {
@@ -25,6 +32,7 @@ struct wlr_swapchain *wlr_swapchain_create(
 	swapchain->allocator = alloc;
 	swapchain->width = width;
 	swapchain->height = height;
+	swapchain->depth = MIN_DEPTH;
 
 	if (!wlr_drm_format_copy(&swapchain->format, format)) {
 		free(swapchain);
@@ -77,10 +85,69 @@ static struct wlr_buffer *slot_acquire(struct wlr_swapchain *swapchain,
 	return wlr_buffer_lock(slot->buffer);
 }
 
+static void swapchain_grow(struct wlr_swapchain *swapchain, const char *reason) {
+	assert(swapchain->depth < WLR_SWAPCHAIN_CAP);
+	swapchain->depth++;
+	wlr_log(WLR_DEBUG, "Growing swapchain to %zu buffers: %s",
+		swapchain->depth, reason);
+}
+
+/**
+ * Shrink the swapchain if its extra buffers haven't been needed during the
+ * quiet period, given the number of buffers currently in use.
+ */
+static void swapchain_update_depth(struct wlr_swapchain *swapchain,
+		size_t acquired) {
+	int64_t now = get_current_time_msec();
+
+	// The buffer about to be acquired is the last one left: all of them are
+	// needed
+	if (acquired + 1 >= swapchain->depth) {
+		swapchain->last_pressure_msec = now;
+		return;
+	}
+
+	if (swapchain->depth <= MIN_DEPTH ||
+			now - swapchain->last_pressure_msec < QUIET_PERIOD_MSEC) {
+		return;
+	}
+
+	swapchain->depth--;
+	swapchain->last_pressure_msec = now;
+	wlr_log(WLR_DEBUG, "Shrinking swapchain to %zu buffers: "
+		"extra buffers unused for %d ms", swapchain->depth, QUIET_PERIOD_MSEC);
+
+	size_t buffers = 0;
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+		if (swapchain->slots[i].buffer != NULL) {
+			buffers++;
+		}
+	}
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP && buffers > swapchain->depth; i++) {
+		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
+		if (slot->buffer != NULL && !slot->acquired) {
+			slot_reset(slot);
+			buffers--;
+		}
+	}
+}
+
 struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain) {
+	size_t acquired = 0;
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+		if (swapchain->slots[i].acquired) {
+			acquired++;
+		}
+	}
+	swapchain_update_depth(swapchain, acquired);
+
 	struct wlr_swapchain_slot *free_slot = NULL;
+	size_t buffers = 0;
 	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
 		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
+		if (slot->buffer != NULL) {
+			buffers++;
+		}
 		if (slot->acquired) {
 			continue;
 		}
@@ -94,6 +161,11 @@ struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain) {
 		return NULL;
 	}
 
+	if (buffers >= swapchain->depth) {
+		swapchain_grow(swapchain, "all buffers are busy");
+		swapchain->last_pressure_msec = get_current_time_msec();
+	}
+
 	if (swapchain->allocator == NULL) {
 		return NULL;
 	}
@@ -108,6 +180,47 @@ struct wlr_buffer *wlr_swapchain_acquire(struct wlr_swapchain *swapchain) {
 	return slot_acquire(swapchain, free_slot);
 }
 
+/**
+ * Allocate buffers in empty slots until the swapchain has as many buffers as
+ * its depth, so that they are ready by the time they are needed.
+ */
+static void swapchain_fill(struct wlr_swapchain *swapchain) {
+	if (swapchain->allocator == NULL) {
+		return;
+	}
+
+	size_t buffers = 0;
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
+		if (swapchain->slots[i].buffer != NULL) {
+			buffers++;
+		}
+	}
+	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP && buffers < swapchain->depth; i++) {
+		struct wlr_swapchain_slot *slot = &swapchain->slots[i];
+		if (slot->buffer != NULL) {
+			continue;
+		}
+
+		wlr_log(WLR_DEBUG, "Allocating new swapchain buffer");
+		slot->buffer = wlr_allocator_create_buffer(swapchain->allocator,
+			swapchain->width, swapchain->height, &swapchain->format);
+		if (slot->buffer == NULL) {
+			// wlr_swapchain_acquire() will try again when the buffer is needed
+			wlr_log(WLR_ERROR, "Failed to allocate buffer");
+			return;
+		}
+		buffers++;
+	}
+}
+
+void wlr_swapchain_report_missed_frame(struct wlr_swapchain *swapchain) {
+	swapchain->last_pressure_msec = get_current_time_msec();
+	if (swapchain->depth < MISSED_FRAME_DEPTH) {
+		swapchain_grow(swapchain, "frame missed");
+		swapchain_fill(swapchain);
+	}
+}
+
 bool wlr_swapchain_has_buffer(struct wlr_swapchain *swapchain,
 		struct wlr_buffer *buffer) {
 	for (size_t i = 0; i < WLR_SWAPCHAIN_CAP; i++) {
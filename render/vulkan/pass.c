@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <wlr/util/log.h>
 #include <wlr/render/color.h>
@@ -9,6 +11,7 @@
 #include "render/color.h"
 #include "render/vulkan.h"
 #include "types/wlr_matrix.h"
+#include "util/trace.h"
 
 static const struct wlr_render_pass_impl render_pass_impl;
 static const struct wlr_addon_interface vk_color_transform_impl;
@@ -91,9 +94,109 @@ static void render_pass_destroy(struct wlr_vk_render_pass *pass) {
 	wlr_drm_syncobj_timeline_unref(pass->signal_timeline);
 	rect_union_finish(&pass->updated_region);
 	wl_array_release(&pass->textures);
+	wl_array_release(&pass->batch.instances);
 	free(pass);
 }
 
+static void render_pass_flush_batch(struct wlr_vk_render_pass *pass) {
+	size_t size = pass->batch.instances.size;
+	if (size == 0) {
+		return;
+	}
+	pass->batch.instances.size = 0;
+
+	VkCommandBuffer cb = pass->command_buffer->vk;
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	void *data;
+	if (!vulkan_command_buffer_alloc_instances(pass->renderer,
+			pass->command_buffer, size, &buffer, &offset, &data)) {
+		wlr_log(WLR_ERROR, "Failed to allocate instance buffer");
+		pass->failed = true;
+		return;
+	}
+	memcpy(data, pass->batch.instances.data, size);
+
+	const struct wlr_vk_pipeline *pipe = pass->batch.pipe;
+	bind_pipeline(pass, pipe->vk);
+	if (pass->batch.ds != VK_NULL_HANDLE) {
+		vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			pipe->layout->vk, 0, 1, &pass->batch.ds, 0, NULL);
+	}
+	vkCmdPushConstants(cb, pipe->layout->vk, VK_SHADER_STAGE_FRAGMENT_BIT,
+		sizeof(struct wlr_vk_vert_pcr_data), pass->batch.frag_pcr_size,
+		pass->batch.frag_pcr);
+
+	// Instances are clipped in the vertex shader
+	struct wlr_buffer *wlr_buffer = pass->render_buffer->wlr_buffer;
+	VkRect2D rect = { .extent = { wlr_buffer->width, wlr_buffer->height } };
+	vkCmdSetScissor(cb, 0, 1, &rect);
+
+	vkCmdBindVertexBuffers(cb, 0, 1, &buffer, &offset);
+	vkCmdDraw(cb, 4, size / sizeof(struct wlr_vk_instance_data), 0, 0);
+	pass->draws++;
+}
+
+// Adds one instance per clip rectangle to the pending batch, flushing it
+// first if it doesn't share the pipeline, descriptor set and fragment push
+// constants of the quad.
+static void render_pass_batch_quad(struct wlr_vk_render_pass *pass,
+		const struct wlr_vk_pipeline *pipe, VkDescriptorSet ds,
+		const float *frag_pcr, uint32_t frag_pcr_size,
+		const struct wlr_vk_vert_pcr_data *vert_pcr_data,
+		const struct wlr_box *box, const pixman_box32_t *clip_rects,
+		int clip_rects_len) {
+	assert(frag_pcr_size <= sizeof(pass->batch.frag_pcr));
+	if (pass->batch.pipe != pipe || pass->batch.ds != ds ||
+			pass->batch.frag_pcr_size != frag_pcr_size ||
+			memcmp(pass->batch.frag_pcr, frag_pcr, frag_pcr_size) != 0) {
+		render_pass_flush_batch(pass);
+		pass->batch.pipe = pipe;
+		pass->batch.ds = ds;
+		pass->batch.frag_pcr_size = frag_pcr_size;
+		memcpy(pass->batch.frag_pcr, frag_pcr, frag_pcr_size);
+	}
+
+	const float *proj = pass->projection;
+	for (int i = 0; i < clip_rects_len; i++) {
+		struct wlr_box clip_box = {
+			.x = clip_rects[i].x1,
+			.y = clip_rects[i].y1,
+			.width = clip_rects[i].x2 - clip_rects[i].x1,
+			.height = clip_rects[i].y2 - clip_rects[i].y1,
+		};
+		struct wlr_box intersection;
+		if (!wlr_box_intersection(&intersection, box, &clip_box)) {
+			continue;
+		}
+
+		struct wlr_vk_instance_data *instance =
+			wl_array_add(&pass->batch.instances, sizeof(*instance));
+		if (instance == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			pass->failed = true;
+			return;
+		}
+
+		float x1 = intersection.x, y1 = intersection.y;
+		float x2 = x1 + intersection.width, y2 = y1 + intersection.height;
+		float clip_x1 = proj[0] * x1 + proj[1] * y1 + proj[2];
+		float clip_y1 = proj[3] * x1 + proj[4] * y1 + proj[5];
+		float clip_x2 = proj[0] * x2 + proj[1] * y2 + proj[2];
+		float clip_y2 = proj[3] * x2 + proj[4] * y2 + proj[5];
+
+		*instance = (struct wlr_vk_instance_data){
+			.uv_off = { vert_pcr_data->uv_off[0], vert_pcr_data->uv_off[1] },
+			.uv_size = { vert_pcr_data->uv_size[0], vert_pcr_data->uv_size[1] },
+			.clip = {
+				fminf(clip_x1, clip_x2), fminf(clip_y1, clip_y2),
+				fmaxf(clip_x1, clip_x2), fmaxf(clip_y1, clip_y2),
+			},
+		};
+		memcpy(instance->proj, vert_pcr_data->mat4, sizeof(instance->proj));
+	}
+}
+
 static VkSemaphore render_pass_wait_sync_file(struct wlr_vk_render_pass *pass,
 		size_t sem_index, int sync_file_fd) {
 	struct wlr_vk_renderer *renderer = pass->renderer;
@@ -150,6 +253,8 @@ static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 	VkSemaphoreSubmitInfoKHR *render_wait = NULL;
 	bool device_lost = false;
 
+	render_pass_flush_batch(pass);
+
 	if (pass->failed) {
 		goto error;
 	}
@@ -529,20 +634,18 @@ static bool render_pass_submit(struct wlr_render_pass *wlr_pass) {
 
 	free(render_wait);
 
-	struct wlr_vk_shared_buffer *stage_buf, *stage_buf_tmp;
-	wl_list_for_each_safe(stage_buf, stage_buf_tmp, &renderer->stage.buffers, link) {
-		if (stage_buf->allocs.size == 0) {
-			continue;
-		}
-		wl_list_remove(&stage_buf->link);
-		wl_list_insert(&stage_cb->stage_buffers, &stage_buf->link);
-	}
+	vulkan_stage_mark_submitted(renderer, stage_timeline_point);
 
 	if (!vulkan_sync_render_buffer(renderer, render_buffer, render_cb,
 			pass->signal_timeline, pass->signal_point)) {
 		wlr_log(WLR_ERROR, "Failed to sync render buffer");
 	}
 
+	renderer->draws += pass->draws;
+	renderer->elements += pass->elements;
+	TRACE_COUNTER("vulkan_draws", pass->draws);
+	TRACE_COUNTER("vulkan_elements", pass->elements);
+
 	render_pass_destroy(pass);
 	wlr_buffer_unlock(render_buffer->wlr_buffer);
 	return true;
@@ -631,6 +734,7 @@ static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 			&(struct wlr_vk_pipeline_key) {
 				.source = WLR_VK_SHADER_SOURCE_SINGLE_COLOR,
 				.layout = { .ycbcr_format = NULL },
+				.instanced = pass->renderer->batching,
 			});
 		if (!pipe) {
 			pass->failed = true;
@@ -643,6 +747,13 @@ static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 		};
 		mat3_to_mat4(matrix, vert_pcr_data.mat4);
 
+		if (pass->renderer->batching) {
+			render_pass_batch_quad(pass, pipe, VK_NULL_HANDLE,
+				linear_color, sizeof(linear_color), &vert_pcr_data, &box,
+				clip_rects, clip_rects_len);
+			break;
+		}
+
 		bind_pipeline(pass, pipe->vk);
 		vkCmdPushConstants(cb, pipe->layout->vk,
 			VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(vert_pcr_data), &vert_pcr_data);
@@ -655,9 +766,13 @@ static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 			convert_pixman_box_to_vk_rect(&clip_rects[i], &rect);
 			vkCmdSetScissor(cb, 0, 1, &rect);
 			vkCmdDraw(cb, 4, 1, 0, 0);
+			pass->draws++;
 		}
 		break;
 	case WLR_RENDER_BLEND_MODE_NONE:;
+		// Clears aren't batched, keep them ordered with the batched draws
+		render_pass_flush_batch(pass);
+
 		VkClearAttachment clear_att = {
 			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 			.colorAttachment = 0,
@@ -674,10 +789,12 @@ static void render_pass_add_rect(struct wlr_render_pass *wlr_pass,
 		for (int i = 0; i < clip_rects_len; i++) {
 			convert_pixman_box_to_vk_rect(&clip_rects[i], &clear_rect.rect);
 			vkCmdClearAttachments(cb, 1, &clear_att, 1, &clear_rect);
+			pass->draws++;
 		}
 		break;
 	}
 
+	pass->elements++;
 	pixman_region32_fini(&clip);
 }
 
@@ -740,6 +857,7 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 			.texture_transform = texture->transform,
 			.blend_mode = !texture->has_alpha && alpha == 1.0 ?
 				WLR_RENDER_BLEND_MODE_NONE : options->blend_mode,
+			.instanced = renderer->batching,
 		});
 	if (!pipe) {
 		pass->failed = true;
@@ -753,28 +871,38 @@ static void render_pass_add_texture(struct wlr_render_pass *wlr_pass,
 		return;
 	}
 
-	bind_pipeline(pass, pipe->vk);
-
-	vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
-		pipe->layout->vk, 0, 1, &view->ds, 0, NULL);
-
-	vkCmdPushConstants(cb, pipe->layout->vk,
-		VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(vert_pcr_data), &vert_pcr_data);
-	vkCmdPushConstants(cb, pipe->layout->vk,
-		VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(vert_pcr_data), sizeof(float),
-		&alpha);
-
 	pixman_region32_t clip;
 	get_clip_region(pass, options->clip, &clip);
 
 	int clip_rects_len;
 	const pixman_box32_t *clip_rects = pixman_region32_rectangles(&clip, &clip_rects_len);
-	for (int i = 0; i < clip_rects_len; i++) {
-		VkRect2D rect;
-		convert_pixman_box_to_vk_rect(&clip_rects[i], &rect);
-		vkCmdSetScissor(cb, 0, 1, &rect);
-		vkCmdDraw(cb, 4, 1, 0, 0);
 
+	if (renderer->batching) {
+		render_pass_batch_quad(pass, pipe, view->ds, &alpha, sizeof(alpha),
+			&vert_pcr_data, &dst_box, clip_rects, clip_rects_len);
+	} else {
+		bind_pipeline(pass, pipe->vk);
+
+		vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			pipe->layout->vk, 0, 1, &view->ds, 0, NULL);
+
+		vkCmdPushConstants(cb, pipe->layout->vk,
+			VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(vert_pcr_data), &vert_pcr_data);
+		vkCmdPushConstants(cb, pipe->layout->vk,
+			VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(vert_pcr_data), sizeof(float),
+			&alpha);
+
+		for (int i = 0; i < clip_rects_len; i++) {
+			VkRect2D rect;
+			convert_pixman_box_to_vk_rect(&clip_rects[i], &rect);
+			vkCmdSetScissor(cb, 0, 1, &rect);
+			vkCmdDraw(cb, 4, 1, 0, 0);
+			pass->draws++;
+		}
+	}
+	pass->elements++;
+
+	for (int i = 0; i < clip_rects_len; i++) {
 		struct wlr_box clip_box = {
 			.x = clip_rects[i].x1,
 			.y = clip_rects[i].y1,
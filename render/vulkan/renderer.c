@@ -1,9 +1,11 @@
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <math.h>
 #include <poll.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <drm_fourcc.h>
@@ -23,15 +25,17 @@
 #include "render/pixel_format.h"
 #include "render/vulkan.h"
 #include "render/vulkan/shaders/common.vert.h"
+#include "render/vulkan/shaders/instanced.vert.h"
 #include "render/vulkan/shaders/texture.frag.h"
 #include "render/vulkan/shaders/quad.frag.h"
 #include "render/vulkan/shaders/output.frag.h"
 #include "types/wlr_buffer.h"
 #include "types/wlr_matrix.h"
+#include "util/env.h"
 #include "util/time.h"
+#include "util/trace.h"
 
 // TODO:
-// - simplify stage allocation, don't track allocations but use ringbuffer-like
 // - use a pipeline cache (not sure when to save though, after every pipeline
 //   creation?)
 // - create pipelines as derivatives of each other
@@ -41,6 +45,7 @@
 //   might still be a good idea.
 
 static const VkDeviceSize min_stage_size = 1024 * 1024; // 1MB
+static const VkDeviceSize min_instance_buffer_size = 64 * 1024; // 64KB
 static const VkDeviceSize max_stage_size = 256 * min_stage_size; // 256MB
 static const size_t start_descriptor_pool_size = 256u;
 static bool default_debug = true;
@@ -171,17 +176,44 @@ static void destroy_render_format_setup(struct wlr_vk_renderer *renderer,
 	free(setup);
 }
 
+static VkDeviceSize shared_buffer_used(const struct wlr_vk_shared_buffer *buffer) {
+	if (buffer->allocs.size == 0) {
+		return 0;
+	} else if (buffer->head > buffer->tail) {
+		return buffer->head - buffer->tail;
+	} else {
+		// Wrapped around, or full if head == tail
+		return buffer->buf_size - buffer->tail + buffer->head;
+	}
+}
+
+static void update_stage_stats(struct wlr_vk_renderer *r) {
+	VkDeviceSize used = 0, size = 0;
+	struct wlr_vk_shared_buffer *buf;
+	wl_list_for_each(buf, &r->stage.buffers, link) {
+		used += shared_buffer_used(buf);
+		size += buf->buf_size;
+	}
+
+	r->stage.used = used;
+	r->stage.size = size;
+	if (used > r->stage.peak_used) {
+		r->stage.peak_used = used;
+	}
+	if (size > r->stage.peak_size) {
+		r->stage.peak_size = size;
+	}
+
+	TRACE_COUNTER("vulkan_stage_used", (int64_t)used);
+	TRACE_COUNTER("vulkan_stage_size", (int64_t)size);
+}
+
 static void shared_buffer_destroy(struct wlr_vk_renderer *r,
 		struct wlr_vk_shared_buffer *buffer) {
 	if (!buffer) {
 		return;
 	}
 
-	if (buffer->allocs.size > 0) {
-		wlr_log(WLR_ERROR, "shared_buffer_finish: %zu allocations left",
-			buffer->allocs.size / sizeof(struct wlr_vk_allocation));
-	}
-
 	wl_array_release(&buffer->allocs);
 	if (buffer->cpu_mapping) {
 		vkUnmapMemory(r->dev->dev, buffer->memory);
@@ -198,44 +230,128 @@ static void shared_buffer_destroy(struct wlr_vk_renderer *r,
 	free(buffer);
 }
 
-struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
-		VkDeviceSize size, VkDeviceSize alignment) {
-	// try to find free span
-	// simple greedy allocation algorithm - should be enough for this usecase
-	// since all allocations are freed together after the frame
-	struct wlr_vk_shared_buffer *buf;
-	wl_list_for_each_reverse(buf, &r->stage.buffers, link) {
-		VkDeviceSize start = 0u;
-		if (buf->allocs.size > 0) {
-			const struct wlr_vk_allocation *allocs = buf->allocs.data;
-			size_t allocs_len = buf->allocs.size / sizeof(struct wlr_vk_allocation);
-			const struct wlr_vk_allocation *last = &allocs[allocs_len - 1];
-			start = last->start + last->size;
+// Allocates a span at the head of the ring, wrapping around to the start of
+// the buffer if the end is too short
+static struct wlr_vk_allocation *shared_buffer_alloc(
+		struct wlr_vk_shared_buffer *buf, VkDeviceSize size,
+		VkDeviceSize alignment) {
+	if (buf->allocs.size == 0) {
+		buf->head = buf->tail = 0;
+	}
+
+	// ensure the proposed start is a multiple of alignment
+	VkDeviceSize start = buf->head;
+	start += alignment - 1 - ((start + alignment - 1) % alignment);
+
+	if (buf->allocs.size == 0 || buf->head > buf->tail) {
+		// Free space is after the head and before the tail
+		if (start > buf->buf_size || buf->buf_size - start < size) {
+			if (buf->allocs.size == 0 || size > buf->tail) {
+				return NULL;
+			}
+			start = 0;
 		}
+	} else if (start > buf->tail || buf->tail - start < size) {
+		// Free space is between the head and the tail
+		return NULL;
+	}
 
-		assert(start <= buf->buf_size);
+	struct wlr_vk_allocation *a = wl_array_add(&buf->allocs, sizeof(*a));
+	if (a == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
 
-		// ensure the proposed start is a multiple of alignment
-		start += alignment - 1 - ((start + alignment - 1) % alignment);
+	*a = (struct wlr_vk_allocation){
+		.start = start,
+		.size = size,
+	};
+	buf->head = start + size;
+	return a;
+}
 
-		if (buf->buf_size - start < size) {
+// Releases the allocations of the stage cbs which have completed
+static void stage_release(struct wlr_vk_renderer *r, uint64_t current_point,
+		int64_t now) {
+	struct wlr_vk_shared_buffer *buf;
+	wl_list_for_each(buf, &r->stage.buffers, link) {
+		struct wlr_vk_allocation *allocs = buf->allocs.data;
+		size_t allocs_len = buf->allocs.size / sizeof(*allocs);
+		size_t released = 0;
+		while (released < allocs_len &&
+				allocs[released].timeline_point != 0 &&
+				allocs[released].timeline_point <= current_point) {
+			buf->tail = allocs[released].start + allocs[released].size;
+			released++;
+		}
+		if (released == 0) {
 			continue;
 		}
 
-		struct wlr_vk_allocation *a = wl_array_add(&buf->allocs, sizeof(*a));
-		if (a == NULL) {
-			wlr_log_errno(WLR_ERROR, "Allocation failed");
-			goto error_alloc;
+		memmove(allocs, &allocs[released],
+			(allocs_len - released) * sizeof(*allocs));
+		buf->allocs.size -= released * sizeof(*allocs);
+		if (buf->allocs.size == 0) {
+			buf->head = buf->tail = 0;
+			buf->last_used_ms = now;
 		}
+	}
 
-		*a = (struct wlr_vk_allocation){
-			.start = start,
-			.size = size,
-		};
-		return (struct wlr_vk_buffer_span) {
+	update_stage_stats(r);
+}
+
+void vulkan_stage_mark_submitted(struct wlr_vk_renderer *r,
+		uint64_t timeline_point) {
+	struct wlr_vk_shared_buffer *buf;
+	wl_list_for_each(buf, &r->stage.buffers, link) {
+		// Unsubmitted allocations are the most recent ones
+		struct wlr_vk_allocation *allocs = buf->allocs.data;
+		size_t allocs_len = buf->allocs.size / sizeof(*allocs);
+		for (size_t i = allocs_len; i > 0 && allocs[i - 1].timeline_point == 0; i--) {
+			allocs[i - 1].timeline_point = timeline_point;
+		}
+	}
+}
+
+static struct wlr_vk_allocation *stage_alloc(struct wlr_vk_renderer *r,
+		VkDeviceSize size, VkDeviceSize alignment,
+		struct wlr_vk_shared_buffer **out_buf) {
+	struct wlr_vk_shared_buffer *buf;
+	wl_list_for_each_reverse(buf, &r->stage.buffers, link) {
+		struct wlr_vk_allocation *a = shared_buffer_alloc(buf, size, alignment);
+		if (a != NULL) {
+			*out_buf = buf;
+			return a;
+		}
+	}
+	return NULL;
+}
+
+struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
+		VkDeviceSize size, VkDeviceSize alignment) {
+	// Stage buffers are rings, so the first one with enough space at its
+	// head is good. If none has, try again after releasing the spans of the
+	// stage cbs which have completed in the meantime.
+	struct wlr_vk_shared_buffer *buf = NULL;
+	struct wlr_vk_allocation *a = stage_alloc(r, size, alignment, &buf);
+	if (a == NULL && !wl_list_empty(&r->stage.buffers)) {
+		uint64_t current_point;
+		VkResult res = r->dev->api.vkGetSemaphoreCounterValueKHR(r->dev->dev,
+			r->timeline_semaphore, &current_point);
+		if (res == VK_SUCCESS) {
+			stage_release(r, current_point, get_current_time_msec());
+			a = stage_alloc(r, size, alignment, &buf);
+		} else {
+			wlr_vk_error("vkGetSemaphoreCounterValueKHR", res);
+		}
+	}
+	if (a != NULL) {
+		struct wlr_vk_buffer_span span = {
 			.buffer = buf,
 			.alloc = *a,
 		};
+		update_stage_stats(r);
+		return span;
 	}
 
 	if (size > max_stage_size) {
@@ -319,19 +435,15 @@ struct wlr_vk_buffer_span vulkan_get_stage_span(struct wlr_vk_renderer *r,
 		goto error;
 	}
 
-	struct wlr_vk_allocation *a = wl_array_add(&buf->allocs, sizeof(*a));
+	buf->buf_size = bsize;
+	a = shared_buffer_alloc(buf, size, alignment);
 	if (a == NULL) {
-		wlr_log_errno(WLR_ERROR, "Allocation failed");
 		goto error;
 	}
 
-	buf->buf_size = bsize;
 	wl_list_insert(&r->stage.buffers, &buf->link);
+	update_stage_stats(r);
 
-	*a = (struct wlr_vk_allocation){
-		.start = 0,
-		.size = size,
-	};
 	return (struct wlr_vk_buffer_span) {
 		.buffer = buf,
 		.alloc = *a,
@@ -347,6 +459,123 @@ error_alloc:
 	};
 }
 
+static void instance_buffer_finish(struct wlr_vk_renderer *r,
+		struct wlr_vk_instance_buffer *buffer) {
+	if (buffer->cpu_mapping) {
+		vkUnmapMemory(r->dev->dev, buffer->memory);
+	}
+	if (buffer->buffer) {
+		vkDestroyBuffer(r->dev->dev, buffer->buffer, NULL);
+	}
+	if (buffer->memory) {
+		vkFreeMemory(r->dev->dev, buffer->memory, NULL);
+	}
+	*buffer = (struct wlr_vk_instance_buffer){0};
+}
+
+static bool instance_buffer_init(struct wlr_vk_renderer *r,
+		struct wlr_vk_instance_buffer *buffer, VkDeviceSize size) {
+	*buffer = (struct wlr_vk_instance_buffer){0};
+
+	VkResult res;
+	VkBufferCreateInfo buf_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+	res = vkCreateBuffer(r->dev->dev, &buf_info, NULL, &buffer->buffer);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkCreateBuffer", res);
+		goto error;
+	}
+
+	VkMemoryRequirements mem_reqs;
+	vkGetBufferMemoryRequirements(r->dev->dev, buffer->buffer, &mem_reqs);
+
+	int mem_type_index = vulkan_find_mem_type(r->dev,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mem_reqs.memoryTypeBits);
+	if (mem_type_index < 0) {
+		wlr_log(WLR_ERROR, "Failed to find memory type");
+		goto error;
+	}
+
+	VkMemoryAllocateInfo mem_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = mem_reqs.size,
+		.memoryTypeIndex = (uint32_t)mem_type_index,
+	};
+	res = vkAllocateMemory(r->dev->dev, &mem_info, NULL, &buffer->memory);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkAllocateMemory", res);
+		goto error;
+	}
+
+	res = vkBindBufferMemory(r->dev->dev, buffer->buffer, buffer->memory, 0);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkBindBufferMemory", res);
+		goto error;
+	}
+
+	res = vkMapMemory(r->dev->dev, buffer->memory, 0, VK_WHOLE_SIZE, 0,
+		&buffer->cpu_mapping);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkMapMemory", res);
+		goto error;
+	}
+
+	buffer->size = size;
+	return true;
+
+error:
+	instance_buffer_finish(r, buffer);
+	return false;
+}
+
+bool vulkan_command_buffer_alloc_instances(struct wlr_vk_renderer *renderer,
+		struct wlr_vk_command_buffer *cb, VkDeviceSize size,
+		VkBuffer *buffer, VkDeviceSize *offset, void **data) {
+	assert(cb->recording);
+
+	if (cb->instances.size - cb->instances_used < size) {
+		// Draws recorded so far still use the current buffer, keep it
+		// until the command buffer completes
+		VkDeviceSize new_size = cb->instances.size * 2;
+		if (new_size < min_instance_buffer_size) {
+			new_size = min_instance_buffer_size;
+		}
+		while (new_size < size) {
+			new_size *= 2;
+		}
+
+		struct wlr_vk_instance_buffer new_buffer;
+		if (!instance_buffer_init(renderer, &new_buffer, new_size)) {
+			return false;
+		}
+
+		if (cb->instances.buffer != VK_NULL_HANDLE) {
+			struct wlr_vk_instance_buffer *retired =
+				wl_array_add(&cb->retired_instances, sizeof(*retired));
+			if (retired == NULL) {
+				wlr_log_errno(WLR_ERROR, "Allocation failed");
+				instance_buffer_finish(renderer, &new_buffer);
+				return false;
+			}
+			*retired = cb->instances;
+		}
+
+		cb->instances = new_buffer;
+		cb->instances_used = 0;
+	}
+
+	*buffer = cb->instances.buffer;
+	*offset = cb->instances_used;
+	*data = (char *)cb->instances.cpu_mapping + cb->instances_used;
+	cb->instances_used += size;
+	return true;
+}
+
 VkCommandBuffer vulkan_record_stage_cb(struct wlr_vk_renderer *renderer) {
 	if (renderer->stage.cb == NULL) {
 		renderer->stage.cb = vulkan_acquire_command_buffer(renderer);
@@ -397,6 +626,7 @@ bool vulkan_submit_stage_wait(struct wlr_vk_renderer *renderer) {
 
 	// NOTE: don't release stage allocations here since they may still be
 	// used for reading. Will be done next frame.
+	vulkan_stage_mark_submitted(renderer, timeline_point);
 
 	return vulkan_wait_command_buffer(cb, renderer);
 }
@@ -432,7 +662,7 @@ static bool init_command_buffer(struct wlr_vk_command_buffer *cb,
 		.vk = vk_cb,
 	};
 	wl_list_init(&cb->destroy_textures);
-	wl_list_init(&cb->stage_buffers);
+	wl_array_init(&cb->retired_instances);
 	return true;
 }
 
@@ -458,7 +688,7 @@ bool vulkan_wait_command_buffer(struct wlr_vk_command_buffer *cb,
 }
 
 static void release_command_buffer_resources(struct wlr_vk_command_buffer *cb,
-		struct wlr_vk_renderer *renderer, int64_t now) {
+		struct wlr_vk_renderer *renderer) {
 	struct wlr_vk_texture *texture, *texture_tmp;
 	wl_list_for_each_safe(texture, texture_tmp, &cb->destroy_textures, destroy_link) {
 		wl_list_remove(&texture->destroy_link);
@@ -466,19 +696,16 @@ static void release_command_buffer_resources(struct wlr_vk_command_buffer *cb,
 		wlr_texture_destroy(&texture->wlr_texture);
 	}
 
-	struct wlr_vk_shared_buffer *buf, *buf_tmp;
-	wl_list_for_each_safe(buf, buf_tmp, &cb->stage_buffers, link) {
-		buf->allocs.size = 0;
-		buf->last_used_ms = now;
-
-		wl_list_remove(&buf->link);
-		wl_list_insert(&renderer->stage.buffers, &buf->link);
-	}
-
 	if (cb->color_transform) {
 		wlr_color_transform_unref(cb->color_transform);
 		cb->color_transform = NULL;
 	}
+
+	struct wlr_vk_instance_buffer *instances;
+	wl_array_for_each(instances, &cb->retired_instances) {
+		instance_buffer_finish(renderer, instances);
+	}
+	cb->retired_instances.size = 0;
 }
 
 static struct wlr_vk_command_buffer *get_command_buffer(
@@ -494,12 +721,15 @@ static struct wlr_vk_command_buffer *get_command_buffer(
 	}
 
 
-	// Garbage collect any buffers that have remained unused for too long
 	int64_t now = get_current_time_msec();
+	stage_release(renderer, current_point, now);
+
+	// Garbage collect any buffers that have remained unused for too long
 	struct wlr_vk_shared_buffer *buf, *buf_tmp;
 	wl_list_for_each_safe(buf, buf_tmp, &renderer->stage.buffers, link) {
 		if (buf->allocs.size == 0 && buf->last_used_ms + 10000 < now) {
 			shared_buffer_destroy(renderer, buf);
+			update_stage_stats(renderer);
 		}
 	}
 
@@ -508,7 +738,7 @@ static struct wlr_vk_command_buffer *get_command_buffer(
 		struct wlr_vk_command_buffer *cb = &renderer->command_buffers[i];
 		if (cb->vk != VK_NULL_HANDLE && !cb->recording &&
 				cb->timeline_point <= current_point) {
-			release_command_buffer_resources(cb, renderer, now);
+			release_command_buffer_resources(cb, renderer);
 		}
 	}
 
@@ -557,6 +787,7 @@ struct wlr_vk_command_buffer *vulkan_acquire_command_buffer(
 
 	assert(!cb->recording);
 	cb->recording = true;
+	cb->instances_used = 0;
 
 	return cb;
 }
@@ -1068,7 +1299,9 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 		if (cb->vk == VK_NULL_HANDLE) {
 			continue;
 		}
-		release_command_buffer_resources(cb, renderer, 0);
+		release_command_buffer_resources(cb, renderer);
+		instance_buffer_finish(renderer, &cb->instances);
+		wl_array_release(&cb->retired_instances);
 		if (cb->binary_semaphore != VK_NULL_HANDLE) {
 			vkDestroySemaphore(renderer->dev->dev, cb->binary_semaphore, NULL);
 		}
@@ -1079,6 +1312,12 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 		wl_array_release(&cb->wait_semaphores);
 	}
 
+	wlr_log(WLR_DEBUG, "Vulkan stage buffers: peak usage %zu bytes, "
+		"peak size %zu bytes", (size_t)renderer->stage.peak_used,
+		(size_t)renderer->stage.peak_size);
+	wlr_log(WLR_DEBUG, "Vulkan render passes: %" PRIu64 " draws "
+		"for %" PRIu64 " elements", renderer->draws, renderer->elements);
+
 	// stage.cb automatically freed with command pool
 	struct wlr_vk_shared_buffer *buf, *tmp_buf;
 	wl_list_for_each_safe(buf, tmp_buf, &renderer->stage.buffers, link) {
@@ -1119,6 +1358,7 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 	}
 
 	vkDestroyShaderModule(dev->dev, renderer->vert_module, NULL);
+	vkDestroyShaderModule(dev->dev, renderer->instanced_vert_module, NULL);
 	vkDestroyShaderModule(dev->dev, renderer->tex_frag_module, NULL);
 	vkDestroyShaderModule(dev->dev, renderer->quad_frag_module, NULL);
 	vkDestroyShaderModule(dev->dev, renderer->output_module, NULL);
@@ -1628,6 +1868,10 @@ static bool pipeline_key_equals(const struct wlr_vk_pipeline_key *a,
 		return false;
 	}
 
+	if (a->instanced != b->instanced) {
+		return false;
+	}
+
 	return true;
 }
 
@@ -1682,7 +1926,8 @@ struct wlr_vk_pipeline *setup_get_or_create_pipeline(
 	stages[0] = (VkPipelineShaderStageCreateInfo) {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 		.stage = VK_SHADER_STAGE_VERTEX_BIT,
-		.module = renderer->vert_module,
+		.module = key->instanced ?
+			renderer->instanced_vert_module : renderer->vert_module,
 		.pName = "main",
 	};
 
@@ -1766,6 +2011,27 @@ struct wlr_vk_pipeline *setup_get_or_create_pipeline(
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
 	};
 
+	VkVertexInputBindingDescription instance_binding = {
+		.binding = 0,
+		.stride = sizeof(struct wlr_vk_instance_data),
+		.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+	};
+	VkVertexInputAttributeDescription instance_attribs[4];
+	for (uint32_t i = 0; i < 4; i++) {
+		instance_attribs[i] = (VkVertexInputAttributeDescription){
+			.location = i,
+			.binding = 0,
+			.format = VK_FORMAT_R32G32B32A32_SFLOAT,
+			.offset = i * 4 * sizeof(float),
+		};
+	}
+	if (key->instanced) {
+		vertex.vertexBindingDescriptionCount = 1;
+		vertex.pVertexBindingDescriptions = &instance_binding;
+		vertex.vertexAttributeDescriptionCount = 4;
+		vertex.pVertexAttributeDescriptions = instance_attribs;
+	}
+
 	VkGraphicsPipelineCreateInfo pinfo = {
 		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
 		.layout = pipeline_layout->vk,
@@ -2120,6 +2386,17 @@ static bool init_static_render_data(struct wlr_vk_renderer *renderer) {
 		return false;
 	}
 
+	sinfo = (VkShaderModuleCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.codeSize = sizeof(instanced_vert_data),
+		.pCode = instanced_vert_data,
+	};
+	res = vkCreateShaderModule(dev, &sinfo, NULL, &renderer->instanced_vert_module);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("Failed to create instanced vertex shader module", res);
+		return false;
+	}
+
 	sinfo = (VkShaderModuleCreateInfo){
 		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
 		.codeSize = sizeof(texture_frag_data),
@@ -2375,6 +2652,7 @@ static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 	if (!setup_get_or_create_pipeline(setup, &(struct wlr_vk_pipeline_key){
 		.source = WLR_VK_SHADER_SOURCE_SINGLE_COLOR,
 		.layout = { .ycbcr_format = NULL },
+		.instanced = renderer->batching,
 	})) {
 		goto error;
 	}
@@ -2383,6 +2661,7 @@ static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 		.source = WLR_VK_SHADER_SOURCE_TEXTURE,
 		.texture_transform = WLR_VK_TEXTURE_TRANSFORM_IDENTITY,
 		.layout = {.ycbcr_format = NULL },
+		.instanced = renderer->batching,
 	})) {
 		goto error;
 	}
@@ -2391,6 +2670,7 @@ static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 		.source = WLR_VK_SHADER_SOURCE_TEXTURE,
 		.texture_transform = WLR_VK_TEXTURE_TRANSFORM_SRGB,
 		.layout = {.ycbcr_format = NULL },
+		.instanced = renderer->batching,
 	})) {
 		goto error;
 	}
@@ -2404,7 +2684,8 @@ static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 		if (format->is_ycbcr) {
 			if (!setup_get_or_create_pipeline(setup, &(struct wlr_vk_pipeline_key){
 				.texture_transform = WLR_VK_TEXTURE_TRANSFORM_SRGB,
-				.layout = layout
+				.layout = layout,
+				.instanced = renderer->batching,
 			})) {
 				goto error;
 			}
@@ -2439,6 +2720,7 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 	wl_list_init(&renderer->render_buffers);
 	wl_list_init(&renderer->color_transforms);
 	wl_list_init(&renderer->pipeline_layouts);
+	renderer->batching = !env_parse_bool("WLR_VK_NO_BATCHING");
 
 	uint64_t cap_syncobj_timeline;
 	if (dev->drm_fd >= 0 && drmGetCap(dev->drm_fd, DRM_CAP_SYNCOBJ_TIMELINE, &cap_syncobj_timeline) == 0) {
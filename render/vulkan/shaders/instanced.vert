@@ -0,0 +1,32 @@
+#version 450
+
+// Per-instance variant of common.vert, used to draw batches of quads which
+// only differ by their geometry. Scissoring can't change between instances,
+// so each instance is clipped to its own clip rectangle instead.
+
+// first two rows of the (row-major) projection matrix
+layout(location = 0) in vec4 proj_x;
+layout(location = 1) in vec4 proj_y;
+// uv offset in xy, uv size in zw
+layout(location = 2) in vec4 uv_rect;
+// clip rectangle in normalized device coordinates, min in xy, max in zw
+layout(location = 3) in vec4 clip;
+
+layout(location = 0) out vec2 uv;
+
+void main() {
+	vec2 pos = vec2(float((gl_VertexIndex + 1) & 2) * 0.5f,
+		float(gl_VertexIndex & 2) * 0.5f);
+
+	mat2 m = mat2(proj_x.x, proj_y.x, proj_x.y, proj_y.y);
+	vec2 t = vec2(proj_x.w, proj_y.w);
+
+	// The quad and the clip rectangle are both axis-aligned, so clamping
+	// the corners yields their intersection. Texture coordinates are
+	// derived from the clamped position to keep the mapping unchanged.
+	vec2 p = clamp(m * pos + t, clip.xy, clip.zw);
+	pos = inverse(m) * (p - t);
+
+	uv = uv_rect.xy + pos * uv_rect.zw;
+	gl_Position = vec4(p, 0.0, 1.0);
+}
@@ -0,0 +1,145 @@
+/*
+ * Drive the manual clock of a headless output and check the present events
+ * of its commits: vblank sequence numbers, timestamps and discarded frames.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+#define WIDTH 64
+#define HEIGHT 64
+#define REFRESH_NSEC (1000000000000ll / (60 * 1000))
+#define EVENTS_CAP 16
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+				__FILE__, __LINE__, #cond); \
+			abort(); \
+		} \
+	} while (0)
+
+struct present_log {
+	struct wl_listener present;
+	struct wlr_output_event_present events[EVENTS_CAP];
+	size_t events_len;
+};
+
+static void handle_present(struct wl_listener *listener, void *data) {
+	struct present_log *log = wl_container_of(listener, log, present);
+	const struct wlr_output_event_present *event = data;
+	CHECK(log->events_len < EVENTS_CAP);
+	log->events[log->events_len++] = *event;
+}
+
+static void dummy_buffer_destroy(struct wlr_buffer *buffer) {
+	free(buffer);
+}
+
+static const struct wlr_buffer_impl dummy_buffer_impl = {
+	.destroy = dummy_buffer_destroy,
+};
+
+static void commit(struct wl_event_loop *loop, struct wlr_output *output,
+		bool with_buffer) {
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_enabled(&state, true);
+	if (with_buffer) {
+		struct wlr_buffer *buffer = calloc(1, sizeof(*buffer));
+		CHECK(buffer != NULL);
+		wlr_buffer_init(buffer, &dummy_buffer_impl, WIDTH, HEIGHT);
+		wlr_output_state_set_buffer(&state, buffer);
+		wlr_buffer_drop(buffer);
+	}
+	bool ok = wlr_output_commit_state(output, &state);
+	wlr_output_state_finish(&state);
+	CHECK(ok);
+
+	// Discarded frames are reported from an idle callback
+	wl_event_loop_dispatch(loop, 0);
+}
+
+static int64_t event_when_nsec(const struct wlr_output_event_present *event) {
+	return (int64_t)event->when.tv_sec * 1000000000 + event->when.tv_nsec;
+}
+
+static void check_presented(const struct wlr_output_event_present *event,
+		uint32_t commit_seq) {
+	CHECK(event->commit_seq == commit_seq);
+	CHECK(event->presented);
+	CHECK(event->flags & WLR_OUTPUT_PRESENT_VSYNC);
+	CHECK(event->refresh == REFRESH_NSEC);
+}
+
+int main(void) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	struct wl_event_loop *loop = wl_event_loop_create();
+	CHECK(loop != NULL);
+	struct wlr_backend *backend = wlr_headless_backend_create(loop);
+	CHECK(backend != NULL);
+	CHECK(wlr_backend_start(backend));
+
+	struct wlr_output *output = wlr_headless_add_output(backend, WIDTH, HEIGHT);
+	CHECK(output != NULL);
+	wlr_headless_output_set_manual_clock(output, true);
+
+	struct present_log log = { .present.notify = handle_present };
+	wl_signal_add(&output->events.present, &log.present);
+
+	// A frame is presented on the next vblank, not before
+	commit(loop, output, true);
+	CHECK(log.events_len == 0);
+	wlr_headless_output_advance_clock(output, REFRESH_NSEC);
+	CHECK(log.events_len == 1);
+	check_presented(&log.events[0], 1);
+	unsigned seq = log.events[0].seq;
+	int64_t when = event_when_nsec(&log.events[0]);
+
+	// Commits which don't change the contents are presented along with the
+	// pending frame, on the same vblank
+	commit(loop, output, true);
+	commit(loop, output, false);
+	CHECK(log.events_len == 1);
+	wlr_headless_output_advance_clock(output, REFRESH_NSEC);
+	CHECK(log.events_len == 3);
+	for (size_t i = 1; i < 3; i++) {
+		check_presented(&log.events[i], i + 1);
+		CHECK(log.events[i].seq == seq + 1);
+		CHECK(event_when_nsec(&log.events[i]) == when + REFRESH_NSEC);
+	}
+
+	// A frame replaced before its vblank is discarded
+	commit(loop, output, true);
+	commit(loop, output, true);
+	CHECK(log.events_len == 4);
+	CHECK(log.events[3].commit_seq == 4);
+	CHECK(!log.events[3].presented);
+	wlr_headless_output_advance_clock(output, REFRESH_NSEC);
+	CHECK(log.events_len == 5);
+	check_presented(&log.events[4], 5);
+	CHECK(log.events[4].seq == seq + 2);
+	CHECK(event_when_nsec(&log.events[4]) == when + 2 * REFRESH_NSEC);
+
+	// Without a pending frame, a commit is presented on the next vblank
+	commit(loop, output, false);
+	wlr_headless_output_advance_clock(output, 0);
+	CHECK(log.events_len == 5);
+	wlr_headless_output_advance_clock(output, REFRESH_NSEC);
+	CHECK(log.events_len == 6);
+	check_presented(&log.events[5], 6);
+	CHECK(log.events[5].seq == seq + 3);
+	CHECK(event_when_nsec(&log.events[5]) == when + 3 * REFRESH_NSEC);
+
+	wl_list_remove(&log.present.link);
+	wlr_backend_destroy(backend);
+	wl_event_loop_destroy(loop);
+	return EXIT_SUCCESS;
+}
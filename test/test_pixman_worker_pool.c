@@ -0,0 +1,57 @@
+/*
+ * Run batches on pixman worker pools, including right after creating them
+ * when workers may not have started waiting yet, and check that each job
+ * runs exactly once.
+ */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wlr/util/log.h>
+#include "render/pixman.h"
+
+#define THREADS 4
+#define JOBS_LEN 64
+#define POOLS_LEN 100
+#define BATCHES_LEN 10
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+				__FILE__, __LINE__, #cond); \
+			abort(); \
+		} \
+	} while (0)
+
+struct batch {
+	atomic_int runs[JOBS_LEN];
+};
+
+static void run_job(void *data, size_t i) {
+	struct batch *batch = data;
+	CHECK(i < JOBS_LEN);
+	atomic_fetch_add(&batch->runs[i], 1);
+}
+
+static void run_batch(struct wlr_pixman_worker_pool *pool) {
+	struct batch batch = {0};
+	pixman_worker_pool_run(pool, run_job, &batch, JOBS_LEN);
+	for (size_t i = 0; i < JOBS_LEN; i++) {
+		CHECK(atomic_load(&batch.runs[i]) == 1);
+	}
+}
+
+int main(void) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	for (size_t i = 0; i < POOLS_LEN; i++) {
+		struct wlr_pixman_worker_pool *pool = pixman_worker_pool_create(THREADS);
+		CHECK(pool != NULL);
+		for (size_t j = 0; j < BATCHES_LEN; j++) {
+			run_batch(pool);
+		}
+		pixman_worker_pool_destroy(pool);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,190 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/types/wlr_frame_stats.h>
+#include <wlr/util/log.h>
+#include "types/wlr_output.h"
+#include "util/time.h"
+
+#define FRAME_DURATIONS_LEN \
+	(sizeof(((struct wlr_output *)NULL)->frame_durations) / sizeof(int64_t))
+// Time left between the predicted end of a frame and its deadline
+#define SAFETY_MARGIN_NSEC (2 * 1000000)
+// Frame events sent right away after a missed deadline
+#define FALLBACK_FRAMES 60
+
+static bool timespec_is_zero(const struct timespec *t) {
+	return t->tv_sec == 0 && t->tv_nsec == 0;
+}
+
+static int64_t output_refresh_nsec(struct wlr_output *output) {
+	if (output->present_refresh > 0) {
+		return output->present_refresh;
+	}
+	if (output->refresh > 0) {
+		return 1000000000000ll / output->refresh;
+	}
+	return 0;
+}
+
+/**
+ * Predict the time the compositor will take to get a frame on screen after
+ * a frame event, or return -1 if there isn't enough data yet.
+ */
+static int64_t predict_frame_duration(struct wlr_output *output) {
+	if (output->frame_durations_len < FRAME_DURATIONS_LEN) {
+		return -1;
+	}
+
+	// Frame times are noisy, plan for the worst recent one
+	int64_t duration = 0;
+	for (size_t i = 0; i < FRAME_DURATIONS_LEN; i++) {
+		if (output->frame_durations[i] > duration) {
+			duration = output->frame_durations[i];
+		}
+	}
+
+	// Commits don't wait for the GPU, which still needs to be done with the
+	// frame before the deadline
+	struct wlr_frame_stats *stats = wlr_frame_stats_try_get(output);
+	struct wlr_frame_stats_summary summary;
+	if (stats != NULL && wlr_frame_stats_get_summary(stats,
+			WLR_FRAME_STATS_RENDER_GPU, &summary)) {
+		duration += summary.p99_ns;
+	}
+
+	return duration;
+}
+
+static int handle_frame_timer(void *data) {
+	struct wlr_output *output = data;
+	output->frame_delayed = false;
+	output_send_frame_now(output);
+	return 0;
+}
+
+bool output_frame_scheduler_delay_frame(struct wlr_output *output) {
+	output->frame_deadline = (struct timespec){0};
+	if (!output->frame_scheduling || !output->enabled) {
+		return false;
+	}
+	if (output->frame_fallback > 0) {
+		output->frame_fallback--;
+		return false;
+	}
+
+	int64_t refresh = output_refresh_nsec(output);
+	int64_t duration = predict_frame_duration(output);
+	if (refresh <= 0 || duration < 0) {
+		return false;
+	}
+
+	// The refresh cycle started at the last presentation if the backend
+	// just reported it, or now otherwise
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t now_nsec = timespec_to_nsec(&now);
+	int64_t start_nsec = timespec_to_nsec(&output->present_time);
+	if (now_nsec - start_nsec < 0 || now_nsec - start_nsec >= refresh) {
+		start_nsec = now_nsec;
+	}
+
+	int64_t deadline_nsec = start_nsec + refresh;
+	int64_t delay_msec =
+		(deadline_nsec - duration - SAFETY_MARGIN_NSEC - now_nsec) / 1000000;
+	if (delay_msec < 1) {
+		return false;
+	}
+
+	if (output->frame_timer == NULL) {
+		output->frame_timer = wl_event_loop_add_timer(output->event_loop,
+			handle_frame_timer, output);
+		if (output->frame_timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create frame timer");
+			return false;
+		}
+	}
+
+	wl_event_source_timer_update(output->frame_timer, delay_msec);
+	output->frame_delayed = true;
+	timespec_from_nsec(&output->frame_deadline, deadline_nsec);
+	return true;
+}
+
+void output_frame_scheduler_handle_commit(struct wlr_output *output,
+		const struct wlr_output_state *state, const struct timespec *now) {
+	if (!(state->committed & WLR_OUTPUT_STATE_BUFFER)) {
+		return;
+	}
+
+	// A new frame is on its way, the delayed frame event is stale
+	if (output->frame_delayed) {
+		wl_event_source_timer_update(output->frame_timer, 0);
+		output->frame_delayed = false;
+	}
+
+	if (!timespec_is_zero(&output->frame_time)) {
+		struct timespec duration;
+		timespec_sub(&duration, now, &output->frame_time);
+		output->frame_durations[output->frame_durations_len % FRAME_DURATIONS_LEN] =
+			timespec_to_nsec(&duration);
+		output->frame_durations_len++;
+		output->frame_time = (struct timespec){0};
+	}
+
+	if (!timespec_is_zero(&output->frame_deadline)) {
+		output->commit_deadline = output->frame_deadline;
+		output->commit_deadline_seq = output->commit_seq;
+		output->frame_deadline = (struct timespec){0};
+	}
+}
+
+void output_frame_scheduler_handle_present(struct wlr_output *output,
+		const struct wlr_output_event_present *event) {
+	if (!event->presented) {
+		return;
+	}
+
+	// Only timestamps of vblanks tell when refresh cycles start
+	if (event->flags & WLR_OUTPUT_PRESENT_VSYNC) {
+		output->present_time = event->when;
+	} else {
+		output->present_time = (struct timespec){0};
+	}
+	if (event->refresh > 0) {
+		output->present_refresh = event->refresh;
+	}
+
+	if (timespec_is_zero(&output->commit_deadline) ||
+			event->commit_seq != output->commit_deadline_seq) {
+		return;
+	}
+
+	// Leave half a refresh cycle of slack for the presentation timestamp
+	struct timespec late;
+	timespec_sub(&late, &event->when, &output->commit_deadline);
+	output->commit_deadline = (struct timespec){0};
+	if (timespec_to_nsec(&late) > output_refresh_nsec(output) / 2) {
+		wlr_log(WLR_DEBUG, "Output %s missed its frame deadline by %"PRId64" us, "
+			"sending the next %d frame events right away", output->name,
+			timespec_to_nsec(&late) / 1000, FALLBACK_FRAMES);
+		output->frame_fallback = FALLBACK_FRAMES;
+		output->frame_durations_len = 0;
+	}
+}
+
+void output_frame_scheduler_finish(struct wlr_output *output) {
+	if (output->frame_timer != NULL) {
+		wl_event_source_remove(output->frame_timer);
+	}
+}
+
+void wlr_output_set_predictive_frame_scheduling(struct wlr_output *output,
+		bool enabled) {
+	output->frame_scheduling = enabled;
+	if (!enabled && output->frame_delayed) {
+		wl_event_source_timer_update(output->frame_timer, 0);
+		output->frame_delayed = false;
+		output_send_frame_now(output);
+	}
+}
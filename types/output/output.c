@@ -11,6 +11,8 @@
 #include "types/wlr_output.h"
 #include "util/env.h"
 #include "util/global.h"
+#include "util/time.h"
+#include "util/trace.h"
 
 #define OUTPUT_VERSION 4
 
@@ -365,6 +367,8 @@ void wlr_output_init(struct wlr_output *output, struct wlr_backend *backend,
 		wlr_log(WLR_DEBUG, "WLR_NO_HARDWARE_CURSORS set, forcing software cursors");
 	}
 
+	output->frame_scheduling = env_parse_bool("WLR_OUTPUT_PREDICTIVE_FRAMES");
+
 	wlr_addon_set_init(&output->addons);
 
 	wl_list_init(&output->display_destroy.link);
@@ -409,6 +413,8 @@ void wlr_output_destroy(struct wlr_output *output) {
 		wl_event_source_remove(output->idle_frame);
 	}
 
+	output_frame_scheduler_finish(output);
+
 	if (output->idle_done != NULL) {
 		wl_event_source_remove(output->idle_done);
 	}
@@ -734,6 +740,12 @@ void output_apply_commit(struct wlr_output *output, const struct wlr_output_stat
 
 	struct timespec now;
 	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (state->committed & WLR_OUTPUT_STATE_BUFFER) {
+		output->buffer_commit_seq = output->commit_seq;
+		output->buffer_commit_time = now;
+	}
+	output_frame_scheduler_handle_commit(output, state, &now);
+
 	struct wlr_output_event_commit event = {
 		.output = output,
 		.when = &now,
@@ -765,7 +777,10 @@ bool wlr_output_commit_state(struct wlr_output *output,
 		return false;
 	}
 
-	if (!output->impl->commit(output, &pending)) {
+	TRACE_BEGIN("output_commit");
+	bool ok = output->impl->commit(output, &pending);
+	TRACE_END("output_commit");
+	if (!ok) {
 		if (new_back_buffer) {
 			wlr_buffer_unlock(pending.buffer);
 		}
@@ -781,18 +796,28 @@ bool wlr_output_commit_state(struct wlr_output *output,
 	return true;
 }
 
-void wlr_output_send_frame(struct wlr_output *output) {
+void output_send_frame_now(struct wlr_output *output) {
 	output->frame_pending = false;
 	if (output->enabled) {
+		clock_gettime(CLOCK_MONOTONIC, &output->frame_time);
+		TRACE_BEGIN("output_frame");
 		wl_signal_emit_mutable(&output->events.frame, output);
+		TRACE_END("output_frame");
 	}
 }
 
+void wlr_output_send_frame(struct wlr_output *output) {
+	if (output_frame_scheduler_delay_frame(output)) {
+		return;
+	}
+	output_send_frame_now(output);
+}
+
 static void schedule_frame_handle_idle_timer(void *data) {
 	struct wlr_output *output = data;
 	output->idle_frame = NULL;
 	if (!output->frame_pending) {
-		wlr_output_send_frame(output);
+		output_send_frame_now(output);
 	}
 }
 
@@ -825,6 +850,19 @@ void wlr_output_send_present(struct wlr_output *output,
 		}
 	}
 
+	// A frame presented more than a refresh cycle after being committed
+	// missed its vblank, most likely because rendering it took too long
+	if (event->presented && event->refresh > 0 && output->swapchain != NULL &&
+			event->commit_seq == output->buffer_commit_seq) {
+		struct timespec latency;
+		timespec_sub(&latency, &event->when, &output->buffer_commit_time);
+		if (timespec_to_nsec(&latency) > event->refresh) {
+			wlr_swapchain_report_missed_frame(output->swapchain);
+		}
+	}
+
+	output_frame_scheduler_handle_present(output, event);
+
 	wl_signal_emit_mutable(&output->events.present, event);
 }
 
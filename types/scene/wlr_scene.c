@@ -7,19 +7,24 @@
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_damage_ring.h>
+#include <wlr/types/wlr_frame_stats.h>
 #include <wlr/types/wlr_gamma_control_v1.h>
 #include <wlr/types/wlr_linux_dmabuf_v1.h>
+#include <wlr/types/wlr_output_layer.h>
 #include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
 #include <wlr/util/transform.h>
+#include "render/atlas.h"
 #include "types/wlr_buffer.h"
 #include "types/wlr_output.h"
 #include "types/wlr_scene.h"
 #include "util/array.h"
+#include "util/box_tree.h"
 #include "util/env.h"
 #include "util/time.h"
+#include "util/trace.h"
 
 #include <wlr/config.h>
 
@@ -29,6 +34,12 @@
 
 #define HIGHLIGHT_DAMAGE_FADEOUT_TIME 250
 
+#define DEFAULT_OUTPUT_LAYERS 3
+// Bounds of the number of frames to wait for after the backend rejected a
+// layer plan, before trying a new one
+#define MIN_LAYERS_BACKOFF 8
+#define MAX_LAYERS_BACKOFF 256
+
 struct wlr_scene_tree *wlr_scene_tree_from_node(struct wlr_scene_node *node) {
 	assert(node->type == WLR_SCENE_NODE_TREE);
 	struct wlr_scene_tree *tree = wl_container_of(node, tree, node);
@@ -69,6 +80,7 @@ static void scene_node_init(struct wlr_scene_node *node,
 		.type = type,
 		.parent = parent,
 		.enabled = true,
+		.index_leaf = -1,
 	};
 
 	wl_list_init(&node->link);
@@ -78,6 +90,7 @@ static void scene_node_init(struct wlr_scene_node *node,
 
 	if (parent != NULL) {
 		wl_list_insert(parent->children.prev, &node->link);
+		scene_node_get_root(node)->order_dirty = true;
 	}
 
 	wlr_addon_set_init(&node->addons);
@@ -93,6 +106,11 @@ static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
 	struct wlr_buffer *buffer);
 static void scene_buffer_set_texture(struct wlr_scene_buffer *scene_buffer,
 	struct wlr_texture *texture);
+static void scene_buffer_set_atlas_entry(struct wlr_scene_buffer *scene_buffer,
+	struct wlr_atlas_entry *entry);
+static void scene_index_remove(struct wlr_scene *scene,
+	struct wlr_scene_node *node);
+static void scene_invalidate_render_lists(struct wlr_scene *scene);
 
 void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 	if (node == NULL) {
@@ -108,6 +126,11 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 	wlr_scene_node_set_enabled(node, false);
 
 	struct wlr_scene *scene = scene_node_get_root(node);
+	if (node->type != WLR_SCENE_NODE_TREE) {
+		scene_index_remove(scene, node);
+	}
+	scene_invalidate_render_lists(scene);
+
 	if (node->type == WLR_SCENE_NODE_BUFFER) {
 		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
 
@@ -124,6 +147,7 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 
 		scene_buffer_set_buffer(scene_buffer, NULL);
 		scene_buffer_set_texture(scene_buffer, NULL);
+		scene_buffer_set_atlas_entry(scene_buffer, NULL);
 		pixman_region32_fini(&scene_buffer->opaque_region);
 		wlr_drm_syncobj_timeline_unref(scene_buffer->wait_timeline);
 
@@ -145,6 +169,9 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 			wl_list_remove(&scene->linux_dmabuf_v1_destroy.link);
 			wl_list_remove(&scene->gamma_control_manager_v1_destroy.link);
 			wl_list_remove(&scene->gamma_control_manager_v1_set_gamma.link);
+			wl_list_remove(&scene->atlas_renderer_destroy.link);
+			// Entries of the buffer nodes destroyed below outlive the atlas
+			atlas_destroy(scene->atlas);
 		} else {
 			assert(node->parent);
 		}
@@ -154,6 +181,13 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 				&scene_tree->children, link) {
 			wlr_scene_node_destroy(child);
 		}
+
+		if (scene_tree == &scene->tree && scene->index != NULL) {
+			box_tree_finish(scene->index);
+			free(scene->index);
+		}
+
+		pixman_region32_fini(&scene_tree->opaque);
 	}
 
 	assert(wl_list_empty(&node->events.destroy.listener_list));
@@ -168,6 +202,8 @@ static void scene_tree_init(struct wlr_scene_tree *tree,
 	*tree = (struct wlr_scene_tree){0};
 	scene_node_init(&tree->node, WLR_SCENE_NODE_TREE, parent);
 	wl_list_init(&tree->children);
+	pixman_region32_init(&tree->opaque);
+	tree->opaque_dirty = true;
 }
 
 struct wlr_scene *wlr_scene_create(void) {
@@ -182,6 +218,7 @@ struct wlr_scene *wlr_scene_create(void) {
 	wl_list_init(&scene->linux_dmabuf_v1_destroy.link);
 	wl_list_init(&scene->gamma_control_manager_v1_destroy.link);
 	wl_list_init(&scene->gamma_control_manager_v1_set_gamma.link);
+	wl_list_init(&scene->atlas_renderer_destroy.link);
 
 	const char *debug_damage_options[] = {
 		"none",
@@ -194,6 +231,24 @@ struct wlr_scene *wlr_scene_create(void) {
 	scene->direct_scanout = !env_parse_bool("WLR_SCENE_DISABLE_DIRECT_SCANOUT");
 	scene->calculate_visibility = !env_parse_bool("WLR_SCENE_DISABLE_VISIBILITY");
 	scene->highlight_transparent_region = env_parse_bool("WLR_SCENE_HIGHLIGHT_TRANSPARENT_REGION");
+	scene->validate_index = env_parse_bool("WLR_SCENE_VALIDATE_SPATIAL_INDEX");
+	scene->incremental_visibility =
+		!env_parse_bool("WLR_SCENE_DISABLE_INCREMENTAL_VISIBILITY");
+	scene->atlas_enabled = !env_parse_bool("WLR_SCENE_DISABLE_ATLAS");
+	scene->output_layers = env_parse_uint("WLR_SCENE_OUTPUT_LAYERS",
+		DEFAULT_OUTPUT_LAYERS);
+	if (scene->output_layers > WLR_SCENE_OUTPUT_LAYERS_CAP) {
+		scene->output_layers = WLR_SCENE_OUTPUT_LAYERS_CAP;
+	}
+
+	if (!env_parse_bool("WLR_SCENE_DISABLE_SPATIAL_INDEX")) {
+		scene->index = calloc(1, sizeof(*scene->index));
+		if (scene->index != NULL) {
+			box_tree_init(scene->index);
+		} else {
+			wlr_log(WLR_ERROR, "Allocation failed, disabling the scene spatial index");
+		}
+	}
 
 	return scene;
 }
@@ -246,14 +301,218 @@ static bool _scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box
 	return false;
 }
 
-static bool scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box,
-		scene_node_box_iterator_func_t iterator, void *user_data) {
+static void scene_index_disable(struct wlr_scene *scene,
+		struct wlr_scene_node *node) {
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_index_disable(scene, child);
+		}
+	}
+
+	node->index_leaf = -1;
+}
+
+static void scene_index_handle_alloc_failure(struct wlr_scene *scene) {
+	wlr_log(WLR_ERROR, "Allocation failed, disabling the scene spatial index");
+	box_tree_finish(scene->index);
+	free(scene->index);
+	scene->index = NULL;
+	scene_index_disable(scene, &scene->tree.node);
+}
+
+static void scene_index_remove(struct wlr_scene *scene,
+		struct wlr_scene_node *node) {
+	if (node->index_leaf < 0) {
+		return;
+	}
+
+	box_tree_remove(scene->index, node->index_leaf);
+	node->index_leaf = -1;
+}
+
+/**
+ * Bring the spatial index entries of a node and its children up-to-date.
+ * lx, ly and enabled are those of the node, as returned by
+ * wlr_scene_node_coords().
+ */
+static void scene_index_update(struct wlr_scene *scene,
+		struct wlr_scene_node *node, int lx, int ly, bool enabled) {
+	if (scene->index == NULL) {
+		return;
+	}
+
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_index_update(scene, child, lx + child->x, ly + child->y,
+				enabled && child->enabled);
+			if (scene->index == NULL) {
+				return;
+			}
+		}
+		return;
+	}
+
+	int width, height;
+	scene_node_get_size(node, &width, &height);
+	if (!enabled || width <= 0 || height <= 0) {
+		scene_index_remove(scene, node);
+		return;
+	}
+
+	pixman_box32_t box = {
+		.x1 = lx,
+		.y1 = ly,
+		.x2 = lx + width,
+		.y2 = ly + height,
+	};
+
+	if (node->index_leaf < 0) {
+		node->index_leaf = box_tree_insert(scene->index, box, node);
+	} else {
+		const pixman_box32_t *prev = box_tree_get_box(scene->index, node->index_leaf);
+		if (memcmp(prev, &box, sizeof(box)) == 0) {
+			return;
+		}
+		node->index_leaf = box_tree_move(scene->index, node->index_leaf, box);
+	}
+
+	if (node->index_leaf < 0) {
+		scene_index_handle_alloc_failure(scene);
+	}
+}
+
+static void scene_node_update_order(struct wlr_scene_node *node,
+		uint32_t *order) {
+	node->order = (*order)++;
+
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *scene_tree = wlr_scene_tree_from_node(node);
+		struct wlr_scene_node *child;
+		wl_list_for_each(child, &scene_tree->children, link) {
+			scene_node_update_order(child, order);
+		}
+	}
+}
+
+/**
+ * Number all nodes in rendering order, if the stacking order changed since
+ * the last call. The nodes of a subtree get consecutive numbers, starting
+ * with the subtree's root.
+ */
+static void scene_update_order(struct wlr_scene *scene) {
+	if (!scene->order_dirty) {
+		return;
+	}
+
+	uint32_t order = 0;
+	scene_node_update_order(&scene->tree.node, &order);
+	scene->order_dirty = false;
+}
+
+struct index_query_entry {
+	struct wlr_scene_node *node;
+	int x, y;
+};
+
+struct index_query_data {
+	struct wl_array entries; // struct index_query_entry
+	bool failed;
+};
+
+static bool scene_index_query_iterator(void *data,
+		const pixman_box32_t *box, void *user_data) {
+	struct index_query_data *query = user_data;
+
+	struct index_query_entry *entry = wl_array_add(&query->entries, sizeof(*entry));
+	if (entry == NULL) {
+		query->failed = true;
+		return true;
+	}
+
+	*entry = (struct index_query_entry){
+		.node = data,
+		.x = box->x1,
+		.y = box->y1,
+	};
+	return false;
+}
+
+static int index_query_entry_compare(const void *_a, const void *_b) {
+	const struct index_query_entry *a = _a;
+	const struct index_query_entry *b = _b;
+
+	// Topmost nodes first
+	if (a->node->order == b->node->order) {
+		return 0;
+	}
+	return a->node->order < b->node->order ? 1 : -1;
+}
+
+static bool scene_index_nodes_in_box(struct wlr_scene *scene,
+		struct wlr_box *box, scene_node_box_iterator_func_t iterator,
+		void *user_data, bool *found) {
+	scene_update_order(scene);
+
+	pixman_box32_t query_box = {
+		.x1 = box->x,
+		.y1 = box->y,
+		.x2 = box->x + box->width,
+		.y2 = box->y + box->height,
+	};
+
+	struct index_query_data query = {0};
+	wl_array_init(&query.entries);
+	box_tree_query(scene->index, &query_box, scene_index_query_iterator, &query);
+	if (query.failed) {
+		wl_array_release(&query.entries);
+		return false;
+	}
+
+	struct index_query_entry *entries = query.entries.data;
+	size_t len = query.entries.size / sizeof(*entries);
+	qsort(entries, len, sizeof(*entries), index_query_entry_compare);
+
+	*found = false;
+	for (size_t i = 0; i < len; i++) {
+		if (iterator(entries[i].node, entries[i].x, entries[i].y, user_data)) {
+			*found = true;
+			break;
+		}
+	}
+
+	wl_array_release(&query.entries);
+	return true;
+}
+
+static bool scene_nodes_in_box_linear(struct wlr_scene_node *node,
+		struct wlr_box *box, scene_node_box_iterator_func_t iterator,
+		void *user_data) {
 	int x, y;
 	wlr_scene_node_coords(node, &x, &y);
 
 	return _scene_nodes_in_box(node, box, iterator, user_data, x, y);
 }
 
+static bool scene_nodes_in_box(struct wlr_scene_node *node, struct wlr_box *box,
+		scene_node_box_iterator_func_t iterator, void *user_data) {
+	// The spatial index only covers nodes whose ancestors are all enabled,
+	// so it can only answer queries for the whole scene.
+	if (node->parent == NULL) {
+		struct wlr_scene *scene = scene_node_get_root(node);
+		bool found;
+		if (scene->index != NULL && scene_index_nodes_in_box(scene, box,
+				iterator, user_data, &found)) {
+			return found;
+		}
+	}
+
+	return scene_nodes_in_box_linear(node, box, iterator, user_data);
+}
+
 static void scene_node_opaque_region(struct wlr_scene_node *node, int x, int y,
 		pixman_region32_t *opaque) {
 	int width, height;
@@ -287,6 +546,109 @@ static void scene_node_opaque_region(struct wlr_scene_node *node, int x, int y,
 	pixman_region32_init_rect(opaque, x, y, width, height);
 }
 
+/**
+ * Mark the cached opaque regions of the node and its ancestors as stale. Must
+ * be called whenever the result of scene_node_opaque_region() may change for
+ * a node, or when a node is added, removed, moved, enabled or disabled.
+ */
+static void scene_node_invalidate_opaque(struct wlr_scene_node *node) {
+	if (node->type == WLR_SCENE_NODE_TREE) {
+		wlr_scene_tree_from_node(node)->opaque_dirty = true;
+	}
+
+	for (struct wlr_scene_tree *tree = node->parent; tree != NULL;
+			tree = tree->node.parent) {
+		tree->opaque_dirty = true;
+	}
+}
+
+static const pixman_region32_t *scene_tree_get_opaque_region(
+		struct wlr_scene_tree *tree) {
+	if (!tree->opaque_dirty) {
+		return &tree->opaque;
+	}
+
+	pixman_region32_clear(&tree->opaque);
+
+	struct wlr_scene_node *child;
+	wl_list_for_each(child, &tree->children, link) {
+		if (!child->enabled) {
+			continue;
+		}
+
+		pixman_region32_t opaque;
+		pixman_region32_init(&opaque);
+		if (child->type == WLR_SCENE_NODE_TREE) {
+			pixman_region32_copy(&opaque,
+				scene_tree_get_opaque_region(wlr_scene_tree_from_node(child)));
+			pixman_region32_translate(&opaque, child->x, child->y);
+		} else {
+			scene_node_opaque_region(child, child->x, child->y, &opaque);
+		}
+		pixman_region32_union(&tree->opaque, &tree->opaque, &opaque);
+		pixman_region32_fini(&opaque);
+	}
+
+	tree->opaque_dirty = false;
+	return &tree->opaque;
+}
+
+/**
+ * Subtract the opaque regions of all nodes rendered above the node from
+ * the region, in layout-local coordinates. Returns false if the node has a
+ * disabled ancestor.
+ */
+static bool scene_node_subtract_opaque_above(struct wlr_scene_node *node,
+		pixman_region32_t *region) {
+	int x, y;
+	if (node->parent != NULL && !wlr_scene_node_coords(&node->parent->node, &x, &y)) {
+		return false;
+	}
+
+	wlr_scene_node_coords(node, &x, &y);
+	for (struct wlr_scene_node *cur = node; cur->parent != NULL;
+			cur = &cur->parent->node) {
+		// Translate to the coordinates of the parent
+		x -= cur->x;
+		y -= cur->y;
+
+		struct wlr_scene_tree *parent = cur->parent;
+		for (struct wl_list *link = cur->link.next; link != &parent->children;
+				link = link->next) {
+			struct wlr_scene_node *sibling = wl_container_of(link, sibling, link);
+			if (!sibling->enabled) {
+				continue;
+			}
+
+			pixman_region32_t opaque;
+			pixman_region32_init(&opaque);
+			if (sibling->type == WLR_SCENE_NODE_TREE) {
+				pixman_region32_copy(&opaque, scene_tree_get_opaque_region(
+					wlr_scene_tree_from_node(sibling)));
+				pixman_region32_translate(&opaque, x + sibling->x, y + sibling->y);
+			} else {
+				scene_node_opaque_region(sibling, x + sibling->x, y + sibling->y,
+					&opaque);
+			}
+			pixman_region32_subtract(region, region, &opaque);
+			pixman_region32_fini(&opaque);
+		}
+	}
+
+	return true;
+}
+
+static uint32_t scene_node_last_order(struct wlr_scene_node *node) {
+	while (node->type == WLR_SCENE_NODE_TREE) {
+		struct wlr_scene_tree *tree = wlr_scene_tree_from_node(node);
+		if (wl_list_empty(&tree->children)) {
+			break;
+		}
+		node = wl_container_of(tree->children.prev, node, link);
+	}
+	return node->order;
+}
+
 struct scene_update_data {
 	pixman_region32_t *visible;
 	pixman_region32_t *update_region;
@@ -294,6 +656,11 @@ struct scene_update_data {
 	struct wl_list *outputs;
 	bool calculate_visibility;
 
+	// If set, nodes rendered above the node which triggered the update are
+	// unaffected by it and are skipped
+	bool incremental;
+	uint32_t last_order;
+
 #if WLR_HAS_XWAYLAND
 	struct wlr_xwayland_surface *restack_above;
 #endif
@@ -587,6 +954,15 @@ static bool scene_node_update_iterator(struct wlr_scene_node *node,
 	struct wlr_box box = { .x = lx, .y = ly };
 	scene_node_get_size(node, &box.width, &box.height);
 
+	if (data->incremental && node->order > data->last_order) {
+		// The opaque region of this node has already been subtracted from
+		// data->visible
+#if WLR_HAS_XWAYLAND
+		restack_xwayland_surface(node, &box, data);
+#endif
+		return false;
+	}
+
 	pixman_region32_subtract(&node->visible, &node->visible, data->update_region);
 	pixman_region32_union(&node->visible, &node->visible, data->visible);
 	pixman_region32_intersect_rect(&node->visible, &node->visible,
@@ -646,8 +1022,16 @@ static void scene_node_bounds(struct wlr_scene_node *node,
 	pixman_region32_union_rect(visible, visible, x, y, width, height);
 }
 
+/**
+ * Recompute the visibility of nodes in the update region. If changed is not
+ * NULL, the update was caused by a change to this node which didn't alter
+ * the set of nodes rendered above it; only the node and the nodes below it
+ * are then revisited.
+ */
 static void scene_update_region(struct wlr_scene *scene,
-		pixman_region32_t *update_region) {
+		pixman_region32_t *update_region, struct wlr_scene_node *changed) {
+	scene_invalidate_render_lists(scene);
+
 	pixman_region32_t visible;
 	pixman_region32_init(&visible);
 	pixman_region32_copy(&visible, update_region);
@@ -666,23 +1050,38 @@ static void scene_update_region(struct wlr_scene *scene,
 		.calculate_visibility = scene->calculate_visibility,
 	};
 
+	if (changed != NULL && scene->incremental_visibility &&
+			(!scene->calculate_visibility ||
+			scene_node_subtract_opaque_above(changed, &visible))) {
+		scene_update_order(scene);
+		data.incremental = true;
+		data.last_order = scene_node_last_order(changed);
+	}
+
 	// update node visibility and output enter/leave events
 	scene_nodes_in_box(&scene->tree.node, &data.update_box, scene_node_update_iterator, &data);
 
 	pixman_region32_fini(&visible);
 }
 
-static void scene_node_update(struct wlr_scene_node *node,
-		pixman_region32_t *damage) {
+static void _scene_node_update(struct wlr_scene_node *node,
+		pixman_region32_t *damage, bool restacked) {
 	struct wlr_scene *scene = scene_node_get_root(node);
+	struct wlr_scene_node *changed = restacked ? NULL : node;
+
+	scene_node_invalidate_opaque(node);
+	scene_invalidate_render_lists(scene);
 
 	int x, y;
-	if (!wlr_scene_node_coords(node, &x, &y)) {
+	bool enabled = wlr_scene_node_coords(node, &x, &y);
+	scene_index_update(scene, node, x, y, enabled);
+
+	if (!enabled) {
 #if WLR_HAS_XWAYLAND
 		restack_xwayland_surface_below(node);
 #endif
 		if (damage) {
-			scene_update_region(scene, damage);
+			scene_update_region(scene, damage, changed);
 			scene_damage_outputs(scene, damage);
 			pixman_region32_fini(damage);
 		}
@@ -702,7 +1101,7 @@ static void scene_node_update(struct wlr_scene_node *node,
 	pixman_region32_copy(&update_region, damage);
 	scene_node_bounds(node, x, y, &update_region);
 
-	scene_update_region(scene, &update_region);
+	scene_update_region(scene, &update_region, changed);
 	pixman_region32_fini(&update_region);
 
 	scene_node_visibility(node, damage);
@@ -710,6 +1109,13 @@ static void scene_node_update(struct wlr_scene_node *node,
 	pixman_region32_fini(damage);
 }
 
+static void scene_node_update(struct wlr_scene_node *node,
+		pixman_region32_t *damage) {
+	TRACE_BEGIN("scene_node_update");
+	_scene_node_update(node, damage, false);
+	TRACE_END("scene_node_update");
+}
+
 struct wlr_scene_rect *wlr_scene_rect_create(struct wlr_scene_tree *parent,
 		int width, int height, const float color[static 4]) {
 	assert(parent);
@@ -759,6 +1165,11 @@ static void scene_buffer_handle_buffer_release(struct wl_listener *listener,
 	scene_buffer->buffer = NULL;
 	wl_list_remove(&scene_buffer->buffer_release.link);
 	wl_list_init(&scene_buffer->buffer_release.link);
+
+	// The node is no longer considered opaque without a buffer, and may
+	// become invisible
+	scene_node_invalidate_opaque(&scene_buffer->node);
+	scene_invalidate_render_lists(scene_node_get_root(&scene_buffer->node));
 }
 
 static void scene_buffer_set_buffer(struct wlr_scene_buffer *scene_buffer,
@@ -791,6 +1202,7 @@ static void scene_buffer_handle_renderer_destroy(struct wl_listener *listener,
 		void *data) {
 	struct wlr_scene_buffer *scene_buffer = wl_container_of(listener, scene_buffer, renderer_destroy);
 	scene_buffer_set_texture(scene_buffer, NULL);
+	scene_invalidate_render_lists(scene_node_get_root(&scene_buffer->node));
 }
 
 static void scene_buffer_set_texture(struct wlr_scene_buffer *scene_buffer,
@@ -807,6 +1219,12 @@ static void scene_buffer_set_texture(struct wlr_scene_buffer *scene_buffer,
 	}
 }
 
+static void scene_buffer_set_atlas_entry(struct wlr_scene_buffer *scene_buffer,
+		struct wlr_atlas_entry *entry) {
+	atlas_entry_unref(scene_buffer->atlas_entry);
+	scene_buffer->atlas_entry = entry;
+}
+
 static void scene_buffer_set_wait_timeline(struct wlr_scene_buffer *scene_buffer,
 		struct wlr_drm_syncobj_timeline *timeline, uint64_t point) {
 	wlr_drm_syncobj_timeline_unref(scene_buffer->wait_timeline);
@@ -857,7 +1275,8 @@ void wlr_scene_buffer_set_buffer_with_options(struct wlr_scene_buffer *scene_buf
 	assert(buffer || !options->damage);
 
 	bool mapped = buffer != NULL;
-	bool prev_mapped = scene_buffer->buffer != NULL || scene_buffer->texture != NULL;
+	bool prev_mapped = scene_buffer->buffer != NULL || scene_buffer->texture != NULL ||
+		scene_buffer->atlas_entry != NULL;
 
 	if (!mapped && !prev_mapped) {
 		// unmapping already unmapped buffer - noop
@@ -873,11 +1292,23 @@ void wlr_scene_buffer_set_buffer_with_options(struct wlr_scene_buffer *scene_buf
 			scene_buffer->buffer_height != buffer->height;
 	}
 
+	// The contents of the buffer may have changed since it was packed
+	struct wlr_scene *scene = scene_node_get_root(&scene_buffer->node);
+	if (buffer != NULL && scene->atlas != NULL) {
+		atlas_invalidate_buffer(scene->atlas, buffer);
+	}
+
+	bool prev_opaque = scene_buffer->buffer_is_opaque;
 	scene_buffer_set_buffer(scene_buffer, buffer);
 	scene_buffer_set_texture(scene_buffer, NULL);
+	scene_buffer_set_atlas_entry(scene_buffer, NULL);
 	scene_buffer_set_wait_timeline(scene_buffer,
 		options->wait_timeline, options->wait_point);
 
+	if (prev_opaque != scene_buffer->buffer_is_opaque) {
+		scene_node_invalidate_opaque(&scene_buffer->node);
+	}
+
 	if (update) {
 		scene_node_update(&scene_buffer->node, NULL);
 		// updating the node will already damage the whole node for us. Return
@@ -925,7 +1356,6 @@ void wlr_scene_buffer_set_buffer_with_options(struct wlr_scene_buffer *scene_buf
 		box.x, box.y, box.width, box.height);
 	pixman_region32_translate(&trans_damage, -box.x, -box.y);
 
-	struct wlr_scene *scene = scene_node_get_root(&scene_buffer->node);
 	struct wlr_scene_output *scene_output;
 	wl_list_for_each(scene_output, &scene->outputs, link) {
 		float output_scale = scene_output->output->scale;
@@ -995,6 +1425,7 @@ void wlr_scene_buffer_set_opaque_region(struct wlr_scene_buffer *scene_buffer,
 	}
 
 	pixman_region32_copy(&scene_buffer->opaque_region, region);
+	scene_node_invalidate_opaque(&scene_buffer->node);
 
 	int x, y;
 	if (!wlr_scene_node_coords(&scene_buffer->node, &x, &y)) {
@@ -1004,7 +1435,8 @@ void wlr_scene_buffer_set_opaque_region(struct wlr_scene_buffer *scene_buffer,
 	pixman_region32_t update_region;
 	pixman_region32_init(&update_region);
 	scene_node_bounds(&scene_buffer->node, x, y, &update_region);
-	scene_update_region(scene_node_get_root(&scene_buffer->node), &update_region);
+	scene_update_region(scene_node_get_root(&scene_buffer->node), &update_region,
+		&scene_buffer->node);
 	pixman_region32_fini(&update_region);
 }
 
@@ -1161,7 +1593,8 @@ void wlr_scene_node_place_above(struct wlr_scene_node *node,
 
 	wl_list_remove(&node->link);
 	wl_list_insert(&sibling->link, &node->link);
-	scene_node_update(node, NULL);
+	scene_node_get_root(node)->order_dirty = true;
+	_scene_node_update(node, NULL, true);
 }
 
 void wlr_scene_node_place_below(struct wlr_scene_node *node,
@@ -1175,7 +1608,8 @@ void wlr_scene_node_place_below(struct wlr_scene_node *node,
 
 	wl_list_remove(&node->link);
 	wl_list_insert(sibling->link.prev, &node->link);
-	scene_node_update(node, NULL);
+	scene_node_get_root(node)->order_dirty = true;
+	_scene_node_update(node, NULL, true);
 }
 
 void wlr_scene_node_raise_to_top(struct wlr_scene_node *node) {
@@ -1217,10 +1651,14 @@ void wlr_scene_node_reparent(struct wlr_scene_node *node,
 		scene_node_visibility(node, &visible);
 	}
 
+	// Invalidate the cached opaque regions of the previous ancestors
+	scene_node_invalidate_opaque(node);
+
 	wl_list_remove(&node->link);
 	node->parent = new_parent;
 	wl_list_insert(new_parent->children.prev, &node->link);
-	scene_node_update(node, &visible);
+	scene_node_get_root(node)->order_dirty = true;
+	_scene_node_update(node, &visible, true);
 }
 
 bool wlr_scene_node_coords(struct wlr_scene_node *node,
@@ -1314,7 +1752,22 @@ struct wlr_scene_node *wlr_scene_node_at(struct wlr_scene_node *node,
 		.ly = ly
 	};
 
-	if (scene_nodes_in_box(node, &box, scene_node_at_iterator, &data)) {
+	bool found = scene_nodes_in_box(node, &box, scene_node_at_iterator, &data);
+
+	struct wlr_scene *scene = scene_node_get_root(node);
+	if (scene->validate_index && scene->index != NULL && node->parent == NULL) {
+		struct node_at_data linear_data = data;
+		bool linear_found = scene_nodes_in_box_linear(node, &box,
+			scene_node_at_iterator, &linear_data);
+		if (found != linear_found || (found && data.node != linear_data.node)) {
+			wlr_log(WLR_ERROR, "Scene spatial index mismatch at %f,%f: "
+				"got %p, expected %p", lx, ly,
+				found ? (void *)data.node : NULL,
+				linear_found ? (void *)linear_data.node : NULL);
+		}
+	}
+
+	if (found) {
 		if (nx) {
 			*nx = data.rx;
 		}
@@ -1331,6 +1784,7 @@ struct render_list_entry {
 	struct wlr_scene_node *node;
 	bool sent_dmabuf_feedback;
 	bool highlight_transparent_region;
+	bool offloaded; // displayed on an output layer this frame
 	int x, y;
 };
 
@@ -1385,8 +1839,25 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 	case WLR_SCENE_NODE_BUFFER:;
 		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
 
-		struct wlr_texture *texture = scene_buffer_get_texture(scene_buffer,
-			data->output->output->renderer);
+		struct wlr_renderer *renderer = data->output->output->renderer;
+		struct wlr_fbox src_box = scene_buffer->src_box;
+		struct wlr_texture *texture = NULL;
+		struct wlr_box atlas_box;
+		if (scene_buffer->atlas_entry != NULL) {
+			texture = atlas_entry_get_texture(scene_buffer->atlas_entry, &atlas_box);
+		}
+		if (texture != NULL && texture->renderer == renderer) {
+			if (wlr_fbox_empty(&src_box)) {
+				src_box = (struct wlr_fbox){
+					.width = atlas_box.width,
+					.height = atlas_box.height,
+				};
+			}
+			src_box.x += atlas_box.x;
+			src_box.y += atlas_box.y;
+		} else {
+			texture = scene_buffer_get_texture(scene_buffer, renderer);
+		}
 		if (texture == NULL) {
 			scene_output_damage(data->output, &render_region);
 			break;
@@ -1398,7 +1869,7 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 
 		wlr_render_pass_add_texture(data->render_pass, &(struct wlr_render_texture_options) {
 			.texture = texture,
-			.src_box = scene_buffer->src_box,
+			.src_box = src_box,
 			.dst_box = dst_box,
 			.transform = transform,
 			.clip = &render_region,
@@ -1432,6 +1903,76 @@ static void scene_entry_render(struct render_list_entry *entry, const struct ren
 	pixman_region32_fini(&render_region);
 }
 
+static void scene_handle_atlas_renderer_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene *scene =
+		wl_container_of(listener, scene, atlas_renderer_destroy);
+	wl_list_remove(&scene->atlas_renderer_destroy.link);
+	wl_list_init(&scene->atlas_renderer_destroy.link);
+	// Entries left in buffer nodes stop referencing a texture, and are
+	// replaced the next time the nodes are rendered
+	atlas_destroy(scene->atlas);
+	scene->atlas = NULL;
+}
+
+/**
+ * Pack the small buffers about to be rendered into the atlas. This happens
+ * before the render pass begins, so that the uploads don't land in its middle.
+ */
+static void scene_output_pack_atlas(struct wlr_scene_output *scene_output,
+		struct render_list_entry *list, int list_len) {
+	struct wlr_scene *scene = scene_output->scene;
+	struct wlr_renderer *renderer = scene_output->output->renderer;
+	if (!scene->atlas_enabled) {
+		return;
+	}
+
+	if (scene->atlas == NULL) {
+		scene->atlas = atlas_create(renderer);
+		if (scene->atlas == NULL) {
+			return;
+		}
+		scene->atlas_renderer_destroy.notify = scene_handle_atlas_renderer_destroy;
+		wl_signal_add(&renderer->events.destroy, &scene->atlas_renderer_destroy);
+	}
+	if (scene->atlas->renderer != renderer) {
+		return;
+	}
+
+	for (int i = 0; i < list_len; i++) {
+		struct wlr_scene_node *node = list[i].node;
+		if (node->type != WLR_SCENE_NODE_BUFFER) {
+			continue;
+		}
+
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+		struct wlr_box box;
+		if (scene_buffer->atlas_entry != NULL &&
+				atlas_entry_get_texture(scene_buffer->atlas_entry, &box) != NULL) {
+			continue;
+		}
+
+		// Client buffers come with their own texture, updated in place
+		if (scene_buffer->buffer == NULL || scene_buffer->texture != NULL ||
+				scene_buffer->wait_timeline != NULL ||
+				wlr_client_buffer_get(scene_buffer->buffer) != NULL) {
+			continue;
+		}
+
+		struct wlr_atlas_entry *entry = atlas_add(scene->atlas, scene_buffer->buffer);
+		if (entry == NULL) {
+			continue;
+		}
+		scene_buffer_set_atlas_entry(scene_buffer, entry);
+
+		// Like textures, entries hold a copy of the buffer contents
+		if (scene_buffer->own_buffer) {
+			scene_buffer->own_buffer = false;
+			wlr_buffer_unlock(scene_buffer->buffer);
+		}
+	}
+}
+
 static void scene_handle_linux_dmabuf_v1_destroy(struct wl_listener *listener,
 		void *data) {
 	struct wlr_scene *scene =
@@ -1548,6 +2089,31 @@ static void scene_output_handle_commit(struct wl_listener *listener, void *data)
 		}
 	}
 
+	if ((state->committed & WLR_OUTPUT_STATE_LAYERS) &&
+			state->layers == scene_output->layer_states) {
+		bool active = false, rejected = false;
+		for (size_t i = 0; i < state->layers_len; i++) {
+			if (state->layers[i].buffer != NULL) {
+				active = true;
+				rejected = rejected || !state->layers[i].accepted;
+			}
+		}
+		scene_output->layers_active = active;
+
+		if (rejected) {
+			// The backend didn't display a layer it accepted during the
+			// test, its contents are missing from this frame
+			wlr_log(WLR_DEBUG, "Output layers rejected on commit, "
+				"falling back to composition");
+			scene_output->layers_rejected = scene_output->layers_prev;
+			scene_output->layers_accepted.len = 0;
+			scene_output_damage_whole(scene_output);
+		}
+	}
+	if ((state->committed & WLR_OUTPUT_STATE_ENABLED) && !state->enabled) {
+		scene_output->layers_active = false;
+	}
+
 	bool force_update = state->committed & (
 		WLR_OUTPUT_STATE_TRANSFORM |
 		WLR_OUTPUT_STATE_SCALE |
@@ -1609,6 +2175,7 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 	wlr_damage_ring_init(&scene_output->damage_ring);
 	pixman_region32_init(&scene_output->pending_commit_damage);
 	wl_list_init(&scene_output->damage_highlight_regions);
+	scene_output->render_list_dirty = true;
 
 	int prev_output_index = -1;
 	struct wl_list *prev_output_link = &scene->outputs;
@@ -1675,6 +2242,10 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
 		highlight_region_destroy(damage);
 	}
 
+	for (size_t i = 0; i < scene_output->layers_len; i++) {
+		wlr_output_layer_destroy(scene_output->layers[i]);
+	}
+
 	wlr_addon_finish(&scene_output->addon);
 	wlr_damage_ring_finish(&scene_output->damage_ring);
 	pixman_region32_fini(&scene_output->pending_commit_damage);
@@ -1711,6 +2282,13 @@ void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
 	scene_output_update_geometry(scene_output, false);
 }
 
+static void scene_invalidate_render_lists(struct wlr_scene *scene) {
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		scene_output->render_list_dirty = true;
+	}
+}
+
 static bool scene_node_invisible(struct wlr_scene_node *node) {
 	if (node->type == WLR_SCENE_NODE_TREE) {
 		return true;
@@ -1721,7 +2299,8 @@ static bool scene_node_invisible(struct wlr_scene_node *node) {
 	} else if (node->type == WLR_SCENE_NODE_BUFFER) {
 		struct wlr_scene_buffer *buffer = wlr_scene_buffer_from_node(node);
 
-		return buffer->buffer == NULL && buffer->texture == NULL;
+		return buffer->buffer == NULL && buffer->texture == NULL &&
+			buffer->atlas_entry == NULL;
 	}
 
 	return false;
@@ -1733,6 +2312,7 @@ struct render_list_constructor_data {
 	bool calculate_visibility;
 	bool highlight_transparent_region;
 	bool fractional_scale;
+	bool failed;
 };
 
 static bool construct_render_list_iterator(struct wlr_scene_node *node,
@@ -1771,6 +2351,7 @@ static bool construct_render_list_iterator(struct wlr_scene_node *node,
 
 	struct render_list_entry *entry = wl_array_add(data->render_list, sizeof(*entry));
 	if (!entry) {
+		data->failed = true;
 		return false;
 	}
 
@@ -1815,6 +2396,286 @@ static void scene_buffer_send_dmabuf_feedback(const struct wlr_scene *scene,
 	wlr_linux_dmabuf_feedback_v1_finish(&feedback);
 }
 
+/**
+ * Get the buffer to hand over to the backend to display a scene buffer
+ * without compositing it.
+ */
+static struct wlr_buffer *scene_buffer_get_scanout_buffer(
+		struct wlr_scene_buffer *scene_buffer) {
+	struct wlr_buffer *wlr_buffer = scene_buffer->buffer;
+	struct wlr_client_buffer *client_buffer = wlr_client_buffer_get(wlr_buffer);
+	if (client_buffer != NULL && client_buffer->source != NULL && client_buffer->source->n_locks > 0) {
+		wlr_buffer = client_buffer->source;
+	}
+	return wlr_buffer;
+}
+
+static bool layer_plan_equal(const struct wlr_scene_layer_plan *a,
+		const struct wlr_scene_layer_plan *b) {
+	if (a->len != b->len) {
+		return false;
+	}
+	for (size_t i = 0; i < a->len; i++) {
+		if (a->entries[i].scene_buffer != b->entries[i].scene_buffer ||
+				!wlr_fbox_equal(&a->entries[i].src_box, &b->entries[i].src_box) ||
+				!wlr_box_equal(&a->entries[i].dst_box, &b->entries[i].dst_box) ||
+				a->entries[i].buffer_width != b->entries[i].buffer_width ||
+				a->entries[i].buffer_height != b->entries[i].buffer_height ||
+				a->entries[i].buffer_caps != b->entries[i].buffer_caps ||
+				a->entries[i].format != b->entries[i].format ||
+				a->entries[i].modifier != b->entries[i].modifier) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Check whether a render list entry can be displayed on an output layer,
+ * and append it to the plan if so.
+ */
+static bool scene_entry_plan_layer(struct render_list_entry *entry,
+		const struct render_data *data, struct wlr_scene_layer_plan *plan) {
+	struct wlr_scene_node *node = entry->node;
+	if (node->type != WLR_SCENE_NODE_BUFFER || entry->highlight_transparent_region) {
+		return false;
+	}
+
+	// Output layers have no way to wait on a timeline, to blend with an
+	// opacity or to apply a transform other than the output's
+	struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(node);
+	if (scene_buffer->buffer == NULL || scene_buffer->wait_timeline != NULL ||
+			scene_buffer->opacity != 1 ||
+			scene_buffer->transform != data->transform) {
+		return false;
+	}
+
+	struct wlr_box dst_box = {
+		.x = entry->x - data->output->x,
+		.y = entry->y - data->output->y,
+	};
+	scene_node_get_size(node, &dst_box.width, &dst_box.height);
+	transform_output_box(&dst_box, data);
+	if (wlr_box_empty(&dst_box)) {
+		return false;
+	}
+
+	// Clients may switch to a buffer of another kind, format or modifier
+	// without the node changing: these need to be tested again
+	struct wlr_buffer *buffer = scene_buffer_get_scanout_buffer(scene_buffer);
+	struct wlr_scene_layer_plan_entry *plan_entry = &plan->entries[plan->len];
+	*plan_entry = (struct wlr_scene_layer_plan_entry){
+		.scene_buffer = scene_buffer,
+		.src_box = scene_buffer->src_box,
+		.dst_box = dst_box,
+		.buffer_width = buffer->width,
+		.buffer_height = buffer->height,
+	};
+	struct wlr_dmabuf_attributes dmabuf;
+	struct wlr_shm_attributes shm;
+	if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		plan_entry->buffer_caps = WLR_BUFFER_CAP_DMABUF;
+		plan_entry->format = dmabuf.format;
+		plan_entry->modifier = dmabuf.modifier;
+	} else if (wlr_buffer_get_shm(buffer, &shm)) {
+		plan_entry->buffer_caps = WLR_BUFFER_CAP_SHM;
+		plan_entry->format = shm.format;
+	}
+	plan->len++;
+	return true;
+}
+
+static void scene_output_set_layers(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state, struct render_list_entry **offloaded,
+		const struct wlr_scene_layer_plan *plan) {
+	// Layers are stacked in the order of their states, the unused ones are
+	// left at the bottom
+	size_t unused = scene_output->layers_len - plan->len;
+	for (size_t i = 0; i < scene_output->layers_len; i++) {
+		struct wlr_output_layer_state *layer_state = &scene_output->layer_states[i];
+		*layer_state = (struct wlr_output_layer_state){
+			.layer = scene_output->layers[i],
+		};
+		if (i < unused) {
+			continue;
+		}
+
+		struct wlr_scene_buffer *scene_buffer =
+			wlr_scene_buffer_from_node(offloaded[i - unused]->node);
+		layer_state->buffer = scene_buffer_get_scanout_buffer(scene_buffer);
+		layer_state->src_box = plan->entries[i - unused].src_box;
+		layer_state->dst_box = plan->entries[i - unused].dst_box;
+	}
+	wlr_output_state_set_layers(state, scene_output->layer_states,
+		scene_output->layers_len);
+}
+
+static bool scene_output_ensure_layers(struct wlr_scene_output *scene_output,
+		size_t len) {
+	while (scene_output->layers_len < len) {
+		struct wlr_output_layer *layer =
+			wlr_output_layer_create(scene_output->output);
+		if (layer == NULL) {
+			return false;
+		}
+		scene_output->layers[scene_output->layers_len++] = layer;
+	}
+	return true;
+}
+
+static void scene_output_damage_layer_plan(struct wlr_scene_output *scene_output,
+		const struct wlr_scene_layer_plan *plan) {
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	for (size_t i = 0; i < plan->len; i++) {
+		const struct wlr_box *box = &plan->entries[i].dst_box;
+		pixman_region32_union_rect(&damage, &damage,
+			box->x, box->y, box->width, box->height);
+	}
+	scene_output_damage(scene_output, &damage);
+	pixman_region32_fini(&damage);
+}
+
+/**
+ * Offload the top-most scene buffers to output layers, so that only the
+ * remaining entries need to be composited. An entry can only be offloaded if
+ * no composited entry is displayed above it, since layers are stacked on top
+ * of the primary buffer.
+ */
+static void scene_output_plan_layers(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state, const struct render_data *data,
+		struct render_list_entry *list_data, int list_len, bool allowed) {
+	struct wlr_scene *scene = scene_output->scene;
+	struct wlr_output *output = scene_output->output;
+
+	for (int i = 0; i < list_len; i++) {
+		list_data[i].offloaded = false;
+	}
+
+	// Layers created by someone else would need to be part of our states
+	allowed = allowed && scene->output_layers > 0 &&
+		scene_output->layers_frame >= scene_output->layers_retry_frame &&
+		!(state->committed & (WLR_OUTPUT_STATE_MODE |
+			WLR_OUTPUT_STATE_ENABLED |
+			WLR_OUTPUT_STATE_RENDER_FORMAT)) &&
+		(size_t)wl_list_length(&output->layers) == scene_output->layers_len &&
+		wlr_output_is_direct_scanout_allowed(output);
+	scene_output->layers_frame++;
+
+	// Plan from the top-most entry down
+	struct wlr_scene_layer_plan plan = {0};
+	struct render_list_entry *offloaded[WLR_SCENE_OUTPUT_LAYERS_CAP];
+	if (allowed) {
+		pixman_region32_t composited_above;
+		pixman_region32_init(&composited_above);
+		for (int i = 0; i < list_len && plan.len < scene->output_layers; i++) {
+			struct render_list_entry *entry = &list_data[i];
+
+			pixman_region32_t overlap;
+			pixman_region32_init(&overlap);
+			pixman_region32_intersect(&overlap, &entry->node->visible,
+				&composited_above);
+			bool covered = pixman_region32_not_empty(&overlap);
+			pixman_region32_fini(&overlap);
+
+			if (!covered && scene_entry_plan_layer(entry, data, &plan)) {
+				offloaded[plan.len - 1] = entry;
+			} else {
+				pixman_region32_union(&composited_above, &composited_above,
+					&entry->node->visible);
+			}
+		}
+		pixman_region32_fini(&composited_above);
+
+		// Layers are stacked bottom-most first
+		for (size_t i = 0; i < plan.len / 2; i++) {
+			size_t j = plan.len - 1 - i;
+			struct render_list_entry *tmp_entry = offloaded[i];
+			offloaded[i] = offloaded[j];
+			offloaded[j] = tmp_entry;
+			struct wlr_scene_layer_plan_entry tmp_plan = plan.entries[i];
+			plan.entries[i] = plan.entries[j];
+			plan.entries[j] = tmp_plan;
+		}
+	}
+
+	if (plan.len > 0 && layer_plan_equal(&plan, &scene_output->layers_rejected)) {
+		plan.len = 0;
+	}
+	if (plan.len > 0 && !scene_output_ensure_layers(scene_output, plan.len)) {
+		wlr_log(WLR_ERROR, "Failed to create output layers");
+		plan.len = 0;
+	}
+
+	if (plan.len > 0) {
+		scene_output_set_layers(scene_output, state, offloaded, &plan);
+
+		if (!layer_plan_equal(&plan, &scene_output->layers_accepted)) {
+			bool ok = wlr_output_test_state(output, state);
+			for (size_t i = 0; i < scene_output->layers_len; i++) {
+				const struct wlr_output_layer_state *layer_state =
+					&scene_output->layer_states[i];
+				ok = ok && (layer_state->buffer == NULL || layer_state->accepted);
+			}
+
+			if (ok) {
+				wlr_log(WLR_DEBUG, "Offloading %zu scene buffers to output layers",
+					plan.len);
+				scene_output->layers_accepted = plan;
+				scene_output->layers_backoff = 0;
+			} else {
+				scene_output->layers_rejected = plan;
+				scene_output->layers_backoff = scene_output->layers_backoff == 0 ?
+					MIN_LAYERS_BACKOFF : scene_output->layers_backoff * 2;
+				if (scene_output->layers_backoff > MAX_LAYERS_BACKOFF) {
+					scene_output->layers_backoff = MAX_LAYERS_BACKOFF;
+				}
+				scene_output->layers_retry_frame =
+					scene_output->layers_frame + scene_output->layers_backoff;
+				plan.len = 0;
+			}
+		}
+	}
+
+	if (plan.len == 0) {
+		if (scene_output->layers_active) {
+			// Disable the layers displayed by the last commit
+			scene_output_set_layers(scene_output, state, offloaded, &plan);
+		} else {
+			state->committed &= ~WLR_OUTPUT_STATE_LAYERS;
+		}
+	}
+
+	// The primary buffer needs to be repainted where entries started or
+	// stopped being offloaded
+	if (!layer_plan_equal(&plan, &scene_output->layers_prev)) {
+		scene_output_damage_layer_plan(scene_output, &scene_output->layers_prev);
+		scene_output_damage_layer_plan(scene_output, &plan);
+	}
+	scene_output->layers_prev = plan;
+
+	for (size_t i = 0; i < plan.len; i++) {
+		struct render_list_entry *entry = offloaded[i];
+		struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node(entry->node);
+		entry->offloaded = true;
+
+		if (scene_buffer->primary_output == scene_output) {
+			struct wlr_linux_dmabuf_feedback_v1_init_options options = {
+				.main_renderer = output->renderer,
+				.scanout_primary_output = output,
+			};
+			scene_buffer_send_dmabuf_feedback(scene, scene_buffer, &options);
+			entry->sent_dmabuf_feedback = true;
+		}
+
+		struct wlr_scene_output_sample_event sample_event = {
+			.output = scene_output,
+			.direct_scanout = true,
+		};
+		wl_signal_emit_mutable(&scene_buffer->events.output_sample, &sample_event);
+	}
+}
+
 static bool scene_entry_try_direct_scanout(struct render_list_entry *entry,
 		struct wlr_output_state *state, const struct render_data *data) {
 	struct wlr_scene_output *scene_output = data->output;
@@ -1885,13 +2746,7 @@ static bool scene_entry_try_direct_scanout(struct render_list_entry *entry,
 	scene_node_get_size(node, &pending.buffer_dst_box.width, &pending.buffer_dst_box.height);
 	transform_output_box(&pending.buffer_dst_box, data);
 
-	struct wlr_buffer *wlr_buffer = buffer->buffer;
-	struct wlr_client_buffer *client_buffer = wlr_client_buffer_get(wlr_buffer);
-	if (client_buffer != NULL && client_buffer->source != NULL && client_buffer->source->n_locks > 0) {
-		wlr_buffer = client_buffer->source;
-	}
-
-	wlr_output_state_set_buffer(&pending, wlr_buffer);
+	wlr_output_state_set_buffer(&pending, scene_buffer_get_scanout_buffer(buffer));
 	if (buffer->wait_timeline != NULL) {
 		wlr_output_state_set_wait_timeline(&pending, buffer->wait_timeline, buffer->wait_point);
 	}
@@ -1969,16 +2824,19 @@ static void scene_output_state_attempt_gamma(struct wlr_scene_output *scene_outp
 	wlr_output_state_finish(&gamma_pending);
 }
 
-bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
+static bool scene_output_build_state(struct wlr_scene_output *scene_output,
 		struct wlr_output_state *state, const struct wlr_scene_output_state_options *options) {
 	struct wlr_scene_output_state_options default_options = {0};
 	if (!options) {
 		options = &default_options;
 	}
 	struct wlr_scene_timer *timer = options->timer;
+	struct wlr_frame_stats *stats = wlr_frame_stats_try_get(scene_output->output);
 	struct timespec start_time;
-	if (timer) {
+	if (timer || stats) {
 		clock_gettime(CLOCK_MONOTONIC, &start_time);
+	}
+	if (timer) {
 		wlr_scene_timer_finish(timer);
 		*timer = (struct wlr_scene_timer){0};
 	}
@@ -2035,13 +2893,37 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		.fractional_scale = floor(render_data.scale) != render_data.scale,
 	};
 
-	list_con.render_list->size = 0;
-	scene_nodes_in_box(&scene_output->scene->tree.node, &list_con.box,
-		construct_render_list_iterator, &list_con);
-	array_realloc(list_con.render_list, list_con.render_list->size);
+	if (scene_output->render_list_dirty ||
+			!wlr_box_equal(&scene_output->render_list_box, &list_con.box) ||
+			scene_output->render_list_fractional_scale != list_con.fractional_scale) {
+		list_con.render_list->size = 0;
+		scene_nodes_in_box(&scene_output->scene->tree.node, &list_con.box,
+			construct_render_list_iterator, &list_con);
+		array_realloc(list_con.render_list, list_con.render_list->size);
+
+		scene_output->render_list_dirty = list_con.failed;
+		scene_output->render_list_box = list_con.box;
+		scene_output->render_list_fractional_scale = list_con.fractional_scale;
+		scene_output->render_list_rebuilds++;
+	} else {
+		struct render_list_entry *entry;
+		wl_array_for_each(entry, list_con.render_list) {
+			entry->sent_dmabuf_feedback = false;
+		}
+		scene_output->render_list_reuses++;
+	}
+
+	if (timer) {
+		timer->render_list_rebuilds = scene_output->render_list_rebuilds;
+		timer->render_list_reuses = scene_output->render_list_reuses;
+	}
 
 	struct render_list_entry *list_data = list_con.render_list->data;
 	int list_len = list_con.render_list->size / sizeof(*list_data);
+	if (timer) {
+		timer->render_list_len = list_len;
+	}
+	TRACE_COUNTER("render_list_len", list_len);
 
 	if (debug_damage == WLR_SCENE_DEBUG_DAMAGE_RERENDER) {
 		scene_output_damage_whole(scene_output);
@@ -2085,15 +2967,29 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		pixman_region32_fini(&acc_damage);
 	}
 
+	// Output layers bypass color transforms and damage highlighting
+	scene_output_plan_layers(scene_output, state, &render_data, list_data, list_len,
+		options->color_transform == NULL &&
+		debug_damage != WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT);
+
+	int composited_len = 0;
+	struct render_list_entry *composited_entry = NULL;
+	for (int i = 0; i < list_len; i++) {
+		if (!list_data[i].offloaded) {
+			composited_len++;
+			composited_entry = &list_data[i];
+		}
+	}
+
 	wlr_output_state_set_damage(state, &scene_output->pending_commit_damage);
 
 	// We only want to try direct scanout if:
-	// - There is only one entry in the render list
+	// - There is only one entry left to composite in the render list
 	// - There are no color transforms that need to be applied
 	// - Damage highlight debugging is not enabled
 	bool scanout = options->color_transform == NULL &&
-		list_len == 1 && debug_damage != WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT &&
-		scene_entry_try_direct_scanout(&list_data[0], state, &render_data);
+		composited_len == 1 && debug_damage != WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT &&
+		scene_entry_try_direct_scanout(composited_entry, state, &render_data);
 
 	if (scene_output->prev_scanout != scanout) {
 		scene_output->prev_scanout = scanout;
@@ -2104,11 +3000,19 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	if (scanout) {
 		scene_output_state_attempt_gamma(scene_output, state);
 
-		if (timer) {
+		if (timer || stats) {
 			struct timespec end_time, duration;
 			clock_gettime(CLOCK_MONOTONIC, &end_time);
 			timespec_sub(&duration, &end_time, &start_time);
-			timer->pre_render_duration = timespec_to_nsec(&duration);
+			int64_t duration_ns = timespec_to_nsec(&duration);
+			if (timer) {
+				timer->pre_render_duration = duration_ns;
+			}
+			if (stats) {
+				wlr_frame_stats_add_sample(stats, WLR_FRAME_STATS_BUILD, duration_ns);
+				// Nothing gets rendered for this frame
+				wlr_frame_stats_add_render_timer(stats, NULL);
+			}
 		}
 		return true;
 	}
@@ -2129,24 +3033,41 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 	assert(buffer->width == resolution_width && buffer->height == resolution_height);
 
-	if (timer) {
-		timer->render_timer = wlr_render_timer_create(output->renderer);
+	struct wlr_render_timer *render_timer = NULL;
+	struct timespec render_start_time = {0};
+	if (timer || stats) {
+		render_timer = wlr_render_timer_create(output->renderer);
 
-		struct timespec end_time, duration;
-		clock_gettime(CLOCK_MONOTONIC, &end_time);
-		timespec_sub(&duration, &end_time, &start_time);
-		timer->pre_render_duration = timespec_to_nsec(&duration);
+		clock_gettime(CLOCK_MONOTONIC, &render_start_time);
+		struct timespec duration;
+		timespec_sub(&duration, &render_start_time, &start_time);
+		int64_t duration_ns = timespec_to_nsec(&duration);
+		if (timer) {
+			// The caller owns the timer, the statistics don't get a GPU
+			// sample for this frame
+			timer->render_timer = render_timer;
+			timer->pre_render_duration = duration_ns;
+		}
+		if (stats) {
+			wlr_frame_stats_add_sample(stats, WLR_FRAME_STATS_BUILD, duration_ns);
+			wlr_frame_stats_add_render_timer(stats, timer ? NULL : render_timer);
+		}
 	}
 
+	scene_output_pack_atlas(scene_output, list_data, list_len);
+
 	scene_output->in_point++;
 	struct wlr_render_pass *render_pass = wlr_renderer_begin_buffer_pass(output->renderer, buffer,
 			&(struct wlr_buffer_pass_options){
-		.timer = timer ? timer->render_timer : NULL,
+		.timer = render_timer,
 		.color_transform = options->color_transform,
 		.signal_timeline = scene_output->in_timeline,
 		.signal_point = scene_output->in_point,
 	});
 	if (render_pass == NULL) {
+		if (stats) {
+			wlr_frame_stats_add_render_timer(stats, NULL);
+		}
 		wlr_buffer_unlock(buffer);
 		return false;
 	}
@@ -2156,6 +3077,11 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	pixman_region32_init(&render_data.damage);
 	wlr_damage_ring_rotate_buffer(&scene_output->damage_ring, buffer,
 		&render_data.damage);
+	uint32_t damage_area = region_area(&render_data.damage);
+	if (timer) {
+		timer->damage_area = damage_area;
+	}
+	TRACE_COUNTER("damage_area", damage_area);
 
 	pixman_region32_t background;
 	pixman_region32_init(&background);
@@ -2202,6 +3128,9 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 
 	for (int i = list_len - 1; i >= 0; i--) {
 		struct render_list_entry *entry = &list_data[i];
+		if (entry->offloaded) {
+			continue;
+		}
 		scene_entry_render(entry, &render_data);
 
 		if (entry->node->type == WLR_SCENE_NODE_BUFFER) {
@@ -2238,6 +3167,9 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	pixman_region32_fini(&render_data.damage);
 
 	if (!wlr_render_pass_submit(render_pass)) {
+		if (stats) {
+			wlr_frame_stats_add_render_timer(stats, NULL);
+		}
 		wlr_buffer_unlock(buffer);
 
 		// if we failed to render the buffer, it will have undefined contents
@@ -2246,6 +3178,14 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 		return false;
 	}
 
+	if (stats) {
+		struct timespec end_time, duration;
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		timespec_sub(&duration, &end_time, &render_start_time);
+		wlr_frame_stats_add_sample(stats, WLR_FRAME_STATS_RENDER_CPU,
+			timespec_to_nsec(&duration));
+	}
+
 	wlr_output_state_set_buffer(state, buffer);
 	wlr_buffer_unlock(buffer);
 
@@ -2259,6 +3199,14 @@ bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
 	return true;
 }
 
+bool wlr_scene_output_build_state(struct wlr_scene_output *scene_output,
+		struct wlr_output_state *state, const struct wlr_scene_output_state_options *options) {
+	TRACE_BEGIN("wlr_scene_output_build_state");
+	bool ok = scene_output_build_state(scene_output, state, options);
+	TRACE_END("wlr_scene_output_build_state");
+	return ok;
+}
+
 int64_t wlr_scene_timer_get_duration_ns(struct wlr_scene_timer *timer) {
 	int64_t pre_render = timer->pre_render_duration;
 	if (!timer->render_timer) {
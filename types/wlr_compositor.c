@@ -15,6 +15,7 @@
 #include "types/wlr_subcompositor.h"
 #include "util/array.h"
 #include "util/time.h"
+#include "util/trace.h"
 
 #define COMPOSITOR_VERSION 6
 #define CALLBACK_VERSION 1
@@ -512,6 +513,8 @@ static void surface_commit_state(struct wlr_surface *surface,
 		struct wlr_surface_state *next) {
 	assert(next->cached_state_locks == 0);
 
+	TRACE_BEGIN("surface_commit_state");
+
 	bool invalid_buffer = next->committed & WLR_SURFACE_STATE_BUFFER;
 
 	if (invalid_buffer && next->buffer == NULL) {
@@ -564,11 +567,14 @@ static void surface_commit_state(struct wlr_surface *surface,
 	// released immediately on commit when they are uploaded to the GPU.
 	wlr_buffer_unlock(surface->current.buffer);
 	surface->current.buffer = NULL;
+
+	TRACE_END("surface_commit_state");
 }
 
 static void surface_handle_commit(struct wl_client *client,
 		struct wl_resource *resource) {
 	struct wlr_surface *surface = wlr_surface_from_resource(resource);
+	TRACE_INSTANT("client_commit");
 	surface->handling_commit = true;
 
 	surface_finalize_pending(surface);
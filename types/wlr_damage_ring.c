@@ -7,11 +7,24 @@
 #include <wlr/util/box.h>
 
 #define WLR_DAMAGE_RING_MAX_RECTS 20
+#define WLR_DAMAGE_RING_MERGE_WASTE_RATIO 0.25f
+// Number of previously merged boxes a rectangle is checked against
+#define MERGE_WINDOW 8
+
+struct merge_box {
+	pixman_box32_t box;
+	// Damaged area inside the box
+	uint64_t damaged;
+};
 
 void wlr_damage_ring_init(struct wlr_damage_ring *ring) {
-	*ring = (struct wlr_damage_ring){ 0 };
+	*ring = (struct wlr_damage_ring){
+		.merge_waste_ratio = WLR_DAMAGE_RING_MERGE_WASTE_RATIO,
+		.max_rects = WLR_DAMAGE_RING_MAX_RECTS,
+	};
 	pixman_region32_init(&ring->current);
 	wl_list_init(&ring->buffers);
+	wl_array_init(&ring->boxes);
 }
 
 static void buffer_destroy(struct wlr_damage_ring_buffer *entry) {
@@ -27,11 +40,136 @@ void wlr_damage_ring_finish(struct wlr_damage_ring *ring) {
 	wl_list_for_each_safe(entry, tmp_entry, &ring->buffers, link) {
 		buffer_destroy(entry);
 	}
+	wl_array_release(&ring->boxes);
+}
+
+static uint64_t box_area(const pixman_box32_t *box) {
+	return (uint64_t)(box->x2 - box->x1) * (uint64_t)(box->y2 - box->y1);
+}
+
+static uint64_t region_area(const pixman_region32_t *region) {
+	int rects_len;
+	const pixman_box32_t *rects =
+		pixman_region32_rectangles((pixman_region32_t *)region, &rects_len);
+	uint64_t area = 0;
+	for (int i = 0; i < rects_len; i++) {
+		area += box_area(&rects[i]);
+	}
+	return area;
+}
+
+static void box_union(pixman_box32_t *dst, const pixman_box32_t *a,
+		const pixman_box32_t *b) {
+	*dst = (pixman_box32_t){
+		.x1 = a->x1 < b->x1 ? a->x1 : b->x1,
+		.y1 = a->y1 < b->y1 ? a->y1 : b->y1,
+		.x2 = a->x2 > b->x2 ? a->x2 : b->x2,
+		.y2 = a->y2 > b->y2 ? a->y2 : b->y2,
+	};
+}
+
+/**
+ * Replace a region with a superset made of fewer rectangles, following the
+ * simplification policy of the ring.
+ *
+ * Rectangles are merged greedily, in the band order pixman keeps them in, with
+ * one of the last few boxes if the bounding box doesn't waste too much area.
+ * If there are still too many boxes, consecutive ones are grouped into
+ * max_rects bounding boxes. As a last resort, the region is replaced with its
+ * extents.
+ */
+static void damage_ring_simplify(struct wlr_damage_ring *ring,
+		pixman_region32_t *region) {
+	int rects_len;
+	const pixman_box32_t *rects = pixman_region32_rectangles(region, &rects_len);
+	if (rects_len <= 1) {
+		return;
+	}
+
+	uint64_t area_before = region_area(region);
+	pixman_box32_t extents = *pixman_region32_extents(region);
+
+	pixman_region32_t simplified;
+	ring->boxes.size = 0;
+	struct merge_box *merged = wl_array_add(&ring->boxes,
+		rects_len * (sizeof(*merged) + sizeof(pixman_box32_t)));
+	if (merged == NULL) {
+		pixman_region32_init_with_extents(&simplified, &extents);
+		goto out;
+	}
+	pixman_box32_t *boxes = (pixman_box32_t *)&merged[rects_len];
+
+	int merged_len = 0;
+	for (int i = 0; i < rects_len; i++) {
+		const pixman_box32_t *rect = &rects[i];
+		uint64_t rect_area = box_area(rect);
+
+		bool found = false;
+		for (int j = merged_len - 1; j >= 0 && j >= merged_len - MERGE_WINDOW; j--) {
+			pixman_box32_t bounds;
+			box_union(&bounds, &merged[j].box, rect);
+			uint64_t bounds_area = box_area(&bounds);
+			// Rectangles of a region don't overlap
+			uint64_t damaged = merged[j].damaged + rect_area;
+			if (bounds_area - damaged <= ring->merge_waste_ratio * bounds_area) {
+				merged[j].box = bounds;
+				merged[j].damaged = damaged;
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			merged[merged_len++] = (struct merge_box){
+				.box = *rect,
+				.damaged = rect_area,
+			};
+		}
+	}
+
+	int boxes_len;
+	if (ring->max_rects > 0 && merged_len > ring->max_rects) {
+		boxes_len = ring->max_rects;
+		for (int i = 0; i < boxes_len; i++) {
+			int start = (int64_t)i * merged_len / boxes_len;
+			int end = (int64_t)(i + 1) * merged_len / boxes_len;
+			boxes[i] = merged[start].box;
+			for (int j = start + 1; j < end; j++) {
+				box_union(&boxes[i], &boxes[i], &merged[j].box);
+			}
+		}
+	} else {
+		boxes_len = merged_len;
+		for (int i = 0; i < boxes_len; i++) {
+			boxes[i] = merged[i].box;
+		}
+	}
+
+	// Overlapping boxes may be split again into more rectangles
+	pixman_region32_init_rects(&simplified, boxes, boxes_len);
+	if (ring->max_rects > 0 &&
+			pixman_region32_n_rects(&simplified) > ring->max_rects) {
+		pixman_region32_fini(&simplified);
+		pixman_region32_init_with_extents(&simplified, &extents);
+	}
+
+out:
+	pixman_region32_copy(region, &simplified);
+	pixman_region32_fini(&simplified);
+
+	ring->stats.simplified++;
+	ring->stats.rects_before += rects_len;
+	ring->stats.rects_after += pixman_region32_n_rects(region);
+	ring->stats.area_before += area_before;
+	ring->stats.area_after += region_area(region);
 }
 
 void wlr_damage_ring_add(struct wlr_damage_ring *ring,
 		const pixman_region32_t *damage) {
 	pixman_region32_union(&ring->current, &ring->current, damage);
+	if (ring->max_rects > 0 &&
+			pixman_region32_n_rects(&ring->current) > ring->max_rects) {
+		damage_ring_simplify(ring, &ring->current);
+	}
 }
 
 void wlr_damage_ring_add_box(struct wlr_damage_ring *ring,
@@ -39,6 +177,10 @@ void wlr_damage_ring_add_box(struct wlr_damage_ring *ring,
 	pixman_region32_union_rect(&ring->current,
 		&ring->current, box->x, box->y,
 		box->width, box->height);
+	if (ring->max_rects > 0 &&
+			pixman_region32_n_rects(&ring->current) > ring->max_rects) {
+		damage_ring_simplify(ring, &ring->current);
+	}
 }
 
 void wlr_damage_ring_add_whole(struct wlr_damage_ring *ring) {
@@ -87,16 +229,7 @@ void wlr_damage_ring_rotate_buffer(struct wlr_damage_ring *ring,
 		}
 
 		pixman_region32_intersect_rect(damage, damage, 0, 0, buffer->width, buffer->height);
-
-		// Check the number of rectangles
-		int n_rects = pixman_region32_n_rects(damage);
-		if (n_rects > WLR_DAMAGE_RING_MAX_RECTS) {
-			pixman_box32_t *extents = pixman_region32_extents(damage);
-			pixman_region32_union_rect(damage, damage,
-				extents->x1, extents->y1,
-				extents->x2 - extents->x1,
-				extents->y2 - extents->y1);
-		}
+		damage_ring_simplify(ring, damage);
 
 		// rotate
 		entry_squash_damage(entry);
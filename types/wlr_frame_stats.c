@@ -0,0 +1,251 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_frame_stats.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+#include "util/time.h"
+
+// Frames waiting for their present event. Backends send one present event
+// per committed frame, so this only fills up when they don't send any.
+#define MAX_INFLIGHT 16
+
+struct wlr_frame_stats_inflight {
+	uint32_t commit_seq;
+	struct timespec commit_time;
+	struct wlr_render_timer *timer; // may be NULL
+};
+
+static const char *const metric_names[WLR_FRAME_STATS_METRIC_COUNT] = {
+	[WLR_FRAME_STATS_BUILD] = "build",
+	[WLR_FRAME_STATS_RENDER_CPU] = "render (CPU)",
+	[WLR_FRAME_STATS_RENDER_GPU] = "render (GPU)",
+	[WLR_FRAME_STATS_PRESENT_LATENCY] = "present latency",
+};
+
+static void inflight_pop(struct wlr_frame_stats *stats, size_t n) {
+	struct wlr_frame_stats_inflight *inflight = stats->inflight.data;
+	size_t len = stats->inflight.size / sizeof(*inflight);
+	assert(n <= len);
+
+	for (size_t i = 0; i < n; i++) {
+		if (inflight[i].timer != NULL) {
+			wlr_render_timer_destroy(inflight[i].timer);
+		}
+	}
+	memmove(inflight, &inflight[n], (len - n) * sizeof(*inflight));
+	stats->inflight.size -= n * sizeof(*inflight);
+}
+
+static void stats_destroy(struct wlr_frame_stats *stats) {
+	inflight_pop(stats, stats->inflight.size / sizeof(struct wlr_frame_stats_inflight));
+	wl_array_release(&stats->inflight);
+	if (stats->render_timer != NULL) {
+		wlr_render_timer_destroy(stats->render_timer);
+	}
+	wl_list_remove(&stats->output_commit.link);
+	wl_list_remove(&stats->output_present.link);
+	wlr_addon_finish(&stats->addon);
+	free(stats);
+}
+
+static void addon_handle_destroy(struct wlr_addon *addon) {
+	struct wlr_frame_stats *stats = wl_container_of(addon, stats, addon);
+	stats_destroy(stats);
+}
+
+static const struct wlr_addon_interface addon_impl = {
+	.name = "wlr_frame_stats",
+	.destroy = addon_handle_destroy,
+};
+
+static void handle_output_commit(struct wl_listener *listener, void *data) {
+	struct wlr_frame_stats *stats = wl_container_of(listener, stats, output_commit);
+	const struct wlr_output_event_commit *event = data;
+
+	if (!(event->state->committed & WLR_OUTPUT_STATE_BUFFER)) {
+		return;
+	}
+
+	if (stats->inflight.size / sizeof(struct wlr_frame_stats_inflight) >= MAX_INFLIGHT) {
+		inflight_pop(stats, 1);
+	}
+
+	struct wlr_frame_stats_inflight *inflight =
+		wl_array_add(&stats->inflight, sizeof(*inflight));
+	if (inflight == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+	*inflight = (struct wlr_frame_stats_inflight){
+		.commit_seq = stats->output->commit_seq,
+		.commit_time = *event->when,
+		.timer = stats->render_timer,
+	};
+	stats->render_timer = NULL;
+}
+
+static void handle_output_present(struct wl_listener *listener, void *data) {
+	struct wlr_frame_stats *stats = wl_container_of(listener, stats, output_present);
+	const struct wlr_output_event_present *event = data;
+
+	if (event->presented) {
+		stats->presented++;
+	} else {
+		stats->dropped++;
+	}
+
+	// Frames older than this one won't get a present event anymore
+	struct wlr_frame_stats_inflight *inflight = stats->inflight.data;
+	size_t len = stats->inflight.size / sizeof(*inflight);
+	size_t i = 0;
+	while (i < len && (int32_t)(event->commit_seq - inflight[i].commit_seq) > 0) {
+		i++;
+	}
+	if (i == len || inflight[i].commit_seq != event->commit_seq) {
+		inflight_pop(stats, i);
+		return;
+	}
+
+	if (event->presented) {
+		struct timespec latency;
+		timespec_sub(&latency, &event->when, &inflight[i].commit_time);
+		int64_t latency_ns = timespec_to_nsec(&latency);
+		if (latency_ns >= 0) {
+			wlr_frame_stats_add_sample(stats, WLR_FRAME_STATS_PRESENT_LATENCY,
+				latency_ns);
+		}
+
+		if (inflight[i].timer != NULL) {
+			int duration_ns = wlr_render_timer_get_duration_ns(inflight[i].timer);
+			if (duration_ns >= 0) {
+				wlr_frame_stats_add_sample(stats, WLR_FRAME_STATS_RENDER_GPU,
+					duration_ns);
+			}
+		}
+	}
+
+	inflight_pop(stats, i + 1);
+}
+
+struct wlr_frame_stats *wlr_frame_stats_try_get(struct wlr_output *output) {
+	struct wlr_addon *addon = wlr_addon_find(&output->addons, NULL, &addon_impl);
+	if (addon == NULL) {
+		return NULL;
+	}
+	struct wlr_frame_stats *stats = wl_container_of(addon, stats, addon);
+	return stats;
+}
+
+struct wlr_frame_stats *wlr_frame_stats_get(struct wlr_output *output) {
+	struct wlr_frame_stats *stats = wlr_frame_stats_try_get(output);
+	if (stats != NULL) {
+		return stats;
+	}
+
+	stats = calloc(1, sizeof(*stats));
+	if (stats == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	stats->output = output;
+	wl_array_init(&stats->inflight);
+
+	stats->output_commit.notify = handle_output_commit;
+	wl_signal_add(&output->events.commit, &stats->output_commit);
+	stats->output_present.notify = handle_output_present;
+	wl_signal_add(&output->events.present, &stats->output_present);
+
+	wlr_addon_init(&stats->addon, &output->addons, NULL, &addon_impl);
+
+	return stats;
+}
+
+void wlr_frame_stats_add_sample(struct wlr_frame_stats *stats,
+		enum wlr_frame_stats_metric metric, int64_t duration_ns) {
+	assert(metric < WLR_FRAME_STATS_METRIC_COUNT);
+	stats->metrics[metric].samples[stats->metrics[metric].len % WLR_FRAME_STATS_WINDOW] =
+		duration_ns;
+	stats->metrics[metric].len++;
+}
+
+void wlr_frame_stats_add_render_timer(struct wlr_frame_stats *stats,
+		struct wlr_render_timer *timer) {
+	if (stats->render_timer != NULL) {
+		wlr_render_timer_destroy(stats->render_timer);
+	}
+	stats->render_timer = timer;
+}
+
+static int compare_samples(const void *a, const void *b) {
+	int64_t sa = *(const int64_t *)a, sb = *(const int64_t *)b;
+	return (sa > sb) - (sa < sb);
+}
+
+bool wlr_frame_stats_get_summary(struct wlr_frame_stats *stats,
+		enum wlr_frame_stats_metric metric, struct wlr_frame_stats_summary *summary) {
+	assert(metric < WLR_FRAME_STATS_METRIC_COUNT);
+	*summary = (struct wlr_frame_stats_summary){0};
+
+	size_t n = stats->metrics[metric].len;
+	if (n > WLR_FRAME_STATS_WINDOW) {
+		n = WLR_FRAME_STATS_WINDOW;
+	}
+	if (n == 0) {
+		return false;
+	}
+
+	int64_t sorted[WLR_FRAME_STATS_WINDOW];
+	memcpy(sorted, stats->metrics[metric].samples, n * sizeof(sorted[0]));
+	qsort(sorted, n, sizeof(sorted[0]), compare_samples);
+
+	int64_t sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		sum += sorted[i];
+	}
+
+	// Nearest-rank percentile
+	size_t p99 = (n * 99 + 99) / 100;
+
+	*summary = (struct wlr_frame_stats_summary){
+		.samples = n,
+		.min_ns = sorted[0],
+		.avg_ns = sum / (int64_t)n,
+		.p99_ns = sorted[p99 - 1],
+		.max_ns = sorted[n - 1],
+	};
+	return true;
+}
+
+void wlr_frame_stats_reset(struct wlr_frame_stats *stats) {
+	for (size_t i = 0; i < WLR_FRAME_STATS_METRIC_COUNT; i++) {
+		stats->metrics[i].len = 0;
+	}
+	stats->presented = 0;
+	stats->dropped = 0;
+}
+
+void wlr_frame_stats_log(struct wlr_frame_stats *stats,
+		enum wlr_log_importance verbosity) {
+	if (verbosity > wlr_log_get_verbosity()) {
+		return;
+	}
+
+	wlr_log(verbosity, "Frame statistics for output %s: "
+		"%"PRIu64" frames presented, %"PRIu64" dropped",
+		stats->output->name, stats->presented, stats->dropped);
+
+	for (size_t i = 0; i < WLR_FRAME_STATS_METRIC_COUNT; i++) {
+		struct wlr_frame_stats_summary summary;
+		if (!wlr_frame_stats_get_summary(stats, i, &summary)) {
+			continue;
+		}
+		wlr_log(verbosity, "  %s: min %.3f ms, avg %.3f ms, p99 %.3f ms, "
+			"max %.3f ms (%zu samples)", metric_names[i],
+			summary.min_ns / 1e6, summary.avg_ns / 1e6,
+			summary.p99_ns / 1e6, summary.max_ns / 1e6, summary.samples);
+	}
+}
@@ -1,11 +1,13 @@
 #undef _POSIX_C_SOURCE
-#define _DEFAULT_SOURCE // for MAP_ANONYMOUS
+#define _GNU_SOURCE // for MAP_ANONYMOUS and F_GET_SEALS
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wayland-server-protocol.h>
 #include <wlr/interfaces/wlr_buffer.h>
@@ -14,6 +16,7 @@
 #include <wlr/types/wlr_shm.h>
 #include <wlr/util/log.h>
 #include "render/pixel_format.h"
+#include "util/env.h"
 
 #ifdef __STDC_NO_ATOMICS__
 #error "C11 atomics are required"
@@ -29,6 +32,8 @@ struct wlr_shm_pool {
 	struct wlr_shm *shm;
 	struct wl_list buffers; // wlr_shm_buffer.link
 	int fd;
+	// The file is sealed against shrinking
+	bool sealed;
 	struct wlr_shm_mapping *mapping;
 };
 
@@ -44,6 +49,10 @@ struct wlr_shm_mapping {
 	void *data;
 	size_t size;
 	bool dropped; // false while a wlr_shm_pool references this mapping
+	// The file is sealed against shrinking and covers the whole mapping, so
+	// accessing the mapping can't raise SIGBUS
+	bool sealed;
+	size_t unguarded_accesses;
 };
 
 struct wlr_shm_sigbus_data {
@@ -63,7 +72,10 @@ struct wlr_shm_buffer {
 
 	struct wl_listener release;
 
+	// The mapping is set for the duration of a data pointer access, the rest
+	// only if the access is guarded against SIGBUS
 	struct wlr_shm_sigbus_data sigbus_data;
+	bool sigbus_guarded;
 };
 
 // Needs to be a lock-free atomic because it's accessed from a signal handler
@@ -98,13 +110,48 @@ static struct wlr_shm *shm_from_resource(struct wl_resource *resource) {
 	return wl_resource_get_user_data(resource);
 }
 
-static struct wlr_shm_mapping *mapping_create(int fd, size_t size) {
-	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+/**
+ * Check whether a client file is sealed against shrinking. Seals can't be
+ * removed, so this holds for the lifetime of the file.
+ */
+static bool fd_is_sealed(int fd) {
+#ifdef F_GET_SEALS
+	int seals = fcntl(fd, F_GET_SEALS);
+	return seals >= 0 && (seals & F_SEAL_SHRINK);
+#else
+	return false;
+#endif
+}
+
+static bool fd_covers_size(int fd, size_t size) {
+	struct stat st;
+	return fstat(fd, &st) == 0 && st.st_size >= 0 && (size_t)st.st_size >= size;
+}
+
+static struct wlr_shm_mapping *mapping_create(struct wlr_shm *shm, int fd,
+		size_t size, bool sealed) {
+	sealed = sealed && fd_covers_size(fd, size);
+
+	int flags = MAP_SHARED;
+	bool prefault = false;
+#ifdef MAP_POPULATE
+	// Only prefault files known to cover the whole mapping
+	if (shm->populate && sealed) {
+		flags |= MAP_POPULATE;
+		prefault = true;
+	}
+#endif
+
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
 	if (data == MAP_FAILED) {
 		wlr_log_errno(WLR_DEBUG, "mmap failed");
 		return NULL;
 	}
 
+	if (shm->populate && !prefault) {
+		madvise(data, size, MADV_WILLNEED);
+	}
+
 	struct wlr_shm_mapping *mapping = calloc(1, sizeof(*mapping));
 	if (mapping == NULL) {
 		munmap(data, size);
@@ -113,11 +160,12 @@ static struct wlr_shm_mapping *mapping_create(int fd, size_t size) {
 
 	mapping->data = data;
 	mapping->size = size;
+	mapping->sealed = sealed;
 	return mapping;
 }
 
 static void mapping_consider_destroy(struct wlr_shm_mapping *mapping) {
-	if (!mapping->dropped) {
+	if (!mapping->dropped || mapping->unguarded_accesses > 0) {
 		return;
 	}
 
@@ -217,6 +265,19 @@ reraise:
 static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
 		uint32_t flags, void **data, uint32_t *format, size_t *stride) {
 	struct wlr_shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	struct wlr_shm_mapping *mapping = buffer->pool->mapping;
+
+	*data = (char *)mapping->data + buffer->offset;
+	*format = buffer->drm_format;
+	*stride = buffer->stride;
+
+	if (mapping->sealed) {
+		// No need to guard against SIGBUS, only keep the mapping alive
+		buffer->sigbus_data = (struct wlr_shm_sigbus_data){ .mapping = mapping };
+		buffer->sigbus_guarded = false;
+		mapping->unguarded_accesses++;
+		return true;
+	}
 
 	if (!atomic_is_lock_free(&sigbus_data)) {
 		wlr_log(WLR_ERROR, "Lock-free atomic pointers are required");
@@ -239,24 +300,27 @@ static bool buffer_begin_data_ptr_access(struct wlr_buffer *wlr_buffer,
 		prev_action = sigbus_data->prev_action;
 	}
 
-	struct wlr_shm_mapping *mapping = buffer->pool->mapping;
-
 	buffer->sigbus_data = (struct wlr_shm_sigbus_data){
 		.mapping = mapping,
 		.prev_action = prev_action,
 		.next = sigbus_data,
 	};
+	buffer->sigbus_guarded = true;
 	sigbus_data = &buffer->sigbus_data;
-
-	*data = (char *)mapping->data + buffer->offset;
-	*format = buffer->drm_format;
-	*stride = buffer->stride;
 	return true;
 }
 
 static void buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
 	struct wlr_shm_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
 
+	if (!buffer->sigbus_guarded) {
+		struct wlr_shm_mapping *mapping = buffer->sigbus_data.mapping;
+		assert(mapping->unguarded_accesses > 0);
+		mapping->unguarded_accesses--;
+		mapping_consider_destroy(mapping);
+		return;
+	}
+
 	if (sigbus_data == &buffer->sigbus_data) {
 		sigbus_data = buffer->sigbus_data.next;
 	} else {
@@ -380,7 +444,8 @@ static void pool_handle_resize(struct wl_client *client,
 		return;
 	}
 
-	struct wlr_shm_mapping *mapping = mapping_create(pool->fd, size);
+	struct wlr_shm_mapping *mapping =
+		mapping_create(pool->shm, pool->fd, size, pool->sealed);
 	if (mapping == NULL) {
 		wl_resource_post_error(pool_resource, WL_SHM_ERROR_INVALID_FD,
 			"Failed to create memory mapping");
@@ -423,7 +488,8 @@ static void shm_handle_create_pool(struct wl_client *client,
 		goto error_fd;
 	}
 
-	struct wlr_shm_mapping *mapping = mapping_create(fd, size);
+	bool sealed = fd_is_sealed(fd);
+	struct wlr_shm_mapping *mapping = mapping_create(shm, fd, size, sealed);
 	if (mapping == NULL) {
 		wl_resource_post_error(shm_resource, WL_SHM_ERROR_INVALID_FD,
 			"Failed to create memory mapping");
@@ -449,6 +515,7 @@ static void shm_handle_create_pool(struct wl_client *client,
 	pool->mapping = mapping;
 	pool->shm = shm;
 	pool->fd = fd;
+	pool->sealed = sealed;
 	wl_list_init(&pool->buffers);
 	return;
 
@@ -539,6 +606,8 @@ struct wlr_shm *wlr_shm_create(struct wl_display *display, uint32_t version,
 		return NULL;
 	}
 
+	shm->populate = env_parse_bool("WLR_SHM_POPULATE");
+
 	shm->display_destroy.notify = handle_display_destroy;
 	wl_display_add_destroy_listener(display, &shm->display_destroy);
 
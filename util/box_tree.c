@@ -0,0 +1,334 @@
+#include <assert.h>
+#include "util/box_tree.h"
+
+struct box_tree_node {
+	pixman_box32_t box;
+	void *data;
+	int parent; // next free node if this node is unused
+	int child1, child2; // -1 for leaves
+	int height; // 0 for leaves, -1 for unused nodes
+};
+
+static struct box_tree_node *tree_node(struct box_tree *tree, int i) {
+	assert(i >= 0 && (size_t)i < tree->nodes.size / sizeof(struct box_tree_node));
+	struct box_tree_node *nodes = tree->nodes.data;
+	return &nodes[i];
+}
+
+static bool node_is_leaf(const struct box_tree_node *node) {
+	return node->child1 < 0;
+}
+
+static pixman_box32_t box_union(const pixman_box32_t *a, const pixman_box32_t *b) {
+	return (pixman_box32_t){
+		.x1 = a->x1 < b->x1 ? a->x1 : b->x1,
+		.y1 = a->y1 < b->y1 ? a->y1 : b->y1,
+		.x2 = a->x2 > b->x2 ? a->x2 : b->x2,
+		.y2 = a->y2 > b->y2 ? a->y2 : b->y2,
+	};
+}
+
+static int64_t box_perimeter(const pixman_box32_t *box) {
+	return 2 * ((int64_t)box->x2 - box->x1 + (int64_t)box->y2 - box->y1);
+}
+
+static bool box_overlaps(const pixman_box32_t *a, const pixman_box32_t *b) {
+	return a->x1 < b->x2 && b->x1 < a->x2 && a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static int max_int(int a, int b) {
+	return a > b ? a : b;
+}
+
+void box_tree_init(struct box_tree *tree) {
+	*tree = (struct box_tree){
+		.root = -1,
+		.free_list = -1,
+	};
+	wl_array_init(&tree->nodes);
+}
+
+void box_tree_finish(struct box_tree *tree) {
+	wl_array_release(&tree->nodes);
+}
+
+static int allocate_node(struct box_tree *tree) {
+	int i;
+	if (tree->free_list >= 0) {
+		i = tree->free_list;
+		tree->free_list = tree_node(tree, i)->parent;
+	} else {
+		struct box_tree_node *node = wl_array_add(&tree->nodes, sizeof(*node));
+		if (node == NULL) {
+			return -1;
+		}
+		i = tree->nodes.size / sizeof(*node) - 1;
+	}
+
+	*tree_node(tree, i) = (struct box_tree_node){
+		.parent = -1,
+		.child1 = -1,
+		.child2 = -1,
+	};
+	return i;
+}
+
+static void free_node(struct box_tree *tree, int i) {
+	struct box_tree_node *node = tree_node(tree, i);
+	node->parent = tree->free_list;
+	node->height = -1;
+	node->data = NULL;
+	tree->free_list = i;
+}
+
+static void replace_child(struct box_tree *tree, int parent, int old, int new) {
+	if (parent < 0) {
+		tree->root = new;
+		return;
+	}
+
+	struct box_tree_node *node = tree_node(tree, parent);
+	if (node->child1 == old) {
+		node->child1 = new;
+	} else {
+		assert(node->child2 == old);
+		node->child2 = new;
+	}
+}
+
+/**
+ * Perform a left or right rotation if the subtree rooted at `ia` is
+ * imbalanced. Returns the new root of the subtree.
+ */
+static int balance(struct box_tree *tree, int ia) {
+	struct box_tree_node *a = tree_node(tree, ia);
+	if (node_is_leaf(a) || a->height < 2) {
+		return ia;
+	}
+
+	int ib = a->child1;
+	int ic = a->child2;
+	struct box_tree_node *b = tree_node(tree, ib);
+	struct box_tree_node *c = tree_node(tree, ic);
+
+	int diff = c->height - b->height;
+	if (diff > 1) {
+		// Rotate c up
+		int i_f = c->child1;
+		int ig = c->child2;
+		struct box_tree_node *f = tree_node(tree, i_f);
+		struct box_tree_node *g = tree_node(tree, ig);
+
+		c->child1 = ia;
+		c->parent = a->parent;
+		a->parent = ic;
+		replace_child(tree, c->parent, ia, ic);
+
+		if (f->height > g->height) {
+			c->child2 = i_f;
+			a->child2 = ig;
+			g->parent = ia;
+			a->box = box_union(&b->box, &g->box);
+			c->box = box_union(&a->box, &f->box);
+			a->height = 1 + max_int(b->height, g->height);
+			c->height = 1 + max_int(a->height, f->height);
+		} else {
+			c->child2 = ig;
+			a->child2 = i_f;
+			f->parent = ia;
+			a->box = box_union(&b->box, &f->box);
+			c->box = box_union(&a->box, &g->box);
+			a->height = 1 + max_int(b->height, f->height);
+			c->height = 1 + max_int(a->height, g->height);
+		}
+
+		return ic;
+	} else if (diff < -1) {
+		// Rotate b up
+		int id = b->child1;
+		int ie = b->child2;
+		struct box_tree_node *d = tree_node(tree, id);
+		struct box_tree_node *e = tree_node(tree, ie);
+
+		b->child1 = ia;
+		b->parent = a->parent;
+		a->parent = ib;
+		replace_child(tree, b->parent, ia, ib);
+
+		if (d->height > e->height) {
+			b->child2 = id;
+			a->child1 = ie;
+			e->parent = ia;
+			a->box = box_union(&c->box, &e->box);
+			b->box = box_union(&a->box, &d->box);
+			a->height = 1 + max_int(c->height, e->height);
+			b->height = 1 + max_int(a->height, d->height);
+		} else {
+			b->child2 = ie;
+			a->child1 = id;
+			d->parent = ia;
+			a->box = box_union(&c->box, &d->box);
+			b->box = box_union(&a->box, &e->box);
+			a->height = 1 + max_int(c->height, d->height);
+			b->height = 1 + max_int(a->height, e->height);
+		}
+
+		return ib;
+	}
+
+	return ia;
+}
+
+static void refit_ancestors(struct box_tree *tree, int i) {
+	while (i >= 0) {
+		i = balance(tree, i);
+
+		struct box_tree_node *node = tree_node(tree, i);
+		struct box_tree_node *child1 = tree_node(tree, node->child1);
+		struct box_tree_node *child2 = tree_node(tree, node->child2);
+		node->height = 1 + max_int(child1->height, child2->height);
+		node->box = box_union(&child1->box, &child2->box);
+
+		i = node->parent;
+	}
+}
+
+static void insert_leaf(struct box_tree *tree, int leaf, int new_parent) {
+	if (tree->root < 0) {
+		tree->root = leaf;
+		return;
+	}
+
+	// Find the best sibling by descending the tree, using the increase in
+	// perimeter as the cost heuristic
+	pixman_box32_t leaf_box = tree_node(tree, leaf)->box;
+	int i = tree->root;
+	while (!node_is_leaf(tree_node(tree, i))) {
+		struct box_tree_node *node = tree_node(tree, i);
+		pixman_box32_t combined = box_union(&node->box, &leaf_box);
+		int64_t cost = 2 * box_perimeter(&combined);
+		int64_t inheritance = 2 * (box_perimeter(&combined) - box_perimeter(&node->box));
+
+		int64_t child_cost[2];
+		int children[2] = { node->child1, node->child2 };
+		for (int j = 0; j < 2; j++) {
+			struct box_tree_node *child = tree_node(tree, children[j]);
+			pixman_box32_t child_combined = box_union(&child->box, &leaf_box);
+			child_cost[j] = box_perimeter(&child_combined) + inheritance;
+			if (!node_is_leaf(child)) {
+				child_cost[j] -= box_perimeter(&child->box);
+			}
+		}
+
+		if (cost < child_cost[0] && cost < child_cost[1]) {
+			break;
+		}
+
+		i = child_cost[0] < child_cost[1] ? children[0] : children[1];
+	}
+
+	int sibling = i;
+	struct box_tree_node *sibling_node = tree_node(tree, sibling);
+	struct box_tree_node *parent_node = tree_node(tree, new_parent);
+	int old_parent = sibling_node->parent;
+
+	parent_node->parent = old_parent;
+	parent_node->box = box_union(&sibling_node->box, &leaf_box);
+	parent_node->height = sibling_node->height + 1;
+	parent_node->child1 = sibling;
+	parent_node->child2 = leaf;
+	replace_child(tree, old_parent, sibling, new_parent);
+
+	sibling_node->parent = new_parent;
+	tree_node(tree, leaf)->parent = new_parent;
+
+	refit_ancestors(tree, new_parent);
+}
+
+static void remove_leaf(struct box_tree *tree, int leaf) {
+	if (leaf == tree->root) {
+		tree->root = -1;
+		return;
+	}
+
+	int parent = tree_node(tree, leaf)->parent;
+	struct box_tree_node *parent_node = tree_node(tree, parent);
+	int grand_parent = parent_node->parent;
+	int sibling = parent_node->child1 == leaf ?
+		parent_node->child2 : parent_node->child1;
+
+	replace_child(tree, grand_parent, parent, sibling);
+	tree_node(tree, sibling)->parent = grand_parent;
+	free_node(tree, parent);
+
+	if (grand_parent >= 0) {
+		refit_ancestors(tree, grand_parent);
+	}
+}
+
+int box_tree_insert(struct box_tree *tree, pixman_box32_t box, void *data) {
+	// Allocate both nodes upfront so that a failure leaves the tree untouched
+	int leaf = allocate_node(tree);
+	if (leaf < 0) {
+		return -1;
+	}
+
+	int parent = -1;
+	if (tree->root >= 0) {
+		parent = allocate_node(tree);
+		if (parent < 0) {
+			free_node(tree, leaf);
+			return -1;
+		}
+	}
+
+	struct box_tree_node *node = tree_node(tree, leaf);
+	node->box = box;
+	node->data = data;
+
+	insert_leaf(tree, leaf, parent);
+	tree->leaves++;
+	return leaf;
+}
+
+void box_tree_remove(struct box_tree *tree, int leaf) {
+	assert(node_is_leaf(tree_node(tree, leaf)) &&
+		tree_node(tree, leaf)->height == 0);
+
+	remove_leaf(tree, leaf);
+	free_node(tree, leaf);
+	tree->leaves--;
+}
+
+int box_tree_move(struct box_tree *tree, int leaf, pixman_box32_t box) {
+	void *data = tree_node(tree, leaf)->data;
+	box_tree_remove(tree, leaf);
+	return box_tree_insert(tree, box, data);
+}
+
+const pixman_box32_t *box_tree_get_box(struct box_tree *tree, int leaf) {
+	return &tree_node(tree, leaf)->box;
+}
+
+static bool query_node(struct box_tree *tree, int i, const pixman_box32_t *box,
+		box_tree_iterator_func_t iterator, void *user_data) {
+	struct box_tree_node *node = tree_node(tree, i);
+	if (!box_overlaps(&node->box, box)) {
+		return false;
+	}
+
+	if (node_is_leaf(node)) {
+		return iterator(node->data, &node->box, user_data);
+	}
+
+	return query_node(tree, node->child1, box, iterator, user_data) ||
+		query_node(tree, node->child2, box, iterator, user_data);
+}
+
+bool box_tree_query(struct box_tree *tree, const pixman_box32_t *box,
+		box_tree_iterator_func_t iterator, void *user_data) {
+	if (tree->root < 0) {
+		return false;
+	}
+	return query_node(tree, tree->root, box, iterator, user_data);
+}
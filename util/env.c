@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <wlr/util/log.h>
@@ -36,3 +37,22 @@ size_t env_parse_switch(const char *option, const char **switches) {
 	wlr_log(WLR_ERROR, "Unknown %s option: %s", option, env);
 	return 0;
 }
+
+long env_parse_uint(const char *option, long default_value) {
+	const char *env = getenv(option);
+	if (env) {
+		wlr_log(WLR_INFO, "Loading %s option: %s", option, env);
+	} else {
+		return default_value;
+	}
+
+	char *end;
+	errno = 0;
+	long value = strtol(env, &end, 10);
+	if (errno != 0 || end == env || *end != '\0' || value < 0) {
+		wlr_log(WLR_ERROR, "Unknown %s option: %s", option, env);
+		return default_value;
+	}
+
+	return value;
+}
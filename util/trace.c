@@ -0,0 +1,158 @@
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "util/env.h"
+#include "util/time.h"
+#include "util/trace.h"
+
+#define DEFAULT_BUFFER_SIZE 65536
+
+struct trace_event {
+	const char *name;
+	int64_t time; // nanoseconds, CLOCK_MONOTONIC
+	int64_t value;
+	char phase;
+};
+
+static struct {
+	const char *path;
+	struct trace_event *events;
+	size_t events_cap;
+	// Number of events recorded so far, older ones being overwritten once
+	// the ring buffer is full
+	size_t events_len;
+	volatile sig_atomic_t dump_requested;
+} trace;
+
+enum trace_state trace_state = TRACE_UNINITIALIZED;
+
+static void trace_dump(void) {
+	FILE *f = fopen(trace.path, "w");
+	if (f == NULL) {
+		wlr_log_errno(WLR_ERROR, "Failed to open trace file %s", trace.path);
+		return;
+	}
+
+	int pid = getpid();
+	size_t start = trace.events_len > trace.events_cap ?
+		trace.events_len - trace.events_cap : 0;
+
+	fprintf(f, "{\"traceEvents\":[");
+	for (size_t i = start; i < trace.events_len; i++) {
+		const struct trace_event *event = &trace.events[i % trace.events_cap];
+		fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRId64 ".%03d,"
+			"\"pid\":%d,\"tid\":%d", i > start ? "," : "", event->name,
+			event->phase, event->time / 1000, (int)(event->time % 1000), pid, pid);
+		switch (event->phase) {
+		case 'C':
+			fprintf(f, ",\"args\":{\"value\":%" PRId64 "}", event->value);
+			break;
+		case 'i':
+			fprintf(f, ",\"s\":\"p\"");
+			break;
+		}
+		fprintf(f, "}");
+	}
+	fprintf(f, "\n]}\n");
+
+	if (fclose(f) != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to write trace file %s", trace.path);
+		return;
+	}
+	wlr_log(WLR_INFO, "Wrote %zu trace events to %s",
+		trace.events_len - start, trace.path);
+}
+
+static void handle_exit(void) {
+	trace_dump();
+	free(trace.events);
+	trace.events = NULL;
+	trace_state = TRACE_DISABLED;
+}
+
+static void handle_signal(int signo) {
+	// Writing the trace isn't async-signal-safe, defer it to the next event
+	trace.dump_requested = 1;
+}
+
+void trace_init(void) {
+	trace_state = TRACE_DISABLED;
+
+	trace.path = getenv("WLR_TRACE");
+	if (trace.path == NULL || trace.path[0] == '\0') {
+		return;
+	}
+
+	long cap = env_parse_uint("WLR_TRACE_BUFFER_SIZE", DEFAULT_BUFFER_SIZE);
+	trace.events_cap = cap > 0 ? (size_t)cap : DEFAULT_BUFFER_SIZE;
+	trace.events = calloc(trace.events_cap, sizeof(*trace.events));
+	if (trace.events == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+
+	if (atexit(handle_exit) != 0) {
+		wlr_log(WLR_ERROR, "Failed to register trace exit handler");
+		free(trace.events);
+		trace.events = NULL;
+		return;
+	}
+
+	// Don't steal the signal from the compositor
+	struct sigaction old_action;
+	if (sigaction(SIGUSR2, NULL, &old_action) == 0 &&
+			old_action.sa_handler == SIG_DFL) {
+		struct sigaction action = {
+			.sa_handler = handle_signal,
+			.sa_flags = SA_RESTART,
+		};
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGUSR2, &action, NULL);
+	} else {
+		wlr_log(WLR_ERROR, "SIGUSR2 is already handled, "
+			"the trace will only be written on exit");
+	}
+
+	wlr_log(WLR_INFO, "Tracing to %s, keeping the last %zu events",
+		trace.path, trace.events_cap);
+	trace_state = TRACE_ENABLED;
+}
+
+static void record(char phase, const char *name, int64_t value) {
+	if (trace.dump_requested) {
+		trace.dump_requested = 0;
+		trace_dump();
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	struct trace_event *event = &trace.events[trace.events_len % trace.events_cap];
+	*event = (struct trace_event){
+		.name = name,
+		.time = timespec_to_nsec(&now),
+		.value = value,
+		.phase = phase,
+	};
+	trace.events_len++;
+}
+
+void trace_begin(const char *name) {
+	record('B', name, 0);
+}
+
+void trace_end(const char *name) {
+	record('E', name, 0);
+}
+
+void trace_counter(const char *name, int64_t value) {
+	record('C', name, value);
+}
+
+void trace_instant(const char *name) {
+	record('i', name, 0);
+}